@@ -5,5 +5,6 @@ include(../config.pri)
 
 win32|!system_qwt:SUBDIRS += qwt
 !win32:SUBDIRS += qextserialport
+SUBDIRS += zstd
 python:SUBDIRS += pythonqt
 qsci_editor:SUBDIRS += qscintilla2
@@ -0,0 +1,43 @@
+# Zstandard compression library, used for compressed data files
+TEMPLATE = lib
+CONFIG += staticlib warn_off
+CONFIG -= qt
+TARGET = zstd_lorris
+DESTDIR = $$PWD/lib
+
+# huf_decompress_amd64.S is not included
+DEFINES += ZSTD_DISABLE_ASM ZSTD_LEGACY_SUPPORT=0
+
+INCLUDEPATH += src src/common
+
+HEADERS += \
+    src/zstd.h \
+    src/zstd_errors.h
+
+SOURCES += \
+    src/common/debug.c \
+    src/common/entropy_common.c \
+    src/common/error_private.c \
+    src/common/fse_decompress.c \
+    src/common/pool.c \
+    src/common/threading.c \
+    src/common/xxhash.c \
+    src/common/zstd_common.c \
+    src/compress/fse_compress.c \
+    src/compress/hist.c \
+    src/compress/huf_compress.c \
+    src/compress/zstd_compress.c \
+    src/compress/zstd_compress_literals.c \
+    src/compress/zstd_compress_sequences.c \
+    src/compress/zstd_compress_superblock.c \
+    src/compress/zstd_double_fast.c \
+    src/compress/zstd_fast.c \
+    src/compress/zstd_lazy.c \
+    src/compress/zstd_ldm.c \
+    src/compress/zstd_opt.c \
+    src/compress/zstd_preSplit.c \
+    src/compress/zstdmt_compress.c \
+    src/decompress/huf_decompress.c \
+    src/decompress/zstd_ddict.c \
+    src/decompress/zstd_decompress.c \
+    src/decompress/zstd_decompress_block.c
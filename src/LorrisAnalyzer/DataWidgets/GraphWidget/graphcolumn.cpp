@@ -0,0 +1,433 @@
+/**********************************************
+**    This file is part of Lorris
+**    http://tasssadar.github.com/Lorris/
+**
+**    See README and COPYING
+***********************************************/
+
+#include <string.h>
+#include <algorithm>
+
+#include "graphcolumn.h"
+#include "../datawidget.h"
+#include "../../storage.h"
+#include "../../../misc/formulaevaluation.h"
+#include "../../../misc/utils.h"
+
+// Blocks of the lowest pyramid level have 32 values,
+// each next level merges 4 blocks of the previous one
+#define LOD_BASE_SHIFT  5
+#define LOD_LEVEL_SHIFT 2
+#define LOD_MAX_LEVELS  12
+#define LOD_TOP_BLOCKS  256
+
+static std::vector<GraphColumn*> columns;
+
+static inline int lodShift(size_t level)
+{
+    return LOD_BASE_SHIFT + level*LOD_LEVEL_SHIFT;
+}
+
+// Positions go negative when values are prepended, round down for those too
+static inline qint64 blockOf(qint64 pos, int shift)
+{
+    return pos >= 0 ? (pos >> shift) : -((-pos - 1) >> shift) - 1;
+}
+
+GraphColumn *GraphColumn::acquire(Storage *storage, DataFilter *filter, quint32 pos,
+                                  quint8 type, const QString& formula)
+{
+    for(size_t i = 0; i < columns.size(); ++i)
+    {
+        GraphColumn *c = columns[i];
+        if(c->m_storage == storage && c->m_filter == filter && c->m_pos == pos &&
+           c->m_type == type && c->m_formula == formula)
+        {
+            ++c->m_refs;
+            return c;
+        }
+    }
+
+    GraphColumn *c = new GraphColumn(storage, filter, pos, type, formula);
+    columns.push_back(c);
+    return c;
+}
+
+void GraphColumn::release(GraphColumn *column)
+{
+    if(!column || --column->m_refs != 0)
+        return;
+
+    columns.erase(std::find(columns.begin(), columns.end(), column));
+    delete column;
+}
+
+GraphColumn::GraphColumn(Storage *storage, DataFilter *filter, quint32 pos, quint8 type, const QString& formula)
+{
+    m_storage = storage;
+    m_filter = filter;
+    m_pos = pos;
+    m_type = type;
+    m_formula = formula;
+    m_refs = 1;
+
+    m_eval = NULL;
+    if(!formula.isEmpty())
+    {
+        m_eval = new FormulaEvaluation();
+        m_eval->setFormula(formula);
+        if(!m_eval->isActive())
+        {
+            delete m_eval;
+            m_eval = NULL;
+        }
+    }
+
+    m_shift = 0;
+    m_from = m_to = 0;
+    m_window = 0;
+    m_lod_begin = m_lod_end = 0;
+    m_generation = m_filter ? m_filter->getMatchGeneration() : 0;
+    m_version = 0;
+}
+
+GraphColumn::~GraphColumn()
+{
+    delete m_eval;
+}
+
+size_t GraphColumn::physical(qint64 pos) const
+{
+    // Curves have to look up their positions again when version() changes
+    Q_ASSERT(pos >= m_shift && size_t(pos - m_shift) < m_seqs.size());
+    return pos - m_shift;
+}
+
+void GraphColumn::reset()
+{
+    if(!m_seqs.empty())
+        ++m_version;
+
+    m_shift += m_seqs.size();
+    m_seqs.clear();
+    m_values.clear();
+    m_from = m_to = 0;
+
+    m_lod.clear();
+    m_lod_begin = m_lod_end = m_shift;
+}
+
+void GraphColumn::trim(quint64 cut)
+{
+    const size_t count = std::lower_bound(m_seqs.begin(), m_seqs.end(), cut) - m_seqs.begin();
+
+    // Moving the arrays is expensive, so do it only
+    // when at least half of them can go away
+    if(count == 0 || count*2 < m_seqs.size())
+        return;
+
+    m_seqs.erase(m_seqs.begin(), m_seqs.begin() + count);
+    m_values.erase(m_values.begin(), m_values.begin() + count);
+    m_shift += count;
+    ++m_version;
+
+    m_from = (std::max)(m_from, cut);
+    m_to = (std::max)(m_to, m_from);
+}
+
+// span holds packets from matches.front() on, those removed
+// from Storage before it was filled are missing at its start
+template <typename T>
+static void decodeNumbers(const analyzer_span& span, const std::vector<quint64>& matches, quint32 pos,
+                          bool big_endian, std::vector<quint64>& seqs, std::vector<double>& values)
+{
+    T val;
+    for(size_t i = 0; i < matches.size(); ++i)
+    {
+        if(matches[i] < span.first_seq)
+            continue;
+
+        const quint64 idx = matches[i] - span.first_seq;
+        if(idx >= span.count())
+            break;
+
+        if(pos + sizeof(T) > span.sizes[idx])
+            continue;
+
+        memcpy(&val, span.data[idx] + pos, sizeof(T));
+        if(big_endian && sizeof(T) > 1)
+            Utils::swapEndian(val);
+
+        seqs.push_back(matches[i]);
+        values.push_back(double(val));
+    }
+}
+
+void GraphColumn::decode(quint64 from, quint64 to, std::vector<quint64>& seqs, std::vector<double>& values)
+{
+    m_filter->getMatchSeqs(from, to, m_matches);
+
+    analyzer_packet *packet = m_storage->getPacket();
+    if(m_matches.empty() || !packet)
+        return;
+
+    seqs.reserve(seqs.size() + m_matches.size());
+    values.reserve(values.size() + m_matches.size());
+
+    const size_t start = values.size();
+    const bool big = packet->big_endian;
+
+    // All packets of the range are copied under one lock of the storage,
+    // matches are from Storage, so they can't span more than quint32 packets
+    const quint32 count = m_matches.back() - m_matches.front() + 1;
+    m_storage->getSpanFrom(m_matches.front(), count, m_span);
+
+    // Type is resolved once for the whole range, not for every value
+    switch(m_type)
+    {
+        case NUM_UINT8:  decodeNumbers<quint8> (m_span, m_matches, m_pos, big, seqs, values); break;
+        case NUM_UINT16: decodeNumbers<quint16>(m_span, m_matches, m_pos, big, seqs, values); break;
+        case NUM_UINT32: decodeNumbers<quint32>(m_span, m_matches, m_pos, big, seqs, values); break;
+        case NUM_UINT64: decodeNumbers<quint64>(m_span, m_matches, m_pos, big, seqs, values); break;
+        case NUM_INT8:   decodeNumbers<qint8>  (m_span, m_matches, m_pos, big, seqs, values); break;
+        case NUM_INT16:  decodeNumbers<qint16> (m_span, m_matches, m_pos, big, seqs, values); break;
+        case NUM_INT32:  decodeNumbers<qint32> (m_span, m_matches, m_pos, big, seqs, values); break;
+        case NUM_INT64:  decodeNumbers<qint64> (m_span, m_matches, m_pos, big, seqs, values); break;
+        case NUM_FLOAT:  decodeNumbers<float>  (m_span, m_matches, m_pos, big, seqs, values); break;
+        case NUM_DOUBLE: decodeNumbers<double> (m_span, m_matches, m_pos, big, seqs, values); break;
+    }
+
+    // Don't keep copy of the whole range around
+    m_span.buffer.clear();
+
+    if(m_eval && values.size() > start)
+        m_eval->evaluate(&values[start], values.size() - start);
+}
+
+void GraphColumn::fill(quint64 lo, quint64 hi)
+{
+    if(m_filter.isNull())
+    {
+        reset();
+        return;
+    }
+
+    if(m_filter->getMatchGeneration() != m_generation)
+    {
+        reset();
+        m_generation = m_filter->getMatchGeneration();
+    }
+
+    const quint64 base = m_storage->getFirstSeq();
+    lo = (std::max)(lo, base);
+    if(hi <= lo)
+        return;
+
+    m_window = (std::max)(m_window, hi - lo);
+
+    // Requested range does not touch what is in the column, start over
+    if(m_from == m_to || hi < m_from || lo > m_to)
+    {
+        reset();
+        m_from = m_to = lo;
+    }
+
+    if(lo < m_from)
+    {
+        std::vector<quint64> seqs;
+        std::vector<double> values;
+        decode(lo, m_from, seqs, values);
+
+        m_seqs.insert(m_seqs.begin(), seqs.begin(), seqs.end());
+        m_values.insert(m_values.begin(), values.begin(), values.end());
+        m_shift -= seqs.size();
+        m_from = lo;
+    }
+
+    if(hi > m_to)
+    {
+        decode(m_to, hi, m_seqs, m_values);
+        m_to = hi;
+    }
+
+    // Drop packets which are not in Storage anymore and those
+    // far behind the biggest window any curve asked for
+    trim((std::max)(base, hi > 2*m_window ? hi - 2*m_window : 0));
+
+    updateLod();
+}
+
+void GraphColumn::range(quint64 from, quint64 to, qint64& begin, qint64& end) const
+{
+    begin = m_shift + (std::lower_bound(m_seqs.begin(), m_seqs.end(), from) - m_seqs.begin());
+    end = m_shift + (std::lower_bound(m_seqs.begin(), m_seqs.end(), to) - m_seqs.begin());
+    end = (std::max)(begin, end);
+}
+
+qint64 GraphColumn::lowerBound(quint64 seq, qint64 begin, qint64 end) const
+{
+    Q_ASSERT(begin <= end && begin >= m_shift && end <= qint64(m_shift + m_seqs.size()));
+
+    const std::vector<quint64>::const_iterator first = m_seqs.begin() + (begin - m_shift);
+    const std::vector<quint64>::const_iterator last = m_seqs.begin() + (end - m_shift);
+    return begin + (std::lower_bound(first, last, seq) - first);
+}
+
+bool GraphColumn::isBlockClean(qint64 block, int shift, qint64 keep_begin, qint64 keep_end) const
+{
+    if(keep_begin >= keep_end)
+        return false;
+
+    // The block has to cover the same positions as it did last time,
+    // and all of them must be from the part which did not change
+    const qint64 bs = block * (qint64(1) << shift);
+    const qint64 be = bs + (qint64(1) << shift);
+    const qint64 end = m_shift + m_values.size();
+
+    return (std::max)(bs, m_shift) >= keep_begin && (std::min)(be, end) <= keep_end &&
+           (std::max)(bs, m_lod_begin) >= keep_begin && (std::min)(be, m_lod_end) <= keep_end;
+}
+
+void GraphColumn::computeBlock(size_t level, qint64 block)
+{
+    LodLevel& lvl = m_lod[level];
+    const size_t idx = block - lvl.first;
+    double& min = lvl.min[idx];
+    double& max = lvl.max[idx];
+
+    if(level == 0)
+    {
+        const int shift = lodShift(0);
+        const qint64 bs = (std::max)(block * (qint64(1) << shift), m_shift);
+        const qint64 be = (std::min)(bs + (qint64(1) << shift), qint64(m_shift + m_values.size()));
+
+        const double *itr = &m_values[bs - m_shift];
+        const double *last = itr + (be - bs);
+
+        min = max = *itr;
+        for(++itr; itr < last; ++itr)
+        {
+            min = (std::min)(min, *itr);
+            max = (std::max)(max, *itr);
+        }
+        return;
+    }
+
+    const LodLevel& child = m_lod[level - 1];
+    const qint64 cb = (std::max)(block << LOD_LEVEL_SHIFT, child.first);
+    const qint64 ce = (std::min)((block + 1) << LOD_LEVEL_SHIFT, qint64(child.first + child.min.size()));
+
+    min = child.min[cb - child.first];
+    max = child.max[cb - child.first];
+    for(qint64 c = cb + 1; c < ce; ++c)
+    {
+        min = (std::min)(min, child.min[c - child.first]);
+        max = (std::max)(max, child.max[c - child.first]);
+    }
+}
+
+void GraphColumn::updateLod()
+{
+    const qint64 begin = m_shift;
+    const qint64 end = m_shift + m_values.size();
+
+    // Values at positions which were in the column before
+    // the last fill() and still are did not change
+    const qint64 keep_begin = (std::max)(begin, m_lod_begin);
+    const qint64 keep_end = (std::min)(end, m_lod_end);
+
+    size_t levels = 1;
+    while(levels < LOD_MAX_LEVELS && ((end - begin) >> lodShift(levels - 1)) > LOD_TOP_BLOCKS)
+        ++levels;
+    if(levels > m_lod.size())
+        m_lod.resize(levels);
+
+    for(size_t l = 0; l < m_lod.size(); ++l)
+    {
+        LodLevel& lvl = m_lod[l];
+        const int shift = lodShift(l);
+
+        if(begin == end)
+        {
+            lvl.min.clear();
+            lvl.max.clear();
+            continue;
+        }
+
+        const qint64 lo = blockOf(begin, shift);
+        const qint64 hi = blockOf(end - 1, shift);
+
+        // Nothing can be reused, compute the whole level
+        if(lvl.min.empty() || lo >= qint64(lvl.first + lvl.min.size()) || hi < lvl.first)
+        {
+            lvl.first = lo;
+            lvl.min.assign(hi - lo + 1, 0.0);
+            lvl.max.assign(hi - lo + 1, 0.0);
+            for(qint64 b = lo; b <= hi; ++b)
+                computeBlock(l, b);
+            continue;
+        }
+
+        for(; lvl.first < lo; ++lvl.first)
+        {
+            lvl.min.pop_front();
+            lvl.max.pop_front();
+        }
+        for(; lvl.first > lo; --lvl.first)
+        {
+            lvl.min.push_front(0.0);
+            lvl.max.push_front(0.0);
+        }
+        lvl.min.resize(hi - lo + 1, 0.0);
+        lvl.max.resize(hi - lo + 1, 0.0);
+
+        // Only blocks at the ends can have changed
+        qint64 b = lo;
+        for(; b <= hi && !isBlockClean(b, shift, keep_begin, keep_end); ++b)
+            computeBlock(l, b);
+        for(qint64 e = hi; e >= b && !isBlockClean(e, shift, keep_begin, keep_end); --e)
+            computeBlock(l, e);
+    }
+
+    m_lod_begin = begin;
+    m_lod_end = end;
+}
+
+void GraphColumn::minMax(qint64 begin, qint64 end, double& min, double& max) const
+{
+    Q_ASSERT(begin >= end || (begin >= m_shift && end <= qint64(m_shift + m_values.size())));
+
+    if(begin >= end)
+    {
+        min = max = 0.0;
+        return;
+    }
+
+    min = max = m_values[begin - m_shift];
+    while(begin < end)
+    {
+        // Biggest block which starts at begin and fits into the range
+        int l = m_lod.size() - 1;
+        for(; l >= 0; --l)
+        {
+            const qint64 size = qint64(1) << lodShift(l);
+            if((begin & (size - 1)) == 0 && begin + size <= end)
+                break;
+        }
+
+        if(l < 0)
+        {
+            const double val = m_values[begin - m_shift];
+            min = (std::min)(min, val);
+            max = (std::max)(max, val);
+            ++begin;
+            continue;
+        }
+
+        const LodLevel& lvl = m_lod[l];
+        const size_t idx = blockOf(begin, lodShift(l)) - lvl.first;
+        min = (std::min)(min, lvl.min[idx]);
+        max = (std::max)(max, lvl.max[idx]);
+        begin += qint64(1) << lodShift(l);
+    }
+}
@@ -0,0 +1,110 @@
+/**********************************************
+**    This file is part of Lorris
+**    http://tasssadar.github.com/Lorris/
+**
+**    See README and COPYING
+***********************************************/
+
+#ifndef GRAPHCOLUMN_H
+#define GRAPHCOLUMN_H
+
+#include <vector>
+#include <deque>
+#include <QString>
+#include <QPointer>
+
+#include "../../datafilter.h"
+
+class Storage;
+class FormulaEvaluation;
+
+// Decoded values of one number (filter, position in packet, type and formula)
+// from all packets in some range of Storage. Values are kept in contiguous
+// arrays sorted by packet sequence number (see StorageData::firstSeq()),
+// so curves can read samples, minimum and maximum straight from them.
+//
+// Columns are shared between curves which read the same number, get one
+// with acquire() and give it back with release().
+//
+// Items are addressed by "positions", which stay valid when items are
+// added to either end of the column. Items can be removed by fill() of
+// any curve which shares the column, so curves keep their range as sequence
+// numbers and look up positions again with range() whenever version()
+// changes.
+//
+// On top of the values, the column keeps a min/max pyramid of blocks
+// aligned to positions, so minimum and maximum of any range can be found
+// without walking all of its values. It is updated by fill() only at the
+// ends which changed.
+class GraphColumn
+{
+public:
+    static GraphColumn *acquire(Storage *storage, DataFilter *filter, quint32 pos,
+                                quint8 type, const QString& formula);
+    static void release(GraphColumn *column);
+
+    // Decodes matching packets with sequence numbers [from, to)
+    // if they are not in the column yet
+    void fill(quint64 from, quint64 to);
+    // Positions [begin, end) of items with sequence numbers [from, to)
+    void range(quint64 from, quint64 to, qint64& begin, qint64& end) const;
+    // Changes every time some items are removed from the column
+    quint32 version() const { return m_version; }
+
+    bool empty() const { return m_values.empty(); }
+    double value(qint64 pos) const { return m_values[physical(pos)]; }
+    quint64 seq(qint64 pos) const { return m_seqs[physical(pos)]; }
+    void minMax(qint64 begin, qint64 end, double& min, double& max) const;
+
+    // Position of the first item in [begin, end) with sequence number >= seq,
+    // the range has to be from range() of the current version()
+    qint64 lowerBound(quint64 seq, qint64 begin, qint64 end) const;
+
+private:
+    // One level of the pyramid, block b covers positions
+    // [b << lodShift(level), (b+1) << lodShift(level))
+    struct LodLevel
+    {
+        LodLevel() : first(0) { }
+
+        qint64 first;               // block index of min[0] and max[0]
+        std::deque<double> min;
+        std::deque<double> max;
+    };
+
+    GraphColumn(Storage *storage, DataFilter *filter, quint32 pos, quint8 type, const QString& formula);
+    ~GraphColumn();
+
+    size_t physical(qint64 pos) const;
+    void reset();
+    void trim(quint64 cut);
+    void decode(quint64 from, quint64 to, std::vector<quint64>& seqs, std::vector<double>& values);
+
+    void updateLod();
+    void computeBlock(size_t level, qint64 block);
+    bool isBlockClean(qint64 block, int shift, qint64 keep_begin, qint64 keep_end) const;
+
+    Storage *m_storage;
+    QPointer<DataFilter> m_filter;
+    quint32 m_pos;
+    quint8 m_type;
+    QString m_formula;
+    FormulaEvaluation *m_eval;
+    int m_refs;
+
+    std::vector<quint64> m_seqs;
+    std::vector<double> m_values;
+    qint64 m_shift;          // position of m_seqs[0]
+    quint64 m_from, m_to;    // all matching packets with sequence number in [m_from, m_to) are in the column
+    quint64 m_window;        // biggest range requested by fill()
+    quint32 m_generation;    // DataFilter::getMatchGeneration() the values are for
+    quint32 m_version;
+
+    std::vector<quint64> m_matches;
+    analyzer_span m_span;
+
+    std::vector<LodLevel> m_lod;
+    qint64 m_lod_begin, m_lod_end;  // positions the pyramid was computed for
+};
+
+#endif // GRAPHCOLUMN_H
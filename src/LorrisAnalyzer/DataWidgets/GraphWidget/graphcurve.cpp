@@ -6,6 +6,7 @@
 ***********************************************/
 
 #include <qwt_plot.h>
+#include <qwt_scale_map.h>
 
 #include "graphcurve.h"
 #include "../../storage.h"
@@ -40,9 +41,9 @@ void GraphCurve::setSampleSize(quint32 size)
     m_data->setSampleSize(size);
 }
 
-void GraphCurve::dataPosChanged(quint32 pos)
+void GraphCurve::dataPosChanged(quint64 seq)
 {
-    m_data->dataPosChanged(pos);
+    m_data->dataPosChanged(seq);
 }
 
 qint32 GraphCurve::getMax()
@@ -65,6 +66,19 @@ quint32 GraphCurve::getMaxX()
     return m_data->getMaxX();
 }
 
+void GraphCurve::drawSeries(QPainter *painter, const QwtScaleMap &xMap, const QwtScaleMap &yMap,
+                            const QRectF &canvasRect, int from, int to) const
+{
+    // Canvas can show only so many points, big curves are
+    // reduced to minimum and maximum of each pixel column
+    const int pixels = qRound(qAbs(xMap.p2() - xMap.p1()));
+    if(!m_data->decimate(xMap.s1(), xMap.s2(), pixels))
+        return QwtPlotCurve::drawSeries(painter, xMap, yMap, canvasRect, from, to);
+
+    QwtPlotCurve::drawSeries(painter, xMap, yMap, canvasRect, 0, -1);
+    m_data->clearDecimation();
+}
+
 void GraphCurve::setDataType(quint8 type)
 {
     m_data->setDataType(type);
@@ -31,7 +31,7 @@ public:
     void init();
 
     void setSampleSize(quint32 size);
-    void dataPosChanged(quint32 pos);
+    void dataPosChanged(quint64 seq);
 
     qint32 getMin();
     qint32 getMax();
@@ -49,6 +49,9 @@ public:
     QString getFormula() { return m_data->getFormula(); }
     void setFormula(const QString& f) { m_data->setFormula(f); }
 
+    void drawSeries(QPainter *painter, const QwtScaleMap &xMap, const QwtScaleMap &yMap,
+                    const QRectF &canvasRect, int from, int to) const;
+
 public slots:
     void addPoint(quint32 index, qreal val)
     {
@@ -6,6 +6,8 @@
 ***********************************************/
 
 #include <utility>
+#include <algorithm>
+#include <math.h>
 
 #include "graphdata.h"
 #include "../datawidget.h"
@@ -20,21 +22,30 @@ GraphData::GraphData(Storage *storage, data_widget_info &info, qint32 sample_siz
     m_sample_size = sample_size;
     m_data_type = data_type;
 
-    m_last_index = 0;
+    m_last_seq = 0;
     m_min = m_max = 0.0;
 
     m_script_based = false;
+
+    m_column = NULL;
+    m_from = m_to = 0;
+    m_begin = m_end = 0;
+    m_version = 0;
+    m_base_seq = 0;
+    m_decimated = false;
 }
 
 GraphData::~GraphData()
 {
-
+    GraphColumn::release(m_column);
 }
 
 void GraphData::clear()
 {
     m_data.clear();
-    m_last_index = 0;
+    m_from = m_to = 0;
+    m_begin = m_end = 0;
+    m_last_seq = 0;
     m_min = m_max = 0.0;
 }
 
@@ -43,35 +54,73 @@ void GraphData::reloadData()
     if(m_script_based)
         return;
 
-    quint32 idx = m_last_index;
+    quint64 seq = m_last_seq;
     clear();
-    dataPosChanged(idx);
+    dataPosChanged(seq);
+}
+
+void GraphData::releaseColumn()
+{
+    GraphColumn::release(m_column);
+    m_column = NULL;
+}
+
+void GraphData::syncColumn() const
+{
+    if(m_script_based || !m_column || m_column->version() == m_version)
+        return;
+
+    // Other curve which shares the column removed some items
+    m_version = m_column->version();
+    m_column->range(m_from, m_to, m_begin, m_end);
+    m_column->minMax(m_begin, m_end, m_min, m_max);
 }
 
 QPointF GraphData::sample(size_t i) const
 {
-    return m_data[i];
+    if(m_script_based)
+        return m_data[i];
+
+    if(m_decimated)
+        return m_lod[i];
+
+    syncColumn();
+    const qint64 pos = m_begin + i;
+    return QPointF(qreal(m_column->seq(pos) - m_base_seq), m_column->value(pos));
 }
 
 size_t GraphData::size() const
 {
-    return m_data.size();
+    if(m_script_based)
+        return m_data.size();
+
+    if(m_decimated)
+        return m_lod.size();
+
+    if(!m_column)
+        return 0;
+
+    syncColumn();
+    return m_end - m_begin;
 }
 
 QRectF GraphData::boundingRect() const
 {
-    if(m_data.empty())
+    if(size() == 0)
         return QRect();
     else
-        return QRect(m_data.front().x(), m_max, m_data.back().x() - m_data.front().x(), abs(m_max) + abs(m_min));
+    {
+        const qreal first = sample(0).x();
+        return QRect(first, m_max, sample(size()-1).x() - first, abs(m_max) + abs(m_min));
+    }
 }
 
 quint32 GraphData::getMaxX()
 {
-    if(m_data.empty())
+    if(size() == 0)
         return 0;
 
-    return m_data.back().x();
+    return sample(size()-1).x();
 }
 
 void GraphData::setSampleSize(quint32 size)
@@ -86,129 +135,137 @@ void GraphData::setSampleSize(quint32 size)
 void GraphData::setDataType(quint8 type)
 {
     m_data_type = type;
+    releaseColumn();
     reloadData();
 }
 
 void GraphData::setInfo(data_widget_info &info)
 {
     m_info = info;
+    releaseColumn();
     reloadData();
 }
 
-void GraphData::dataPosChanged(quint32 index)
+void GraphData::setFormula(const QString& f)
 {
+    m_eval.setFormula(f);
+    releaseColumn();
+    reloadData();
+}
+
+void GraphData::dataPosChanged(quint64 seq)
+{
+    if(m_script_based)
+        return;
+
     if(m_info.filter.isNull() || m_storage->isEmpty())
     {
         clear();
         return;
     }
 
-    double n;
-    QVariant num;
-    analyzer_data cur(NULL, m_storage->getPacket());
-
-    // FIXME: this can be solved better, somehow
-    if(m_last_index == index && m_storage->isFull())
+    if(!m_column)
     {
-        m_data.clear();
-        m_last_index = 0;
+        m_column = GraphColumn::acquire(m_storage, m_info.filter.data(), m_info.pos,
+                                        m_data_type, m_eval.getFormula());
     }
 
-    if(m_last_index > index)
-    {
-        removeDataAfter(index);
-
-        if(m_sample_size < index)
-        {
-            quint32 i = (std::min)(index, m_last_index-m_sample_size);
-            qint64 start = m_sample_size <= index ? index - m_sample_size : -1;
-            for(; i > start; --i)
-            {
-                cur.setData(m_storage->get(i));
+    // Values are decoded only once into the column, which can
+    // be shared with other curves, here is just the visible window
+    m_to = seq + 1;
+    m_from = m_sample_size < m_to ? m_to - m_sample_size : 0;
+    m_column->fill(m_from, m_to);
 
-                if(!m_info.filter->isOkay(&cur))
-                    continue;
+    m_version = m_column->version();
+    m_column->range(m_from, m_to, m_begin, m_end);
+    m_column->minMax(m_begin, m_end, m_min, m_max);
+    m_base_seq = m_storage->getFirstSeq();
 
-                num = DataWidget::getNumFromPacket(&cur, m_info.pos, m_data_type);
-                if(!num.isValid())
-                    continue;
+    m_last_seq = seq;
+}
 
-                n = num.toDouble();
-                setMinMax(n);
+quint64 GraphData::seqAt(double x) const
+{
+    return x <= 0.0 ? m_base_seq : m_base_seq + quint64(ceil(x));
+}
 
-                m_data.push_front(QPointF(i, n));
-            }
-        }
-    }
-    else
-    {
-        if(m_sample_size < index)
-            removeDataBefore(index-m_sample_size+1);
+void GraphData::addColumnPoints(qint64 begin, qint64 end)
+{
+    for(qint64 pos = begin; pos < end; ++pos)
+        m_lod.push_back(QPointF(qreal(m_column->seq(pos) - m_base_seq), m_column->value(pos)));
+}
 
-        quint32 i = 0;
-        if(m_sample_size < index)
-            i = (std::max)(m_last_index, index - m_sample_size);
-        else
-            i = m_last_index;
+bool GraphData::decimate(double x0, double x1, int pixels)
+{
+    m_decimated = false;
+    m_lod.clear();
 
-        for(++i; i <= index; ++i)
-        {
-            cur.setData(m_storage->get(i));
+    if(m_script_based || pixels <= 0)
+        return false;
 
-            if(!m_info.filter->isOkay(&cur))
-                continue;
+    // Positions are used directly below, the column
+    // could have been trimmed by other curve since the last fill
+    syncColumn();
+    if(size() <= size_t(pixels)*2)
+        return false;
 
-            num = DataWidget::getNumFromPacket(&cur, m_info.pos, m_data_type);
-            if(!num.isValid())
-                continue;
+    if(x0 > x1)
+        std::swap(x0, x1);
 
-            n = num.toDouble();
-            if(m_eval.isActive())
-                n = m_eval.evaluate(QString::number(n, 'f')).toDouble();
+    // Visible points and one more on each side, so that
+    // the lines reach to the edges of the canvas
+    qint64 begin = m_column->lowerBound(seqAt(x0), m_begin, m_end);
+    qint64 end = m_column->lowerBound(seqAt(x1), begin, m_end);
+    begin = (std::max)(m_begin, begin - 1);
+    end = (std::min)(m_end, end + 1);
 
-            setMinMax(n);
+    m_decimated = true;
 
-            m_data.push_back(QPointF(i, n));
-        }
+    if(end - begin <= qint64(pixels)*2)
+    {
+        addColumnPoints(begin, end);
+        return true;
     }
 
-    m_last_index = index;
-}
+    const double step = (x1 - x0) / pixels;
+    m_lod.reserve(pixels*2 + 2);
 
-void GraphData::removeDataAfter(quint32 index)
-{
-    for(size_t i = 0; i < m_data.size(); ++i)
+    qint64 pos = begin;
+    for(int px = 1; px <= pixels+1 && pos < end; ++px)
     {
-        if(m_data[i].x() == index)
+        const qint64 next = px > pixels ? end : m_column->lowerBound(seqAt(x0 + step*px), pos, end);
+        if(next - pos <= 2)
         {
-            ++i;
-            m_data.erase(m_data.begin()+i, m_data.end());
-            return;
+            addColumnPoints(pos, next);
+            pos = next;
+            continue;
         }
-        else if(m_data[i].x() > index)
-        {
-            m_data.clear();
-            return;
-        }
-    }
-}
 
-void GraphData::removeDataBefore(quint32 index)
-{
-    for(size_t i = 1; i < m_data.size(); ++i)
-    {
-        if(m_data[i].x() == index)
+        // Keep both extremes of the pixel, in the order which
+        // follows the direction the curve goes in this pixel
+        double min, max;
+        m_column->minMax(pos, next, min, max);
+
+        const qreal first_x = m_column->seq(pos) - m_base_seq;
+        const qreal last_x = m_column->seq(next - 1) - m_base_seq;
+        if(m_column->value(pos) <= m_column->value(next - 1))
         {
-            m_data.erase(m_data.begin(), m_data.begin()+i);
-            return;
+            m_lod.push_back(QPointF(first_x, min));
+            m_lod.push_back(QPointF(last_x, max));
         }
-        else if(m_data[i].x() > index)
+        else
         {
-            return;
+            m_lod.push_back(QPointF(first_x, max));
+            m_lod.push_back(QPointF(last_x, min));
         }
+        pos = next;
     }
+    return true;
+}
 
-    m_data.clear();
+void GraphData::clearDecimation()
+{
+    m_decimated = false;
 }
 
 void GraphData::setMinMax(double val)
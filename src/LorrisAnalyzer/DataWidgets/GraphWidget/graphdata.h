@@ -10,9 +10,11 @@
 
 #include <qwt_series_data.h>
 #include <deque>
+#include <vector>
 
 #include "../datawidget.h"
 #include "../../../misc/formulaevaluation.h"
+#include "graphcolumn.h"
 
 class Storage;
 struct data_widget_info;
@@ -33,27 +35,36 @@ public:
     QRectF boundingRect() const;
 
     void addPoint(qreal index, qreal data);
-    qint32 getMax() { return m_max; }
-    qint32 getMin() { return m_min; }
+    qint32 getMax() { syncColumn(); return m_max; }
+    qint32 getMin() { syncColumn(); return m_min; }
     quint32 getMaxX();
     void clear();
     void reloadData();
 
     void setSampleSize(quint32 size);
-    void dataPosChanged(quint32 index);
+    // seq is sequence number of the newest packet, see Storage::addData()
+    void dataPosChanged(quint64 seq);
 
     void setDataType(quint8 type);
     quint8 getDataType() { return m_data_type; }
     void setInfo(data_widget_info&);
 
     QString getFormula() { return m_eval.getFormula(); }
-    void setFormula(const QString& f) { m_eval.setFormula(f); }
+    void setFormula(const QString& f);
+
+    // While set, sample() and size() return only about two points
+    // (minimum and maximum) per pixel of x range [x0, x1] which is
+    // drawn into given number of pixels. Returns false if the curve
+    // is small enough to be drawn as it is.
+    bool decimate(double x0, double x1, int pixels);
+    void clearDecimation();
 
 private:
-    void removeDataAfter(quint32 index);
-    void removeDataBefore(quint32 index);
-    inline DataMapItr insertData(DataMapItr hint, quint32 idx, double val);
     inline void setMinMax(double val);
+    void releaseColumn();
+    void syncColumn() const;
+    void addColumnPoints(qint64 begin, qint64 end);
+    quint64 seqAt(double x) const;
 
     FormulaEvaluation m_eval;
     bool m_script_based;
@@ -64,9 +75,24 @@ private:
     quint32 m_sample_size;
     quint8 m_data_type;
 
-    quint32 m_last_index;
+    quint64 m_last_seq;
+    mutable double m_min, m_max;
+
+    // Points added by scripts
     DataMap m_data;
-    double m_min, m_max;
+
+    // Points from Storage, packets with sequence numbers [m_from, m_to).
+    // Their positions [m_begin, m_end) in m_column are valid for
+    // m_column->version() == m_version, see syncColumn().
+    GraphColumn *m_column;
+    quint64 m_from, m_to;
+    mutable qint64 m_begin, m_end;
+    mutable quint32 m_version;
+    quint64 m_base_seq;
+
+    // Points of the visible range, valid between decimate() and clearDecimation()
+    std::vector<QPointF> m_lod;
+    bool m_decimated;
 };
 
 #endif // GRAPHDATA_H
@@ -147,13 +147,13 @@ void GraphWidget::updateRemoveMapping()
     }
 }
 
-void GraphWidget::newData(analyzer_data */*data*/, quint32 index)
+void GraphWidget::newData(analyzer_data */*data*/, quint64 seq)
 {
     if(!isUpdating() || m_curves.empty())
         return;
 
     for(quint8 i = 0; i < m_curves.size(); ++i)
-        m_curves[i]->curve->dataPosChanged(index);
+        m_curves[i]->curve->dataPosChanged(seq);
 
     updateVisibleArea();
 }
@@ -56,7 +56,7 @@ protected:
 private slots:
     void applyCurveChanges();
     void acceptCurveChanges();
-    void newData(analyzer_data *data, quint32 index);
+    void newData(analyzer_data *data, quint64 seq);
     void sampleSizeChanged(int val);
     void editCurve();
     void showLegend(bool show);
@@ -123,6 +123,7 @@ void PythonEngine::setSource(const QString &source)
     emit stopUsingJoy(this);
 
     m_module.evalScript(source, m_name, 257);
+    m_on_data_batch = PythonQt::self()->lookupCallable(m_module, "onDataChangedBatch");
 
     QVariantList args;
     for(WidgetArea::w_map::const_iterator itr = widgets.begin(); itr != widgets.end(); ++itr)
@@ -146,7 +147,7 @@ void PythonEngine::widgetDestroyed(QObject *widget)
     m_widgets.remove(w->getId());
 }
 
-QString PythonEngine::dataChanged(analyzer_data *data, quint32 index)
+QString PythonEngine::dataChanged(analyzer_data *data, quint64 seq)
 {
     if(m_evaluating)
         return QString();
@@ -161,12 +162,61 @@ QString PythonEngine::dataChanged(analyzer_data *data, quint32 index)
     if(data->getCmd(res))  args << res;
     else                   args << -1;
 
-    args << index;
+    // packet could have been removed from the storage already
+    quint32 index = 0;
+    if(getStorage()->seqToIndex(seq, index)) args << index;
+    else                                     args << -1;
 
     QVariant var = m_module.call("onDataChanged", args);
     return var.toString();
 }
 
+QString PythonEngine::dataChangedBatch(const std::vector<QByteArray>& packets, const std::vector<quint64>& seqs,
+                                       analyzer_packet */*packet*/)
+{
+    if(m_evaluating || m_on_data_batch.isNull())
+        return QString();
+
+    // Packets are copied back to back into one bytearray and the script
+    // gets a memoryview slice of it for each packet. These support
+    // the buffer protocol, so they can go straight to numpy.frombuffer()
+    Py_ssize_t total = 0;
+    for(size_t i = 0; i < packets.size(); ++i)
+        total += packets[i].size();
+
+    PythonQtObjectPtr buffer;
+    buffer.setNewRef(PyByteArray_FromStringAndSize(NULL, total));
+    if(buffer.isNull())
+        return QString();
+
+    PythonQtObjectPtr view;
+    view.setNewRef(PyMemoryView_FromObject(buffer.object()));
+
+    PythonQtObjectPtr list;
+    list.setNewRef(PyList_New(packets.size()));
+    if(view.isNull() || list.isNull())
+        return QString();
+
+    char *dst = PyByteArray_AS_STRING(buffer.object());
+    Py_ssize_t pos = 0;
+    for(size_t i = 0; i < packets.size(); ++i)
+    {
+        memcpy(dst + pos, packets[i].constData(), packets[i].size());
+        PyList_SET_ITEM(list.object(), i, PySequence_GetSlice(view.object(), pos, pos + packets[i].size()));
+        pos += packets[i].size();
+    }
+
+    QVariantList seqList;
+    for(size_t i = 0; i < seqs.size(); ++i)
+        seqList << seqs[i];
+
+    QVariantList args;
+    args << QVariant::fromValue(list) << QVariant(seqList);
+
+    QVariant var = PythonQt::self()->call(m_on_data_batch.object(), args);
+    return var.toString();
+}
+
 void PythonEngine::onWidgetAdd(DataWidget *w)
 {
     QString name = sanitizeWidgetName(w->getTitle());
@@ -379,7 +429,7 @@ QByteArray PythonFunctions::getData(quint32 idx) const
     if(idx >= m_engine->getStorage()->getSize())
         return QByteArray();
 
-    return *m_engine->getStorage()->get(idx);
+    return m_engine->getStorage()->get(idx);
 }
 
 quint32 PythonFunctions::getDataCount() const
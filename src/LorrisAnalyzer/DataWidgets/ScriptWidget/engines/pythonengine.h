@@ -73,7 +73,10 @@ public:
     ~PythonEngine();
     
     void setSource(const QString& source);
-    QString dataChanged(analyzer_data *data, quint32 index);
+    QString dataChanged(analyzer_data *data, quint64 seq);
+    bool hasBatchHandler() const { return !m_on_data_batch.isNull(); }
+    QString dataChangedBatch(const std::vector<QByteArray>& packets, const std::vector<quint64>& seqs,
+                             analyzer_packet *packet);
     void onWidgetAdd(DataWidget *w);
     void onWidgetRemove(DataWidget *w);
     void callEventHandler(const QString& eventId, const QVariantList& args = QVariantList());
@@ -95,6 +98,7 @@ private:
     static QString getNewModuleName();
 
     PythonQtObjectPtr m_module;
+    PythonQtObjectPtr m_on_data_batch;
     bool m_evaluating;
     PythonFunctions m_functions;
     QString m_name;
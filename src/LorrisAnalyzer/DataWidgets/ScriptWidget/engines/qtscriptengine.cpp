@@ -23,13 +23,14 @@
 #include "../scriptwidget.h"
 #include "../../../../ui/terminal.h"
 #include "../../../storage.h"
+#include "../../../packetscriptclass.h"
 
 /* Simple JavaScript Inheritance
  * By John Resig http://ejohn.org/
  * MIT Licensed, see MIT_LICENSE file
  * http://ejohn.org/blog/simple-javascript-inheritance/
  */
-static const QString classImplement =
+const QString classImplement =
         "(function(){var i=false,fnTest=/xyz/.test(function(){xyz})?/\\b_super\\b/:/.*/;this.Class=function(){};"
         "Class.extend=function(e){var f=this.prototype;i=true;var g=new this();i=false;for(var h in e){g[h]="
         "typeof e[h]==\"function\"&&typeof f[h]==\"function\"&&fnTest.test(e[h])?(function(c,d){return function()"
@@ -47,6 +48,7 @@ QtScriptEngine::QtScriptEngine(WidgetArea *area, quint32 w_id, ScriptWidget *par
     ScriptEngine(area, w_id, parent)
 {
     m_engine = NULL;
+    m_packets = NULL;
     setSource(QString());
 }
 
@@ -63,6 +65,7 @@ QtScriptEngine::~QtScriptEngine()
         emit stopUsingJoy(m_engine);
 
         delete m_engine;
+        delete m_packets;
     }
 }
 
@@ -180,9 +183,12 @@ void QtScriptEngine::setSource(const QString &source)
     if(m_on_script_exit.isFunction())
         m_on_script_exit.call();
 
+    // objects of the class are owned by the engine, delete it afterwards
     delete m_engine;
+    delete m_packets;
     m_engine = new QtScriptEngine_private(this, parent());
     m_engine->setAgent(new ScriptAgent(this, m_engine));
+    m_packets = new PacketScriptClass(m_engine);
 
     connect(this, SIGNAL(stopUsingJoy(QObject*)), m_engine, SIGNAL(stopUsingJoy(QObject*)));
 
@@ -193,6 +199,7 @@ void QtScriptEngine::setSource(const QString &source)
         emit error(tr("%1 on line %2").arg(m_engine->uncaughtException().toString()).arg(m_engine->uncaughtExceptionLineNumber()));
 
     m_on_data = m_global.property("onDataChanged");
+    m_on_data_batch = m_global.property("onDataChangedBatch");
     m_on_key = m_global.property("onKeyPress");
     m_on_widget_add = m_global.property("onWidgetAdd");
     m_on_widget_remove = m_global.property("onWidgetRemove");
@@ -217,20 +224,14 @@ void QtScriptEngine::setSource(const QString &source)
     }
 }
 
-QString QtScriptEngine::dataChanged(analyzer_data *data, quint32 index)
+QString QtScriptEngine::dataChanged(analyzer_data *data, quint64 seq)
 {
     // do not execute when setting source - agent() == NULL
     if(!m_on_data.isFunction() || !m_engine->agent())
         return "";
 
-    const QByteArray& pkt_data = data->getData();
-
-    QScriptValue jsData = m_engine->newArray(pkt_data.size());
-    for(qint32 i = 0; i < pkt_data.size(); ++i)
-        jsData.setProperty(i, QScriptValue(m_engine, (quint8)pkt_data[i]));
-
     QScriptValueList args;
-    args.push_back(jsData);
+    args.push_back(m_packets->newPacket(*data));
 
     quint8 res = 0;
     if(data->getDeviceId(res)) args << res;
@@ -239,12 +240,36 @@ QString QtScriptEngine::dataChanged(analyzer_data *data, quint32 index)
     if(data->getCmd(res))  args << res;
     else                   args << -1;
 
-    args << index;
+    // packet could have been removed from the storage already
+    quint32 index = 0;
+    if(getStorage()->seqToIndex(seq, index)) args << index;
+    else                                     args << -1;
 
     QScriptValue val = m_on_data.call(QScriptValue(), args);
     return val.isUndefined() ? "" : val.toString();
 }
 
+QString QtScriptEngine::dataChangedBatch(const std::vector<QByteArray>& packets, const std::vector<quint64>& seqs,
+                                         analyzer_packet *packet)
+{
+    if(!m_on_data_batch.isFunction() || !m_engine->agent())
+        return "";
+
+    QScriptValue jsPackets = m_engine->newArray(packets.size());
+    QScriptValue jsSeqs = m_engine->newArray(seqs.size());
+    for(size_t i = 0; i < packets.size(); ++i)
+    {
+        jsPackets.setProperty(i, m_packets->newPacket(packets[i], packet));
+        jsSeqs.setProperty(i, qsreal(seqs[i]));
+    }
+
+    QScriptValueList args;
+    args << jsPackets << jsSeqs;
+
+    QScriptValue val = m_on_data_batch.call(QScriptValue(), args);
+    return val.isUndefined() ? "" : val.toString();
+}
+
 void QtScriptEngine::keyPressed(const QString &key)
 {
     if(!m_on_key.isFunction() || key.isEmpty())
@@ -497,7 +522,7 @@ QScriptValue QtScriptEngine_private::newTimer()
     return m_base->newTimer();
 }
 
-QByteArray *QtScriptEngine_private::getData(quint32 idx) const
+QByteArray QtScriptEngine_private::getData(quint32 idx) const
 {
     return m_base->getStorage()->get(idx);
 }
@@ -518,7 +543,10 @@ QScriptValue QtScriptEngine_private::__appendTerm(QScriptContext *context, QScri
     QtScriptEngine_private *eng = (QtScriptEngine_private*)engine;
     QScriptValue arg = context->argument(0);
 
-    if(!arg.isArray())
+    analyzer_data pkt;
+    if(PacketScriptClass::toData(arg, pkt))
+        eng->appendTermRaw(pkt.getData());
+    else if(!arg.isArray())
         eng->appendTerm(arg.toString());
     else
     {
@@ -544,7 +572,10 @@ QScriptValue QtScriptEngine_private::__sendData(QScriptContext *context, QScript
 
     QScriptValue data = context->argument(0);
     QByteArray sendData;
-    if(data.isArray())
+    analyzer_data pkt;
+    if(PacketScriptClass::toData(data, pkt))
+        sendData = pkt.getData();
+    else if(data.isArray())
     {
         QScriptValueIterator itr(data);
         while(itr.hasNext())
@@ -778,11 +809,7 @@ QScriptValue QtScriptEngine_private::__getData(QScriptContext *context, QScriptE
     if(idx >= count)
         return QScriptValue();
 
-    QByteArray *data = eng->getData(idx);
-    QScriptValue jsData = eng->newArray(data->size());
-    for(int i = 0; i < data->size(); ++i)
-        jsData.setProperty(i, QScriptValue(eng, (quint8)data->at(i)));
-    return jsData;
+    return eng->m_base->m_packets->newPacket(eng->getData(idx), eng->m_base->getStorage()->getPacket());
 }
 
 QScriptValue QtScriptEngine_private::__getDataCount(QScriptContext */*context*/, QScriptEngine *engine)
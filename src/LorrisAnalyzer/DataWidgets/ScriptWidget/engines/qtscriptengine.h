@@ -21,6 +21,10 @@
 class WidgetArea;
 class DataWidget;
 class QtScriptEngine;
+class PacketScriptClass;
+
+// Simple JavaScript Inheritance, evaluated before every QtScript source
+extern const QString classImplement;
 
 class QtScriptEngine_private : public QScriptEngine
 {
@@ -50,7 +54,7 @@ private:
     int getHeight();
     QScriptValue newTimer();
     quint32 getDataCount() const;
-    QByteArray *getData(quint32 idx) const;
+    QByteArray getData(quint32 idx) const;
 
     static QScriptValue __clearTerm(QScriptContext *context, QScriptEngine *engine);
     static QScriptValue __appendTerm(QScriptContext *context, QScriptEngine *engine);
@@ -100,7 +104,10 @@ public:
     void setSource(const QString& source);
     const QString& getSource() { return m_source; }
 
-    QString dataChanged(analyzer_data *data, quint32 index);
+    QString dataChanged(analyzer_data *data, quint64 seq);
+    bool hasBatchHandler() const { return m_on_data_batch.isFunction(); }
+    QString dataChangedBatch(const std::vector<QByteArray>& packets, const std::vector<quint64>& seqs,
+                             analyzer_packet *packet);
     DataWidget *addWidget(quint8 type, QScriptContext *context, quint8 removeArg = 0);
 
     QScriptValue newTimer();
@@ -128,6 +135,7 @@ private:
 
     QScriptValue  m_global;
     QScriptValue  m_on_data;
+    QScriptValue  m_on_data_batch;
     QScriptValue  m_on_key;
     QScriptValue  m_on_widget_add;
     QScriptValue  m_on_widget_remove;
@@ -136,6 +144,7 @@ private:
     QScriptValue  m_on_raw;
 
     QtScriptEngine_private *m_engine;
+    PacketScriptClass *m_packets;
 };
 
 #endif // QTSCRIPTENGINE_H
@@ -12,9 +12,11 @@
 #include <QSize>
 #include <QHash>
 #include <QVariantList>
+#include <vector>
 
 class ScriptStorage;
 class analyzer_data;
+struct analyzer_packet;
 class DataWidget;
 class WidgetArea;
 class QTimer;
@@ -42,6 +44,9 @@ Q_SIGNALS:
     void stopUsingJoy(QObject *object);
     void error(const QString& text);
 
+    // CPU usage and queue state of engines which run in separate thread
+    void usageChanged(const QString& text, bool overBudget);
+
 public:
     ScriptEngine(WidgetArea *area , quint32 w_id, ScriptWidget *parent);
     ~ScriptEngine();
@@ -50,7 +55,20 @@ public:
     static ScriptEngine *getEngine(int idx, WidgetArea *area, quint32 w_id, ScriptWidget *parent);
 
     virtual void setSource(const QString& source) = 0;
-    virtual QString dataChanged(analyzer_data *data, quint32 index) = 0;
+    // seq is sequence number of the packet, see Storage::addData(),
+    // scripts get its Storage index at the time they are called
+    virtual QString dataChanged(analyzer_data *data, quint64 seq) = 0;
+
+    // Scripts which define onDataChangedBatch get all packets received
+    // since the last display refresh at once, instead of onDataChanged
+    // for each of them. seqs[i] is sequence number of packets[i].
+    virtual bool hasBatchHandler() const { return false; }
+    virtual QString dataChangedBatch(const std::vector<QByteArray>& /*packets*/,
+                                     const std::vector<quint64>& /*seqs*/, analyzer_packet */*packet*/)
+    {
+        return QString();
+    }
+
     virtual void onWidgetAdd(DataWidget *w) = 0;
     virtual void onWidgetRemove(DataWidget *w) = 0;
     virtual void callEventHandler(const QString& eventId, const QVariantList& args = QVariantList()) = 0;
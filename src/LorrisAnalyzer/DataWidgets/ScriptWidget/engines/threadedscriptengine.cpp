@@ -0,0 +1,674 @@
+/**********************************************
+**    This file is part of Lorris
+**    http://tasssadar.github.com/Lorris/
+**
+**    See README and COPYING
+***********************************************/
+
+#include <QScriptValueIterator>
+#include <QMetaMethod>
+
+#include "threadedscriptengine.h"
+#include "qtscriptengine.h"
+#include "../../../widgetarea.h"
+#include "../../../widgetfactory.h"
+#include "../../../storage.h"
+#include "../../../packetscriptclass.h"
+#include "../../datawidget.h"
+#include "../../../../misc/config.h"
+#include "../../../../misc/utils.h"
+
+// How long can post() block GUI with SCRIPT_WAIT policy, in ms
+#define SCRIPT_WAIT_TIMEOUT 1000
+#define USAGE_INTERVAL 1000
+
+WorkerScriptEngine::WorkerScriptEngine(ScriptWorker *worker, Storage *storage) : QScriptEngine()
+{
+    m_worker = worker;
+    m_storage = storage;
+    m_packets = NULL;
+    m_processing = false;
+    m_index_base = 0;
+    m_has_index_base = false;
+
+    // also delivers processQueue() and abort() while the script is running
+    setProcessEventsInterval(50);
+    m_freezeDetectTimer.setSingleShot(true);
+    connect(&m_freezeDetectTimer, SIGNAL(timeout()), this, SLOT(freezeDetectorTimeout()));
+}
+
+void WorkerScriptEngine::load(const QString &source)
+{
+    m_global = globalObject();
+
+    QScriptValue appendTerm = newFunction(&WorkerScriptEngine::__appendTerm);
+    QScriptValue sendData = newFunction(&WorkerScriptEngine::__sendData);
+    QScriptValue throwEx = newFunction(&WorkerScriptEngine::__throwException);
+
+    m_global.setProperty("clearTerm", newFunction(&WorkerScriptEngine::__clearTerm));
+    m_global.setProperty("appendTerm", appendTerm);
+    m_global.setProperty("print", appendTerm);
+    m_global.setProperty("sendData", sendData);
+    m_global.setProperty("send", sendData);
+    m_global.setProperty("throwException", throwEx);
+    m_global.setProperty("alert", throwEx);
+    m_global.setProperty("newTimer", newFunction(&WorkerScriptEngine::__newTimer));
+    m_global.setProperty("getData", newFunction(&WorkerScriptEngine::__getData));
+    m_global.setProperty("getDataCount", newFunction(&WorkerScriptEngine::__getDataCount));
+    m_global.setProperty("callWidget", newFunction(&WorkerScriptEngine::__callWidget));
+
+    // defines
+    const QHash<QString, quint32>& enums = sWidgetFactory.getScriptEnums();
+    for(QHash<QString, quint32>::const_iterator itr = enums.begin(); itr != enums.end(); ++itr)
+         m_global.setProperty(itr.key(), QScriptValue(this, *itr));
+
+    QElapsedTimer time;
+    time.start();
+    m_freezeDetectTimer.start(sConfig.get(CFG_QUINT32_SCRIPT_FREEZE_TIMEOUT));
+    evaluate(classImplement + source);
+    finishCall(time);
+
+    m_on_data = m_global.property("onDataChanged");
+    m_on_data_batch = m_global.property("onDataChangedBatch");
+    m_on_key = m_global.property("onKeyPress");
+    m_on_raw = m_global.property("onRawData");
+    m_on_script_exit = m_global.property("onScriptExit");
+}
+
+void WorkerScriptEngine::unload()
+{
+    call(m_on_script_exit, QScriptValueList());
+}
+
+QScriptValue WorkerScriptEngine::call(QScriptValue& fn, const QScriptValueList& args)
+{
+    if(!fn.isFunction())
+        return QScriptValue();
+
+    QElapsedTimer time;
+    time.start();
+    m_freezeDetectTimer.start(sConfig.get(CFG_QUINT32_SCRIPT_FREEZE_TIMEOUT));
+    QScriptValue res = fn.call(QScriptValue(), args);
+    finishCall(time);
+
+    return res;
+}
+
+void WorkerScriptEngine::finishCall(const QElapsedTimer& time)
+{
+    m_freezeDetectTimer.stop();
+    m_worker->addBusyTime(time.nsecsElapsed());
+
+    if(hasUncaughtException())
+    {
+        emit m_worker->error(tr("%1 on line %2").arg(uncaughtException().toString()).arg(uncaughtExceptionLineNumber()));
+        clearExceptions();
+    }
+}
+
+void WorkerScriptEngine::freezeDetectorTimeout()
+{
+    if(!isEvaluating())
+        return;
+
+    abortEvaluation();
+    emit m_worker->error("FreezeDetector: killing, has been in qtscript code for too long. You can change the timeout in the global settings.");
+}
+
+void WorkerScriptEngine::abort()
+{
+    if(isEvaluating())
+        abortEvaluation();
+    m_worker->quit();
+}
+
+void WorkerScriptEngine::processQueue()
+{
+    // Called again from processEvents() while the script is running,
+    // the outer call takes the new messages
+    if(m_processing)
+        return;
+    m_processing = true;
+
+    std::deque<ScriptMessage> msgs;
+    for(m_worker->take(msgs); !msgs.empty() && m_worker->m_run; m_worker->take(msgs))
+    {
+        for(size_t i = 0; i < msgs.size() && m_worker->m_run;)
+        {
+            const ScriptMessage& msg = msgs[i];
+            switch(msg.type)
+            {
+                case ScriptMessage::MSG_DATA:
+                    handleData(msgs, i);
+                    continue;
+                case ScriptMessage::MSG_KEY:
+                    call(m_on_key, QScriptValueList() << msg.text);
+                    break;
+                case ScriptMessage::MSG_RAW:
+                    call(m_on_raw, QScriptValueList() << m_packets->newPacket(msg.data, NULL));
+                    break;
+                case ScriptMessage::MSG_EVENT:
+                {
+                    QScriptValue handler = m_global.property(msg.text);
+                    QScriptValueList args;
+                    for(int a = 0; a < msg.args.size(); ++a)
+                        args << toScriptValue(msg.args[a]);
+                    call(handler, args);
+                    break;
+                }
+            }
+            ++i;
+        }
+        msgs.clear();
+    }
+
+    m_processing = false;
+}
+
+void WorkerScriptEngine::handleData(std::deque<ScriptMessage>& msgs, size_t& idx)
+{
+    size_t end = idx;
+    while(end < msgs.size() && msgs[end].type == ScriptMessage::MSG_DATA)
+        ++end;
+
+    QString out;
+    if(m_on_data_batch.isFunction())
+    {
+        // Packets dropped by the queue policy are not in the batch,
+        // the script can tell by gaps in the sequence numbers
+        setBigEndian(msgs[idx].big_endian);
+
+        m_index_base = m_storage->getFirstSeq();
+        m_has_index_base = true;
+
+        QScriptValue packets = newArray(end - idx);
+        QScriptValue seqs = newArray(end - idx);
+        for(size_t i = idx; i < end; ++i)
+        {
+            packets.setProperty(i - idx, m_packets->newPacket(msgs[i].data, &m_packet));
+            seqs.setProperty(i - idx, qsreal(msgs[i].seq));
+        }
+
+        QScriptValue res = call(m_on_data_batch, QScriptValueList() << packets << seqs);
+        if(!res.isUndefined())
+            out = res.toString();
+    }
+    else if(m_on_data.isFunction())
+    {
+        for(size_t i = idx; i < end && m_worker->m_run; ++i)
+        {
+            setBigEndian(msgs[i].big_endian);
+
+            // index of the packet now, the storage could have dropped some since
+            m_index_base = m_storage->getFirstSeq();
+            m_has_index_base = true;
+            const bool stored = msgs[i].seq >= m_index_base;
+
+            QScriptValueList args;
+            args << m_packets->newPacket(msgs[i].data, &m_packet) << msgs[i].dev << msgs[i].cmd;
+            args << (stored ? QScriptValue(qsreal(msgs[i].seq - m_index_base)) : QScriptValue(-1));
+
+            QScriptValue res = call(m_on_data, args);
+            if(!res.isUndefined())
+                out += res.toString();
+        }
+    }
+
+    m_has_index_base = false;
+
+    if(!out.isEmpty())
+        emit m_worker->appendTerm(out);
+    idx = end;
+}
+
+void WorkerScriptEngine::setBigEndian(bool big_endian)
+{
+    if(m_packet.big_endian == big_endian)
+        return;
+
+    m_packet.big_endian = big_endian;
+    m_packet.compile();
+}
+
+QByteArray WorkerScriptEngine::toBytes(const QScriptValue& value)
+{
+    analyzer_data pkt;
+    if(PacketScriptClass::toData(value, pkt))
+        return pkt.getData();
+
+    QByteArray data;
+    if(value.isArray())
+    {
+        QScriptValueIterator itr(value);
+        while(itr.hasNext())
+        {
+            itr.next();
+            if(itr.value().isNumber() && itr.name() != "length")
+                data.push_back(itr.value().toUInt16());
+        }
+    }
+    else if(value.isString())
+        data = value.toString().toUtf8();
+    return data;
+}
+
+QScriptValue WorkerScriptEngine::__clearTerm(QScriptContext */*context*/, QScriptEngine *engine)
+{
+    emit ((WorkerScriptEngine*)engine)->m_worker->clearTerm();
+    return QScriptValue();
+}
+
+QScriptValue WorkerScriptEngine::__appendTerm(QScriptContext *context, QScriptEngine *engine)
+{
+    ScriptWorker *worker = ((WorkerScriptEngine*)engine)->m_worker;
+    QScriptValue arg = context->argument(0);
+
+    analyzer_data pkt;
+    if(arg.isArray() || PacketScriptClass::toData(arg, pkt))
+        emit worker->appendTermRaw(toBytes(arg));
+    else
+        emit worker->appendTerm(arg.toString());
+    return QScriptValue();
+}
+
+QScriptValue WorkerScriptEngine::__sendData(QScriptContext *context, QScriptEngine *engine)
+{
+    if(context->argumentCount() == 0)
+        return QScriptValue();
+
+    QByteArray data = toBytes(context->argument(0));
+    if(!data.isEmpty())
+        emit ((WorkerScriptEngine*)engine)->m_worker->SendData(data);
+    return QScriptValue();
+}
+
+QScriptValue WorkerScriptEngine::__throwException(QScriptContext *context, QScriptEngine *engine)
+{
+    if(context->argumentCount() != 1)
+        return QScriptValue();
+
+    emit ((WorkerScriptEngine*)engine)->m_worker->alert(context->argument(0).toString());
+    return QScriptValue();
+}
+
+QScriptValue WorkerScriptEngine::__newTimer(QScriptContext */*context*/, QScriptEngine *engine)
+{
+    // lives in worker's thread and is deleted with the engine
+    return engine->newQObject(new QTimer(engine));
+}
+
+QScriptValue WorkerScriptEngine::__getData(QScriptContext *context, QScriptEngine *engine)
+{
+    if(context->argumentCount() != 1 || !context->argument(0).isNumber())
+        return QScriptValue();
+
+    WorkerScriptEngine *eng = (WorkerScriptEngine*)engine;
+
+    // Storage keeps receiving packets while the script runs, so the index
+    // is turned into sequence number and the packet is copied by Storage
+    const quint32 idx = context->argument(0).toUInt32();
+    QByteArray data;
+    if(!eng->m_storage->getBySeq(eng->indexBase() + idx, data))
+        return QScriptValue();
+
+    return eng->m_packets->newPacket(data, &eng->m_packet);
+}
+
+QScriptValue WorkerScriptEngine::__getDataCount(QScriptContext */*context*/, QScriptEngine *engine)
+{
+    WorkerScriptEngine *eng = (WorkerScriptEngine*)engine;
+    return qsreal(eng->m_storage->getNextSeq() - eng->indexBase());
+}
+
+quint64 WorkerScriptEngine::indexBase() const
+{
+    return m_has_index_base ? m_index_base : m_storage->getFirstSeq();
+}
+
+QScriptValue WorkerScriptEngine::__callWidget(QScriptContext *context, QScriptEngine *engine)
+{
+    if(context->argumentCount() < 2)
+        return QScriptValue();
+
+    QVariantList args;
+    for(int i = 2; i < context->argumentCount(); ++i)
+        args << context->argument(i).toVariant();
+
+    emit ((WorkerScriptEngine*)engine)->m_worker->callWidget(context->argument(0).toString(),
+                                                             context->argument(1).toString(), args);
+    return QScriptValue();
+}
+
+ScriptWorker::ScriptWorker(const QString& source, Storage *storage, QObject *parent) :
+    QThread(parent)
+{
+    m_run = true;
+    m_source = source;
+    m_storage = storage;
+    m_engine = NULL;
+    m_max_queue = (std::max)(1u, sConfig.get(CFG_QUINT32_SCRIPT_QUEUE_SIZE));
+    m_policy = sConfig.get(CFG_QUINT32_SCRIPT_QUEUE_POLICY);
+    // run() processes the queue after the source is loaded
+    m_scheduled = true;
+    m_busy = 0;
+    m_dropped = 0;
+}
+
+ScriptWorker::~ScriptWorker()
+{
+    stop();
+}
+
+void ScriptWorker::stop()
+{
+    {
+        QMutexLocker l(&m_lock);
+        m_run = false;
+        m_space.wakeAll();
+        if(m_engine)
+            QMetaObject::invokeMethod(m_engine, "abort", Qt::QueuedConnection);
+    }
+    wait();
+}
+
+void ScriptWorker::post(const ScriptMessage& msg)
+{
+    QMutexLocker l(&m_lock);
+    if(m_queue.size() >= m_max_queue)
+    {
+        switch(m_policy)
+        {
+            case SCRIPT_DROP_NEWEST:
+                ++m_dropped;
+                return;
+            case SCRIPT_WAIT:
+            {
+                QElapsedTimer time;
+                time.start();
+                while(m_run && m_queue.size() >= m_max_queue && time.elapsed() < SCRIPT_WAIT_TIMEOUT)
+                    m_space.wait(&m_lock, SCRIPT_WAIT_TIMEOUT - time.elapsed());
+
+                if(m_queue.size() >= m_max_queue)
+                {
+                    ++m_dropped;
+                    return;
+                }
+                break;
+            }
+            default:
+                while(m_queue.size() >= m_max_queue)
+                {
+                    m_queue.pop_front();
+                    ++m_dropped;
+                }
+                break;
+        }
+    }
+
+    m_queue.push_back(msg);
+
+    if(!m_scheduled && m_engine)
+    {
+        m_scheduled = true;
+        QMetaObject::invokeMethod(m_engine, "processQueue", Qt::QueuedConnection);
+    }
+}
+
+void ScriptWorker::take(std::deque<ScriptMessage>& msgs)
+{
+    QMutexLocker l(&m_lock);
+    msgs.swap(m_queue);
+    if(msgs.empty())
+        m_scheduled = false;
+    m_space.wakeAll();
+}
+
+void ScriptWorker::addBusyTime(quint64 ns)
+{
+    QMutexLocker l(&m_lock);
+    m_busy += ns;
+}
+
+quint64 ScriptWorker::takeBusyTime()
+{
+    QMutexLocker l(&m_lock);
+    quint64 res = m_busy;
+    m_busy = 0;
+    return res;
+}
+
+quint32 ScriptWorker::takeDropped()
+{
+    QMutexLocker l(&m_lock);
+    quint32 res = m_dropped;
+    m_dropped = 0;
+    return res;
+}
+
+quint32 ScriptWorker::getQueued()
+{
+    QMutexLocker l(&m_lock);
+    return m_queue.size();
+}
+
+void ScriptWorker::run()
+{
+    WorkerScriptEngine *engine = new WorkerScriptEngine(this, m_storage);
+    PacketScriptClass *packets = new PacketScriptClass(engine);
+    engine->setPacketClass(packets);
+
+    bool run;
+    {
+        QMutexLocker l(&m_lock);
+        run = m_run;
+        if(run)
+            m_engine = engine;
+    }
+
+    if(run)
+    {
+        engine->load(m_source);
+        engine->processQueue();
+
+        // stop() sets m_run before it posts abort(), which is either
+        // delivered during load or quits the event loop
+        if(m_run)
+            exec();
+
+        engine->unload();
+
+        QMutexLocker l(&m_lock);
+        m_engine = NULL;
+    }
+
+    // objects of the class are owned by the engine, delete it afterwards
+    delete engine;
+    delete packets;
+}
+
+ThreadedScriptEngine::ThreadedScriptEngine(WidgetArea *area, quint32 w_id, ScriptWidget *parent) :
+    ScriptEngine(area, w_id, parent)
+{
+    m_worker = NULL;
+
+    connect(&m_usageTimer, SIGNAL(timeout()), SLOT(updateUsage()));
+    setSource(QString());
+}
+
+ThreadedScriptEngine::~ThreadedScriptEngine()
+{
+    delete m_worker;
+}
+
+void ThreadedScriptEngine::setSource(const QString& source)
+{
+    m_source = source;
+
+    delete m_worker;
+    m_worker = new ScriptWorker(source, getStorage(), this);
+
+    connect(m_worker, SIGNAL(clearTerm()),                this, SIGNAL(clearTerm()));
+    connect(m_worker, SIGNAL(appendTerm(QString)),        this, SIGNAL(appendTerm(QString)));
+    connect(m_worker, SIGNAL(appendTermRaw(QByteArray)),  this, SIGNAL(appendTermRaw(QByteArray)));
+    connect(m_worker, SIGNAL(SendData(QByteArray)),       this, SIGNAL(SendData(QByteArray)));
+    connect(m_worker, SIGNAL(error(QString)),             this, SIGNAL(error(QString)));
+    connect(m_worker, SIGNAL(alert(QString)),             this, SLOT(showAlert(QString)));
+    connect(m_worker, SIGNAL(callWidget(QString,QString,QVariantList)),
+                                                          this, SLOT(callWidget(QString,QString,QVariantList)));
+
+    m_worker->start();
+
+    const WidgetArea::w_map& widgets = m_area->getWidgets();
+    for(WidgetArea::w_map::const_iterator itr = widgets.begin(); itr != widgets.end(); ++itr)
+        onWidgetAdd(*itr);
+
+    m_usageElapsed.start();
+    m_usageTimer.start(USAGE_INTERVAL);
+}
+
+QString ThreadedScriptEngine::dataChanged(analyzer_data *data, quint64 seq)
+{
+    ScriptMessage msg(ScriptMessage::MSG_DATA);
+    msg.data = data->getData();
+    msg.seq = seq;
+    if(data->getPacket())
+        msg.big_endian = data->getPacket()->big_endian;
+
+    quint8 res = 0;
+    if(data->getDeviceId(res))
+        msg.dev = res;
+    if(data->getCmd(res))
+        msg.cmd = res;
+
+    m_worker->post(msg);
+
+    // result is printed when the worker gets to it
+    return QString();
+}
+
+void ThreadedScriptEngine::onWidgetAdd(DataWidget *w)
+{
+    // widget objects can't be passed to other thread, the script gets just
+    // the name it can use with callWidget()
+    const QString name = sanitizeWidgetName(w->getTitle());
+    if(!name.isEmpty())
+        callEventHandler("onWidgetAdd", (QVariantList() << QVariant() << name));
+}
+
+void ThreadedScriptEngine::onWidgetRemove(DataWidget *w)
+{
+    const QString name = sanitizeWidgetName(w->getTitle());
+    if(!name.isEmpty())
+        callEventHandler("onWidgetRemove", (QVariantList() << QVariant() << name));
+}
+
+void ThreadedScriptEngine::callEventHandler(const QString& eventId, const QVariantList& args)
+{
+    ScriptMessage msg(ScriptMessage::MSG_EVENT);
+    msg.text = eventId;
+    msg.args = args;
+    m_worker->post(msg);
+}
+
+void ThreadedScriptEngine::onSave()
+{
+    callEventHandler("onSave");
+}
+
+void ThreadedScriptEngine::keyPressed(const QString &key)
+{
+    if(key.isEmpty())
+        return;
+
+    ScriptMessage msg(ScriptMessage::MSG_KEY);
+    msg.text = key;
+    m_worker->post(msg);
+}
+
+void ThreadedScriptEngine::rawData(const QByteArray& data)
+{
+    ScriptMessage msg(ScriptMessage::MSG_RAW);
+    msg.data = data;
+    m_worker->post(msg);
+}
+
+void ThreadedScriptEngine::showAlert(const QString& text)
+{
+    Utils::showErrorBox(text);
+}
+
+void ThreadedScriptEngine::callWidget(const QString& name, const QString& method, const QVariantList& args)
+{
+    const WidgetArea::w_map& widgets = m_area->getWidgets();
+    for(WidgetArea::w_map::const_iterator itr = widgets.begin(); itr != widgets.end(); ++itr)
+    {
+        if(sanitizeWidgetName((*itr)->getTitle()) != name)
+            continue;
+
+        if(!invoke(*itr, method, args))
+            emit error(tr("callWidget: widget %1 has no method %2 with %3 arguments").arg(name).arg(method).arg(args.size()));
+        return;
+    }
+    emit error(tr("callWidget: widget %1 not found").arg(name));
+}
+
+bool ThreadedScriptEngine::invoke(QObject *object, const QString& method, const QVariantList& args)
+{
+    const QByteArray methodName = method.toLatin1();
+    const QMetaObject *meta = object->metaObject();
+    for(int i = 0; i < meta->methodCount(); ++i)
+    {
+        QMetaMethod m = meta->method(i);
+        if(m.access() != QMetaMethod::Public || m.methodType() == QMetaMethod::Signal)
+            continue;
+
+#if QT_VERSION < 0x050000
+        const QByteArray signature = m.signature();
+#else
+        const QByteArray signature = m.methodSignature();
+#endif
+        if(signature.left(signature.indexOf('(')) != methodName)
+            continue;
+
+        const QList<QByteArray> types = m.parameterTypes();
+        if(types.size() != args.size() || types.size() > 10)
+            continue;
+
+        // Convert arguments to parameter types, numbers from script are doubles
+        QVariant values[10];
+        QGenericArgument params[10];
+        int p = 0;
+        for(; p < types.size(); ++p)
+        {
+            values[p] = args[p];
+            if(types[p] != "QVariant")
+            {
+                const int type = QMetaType::type(types[p].constData());
+                if(type == 0 || !values[p].convert((QVariant::Type)type))
+                    break;
+                params[p] = QGenericArgument(types[p].constData(), values[p].constData());
+            }
+            else
+                params[p] = QGenericArgument("QVariant", &values[p]);
+        }
+
+        if(p != types.size())
+            continue;
+
+        return m.invoke(object, Qt::DirectConnection, params[0], params[1], params[2], params[3], params[4],
+                        params[5], params[6], params[7], params[8], params[9]);
+    }
+    return false;
+}
+
+void ThreadedScriptEngine::updateUsage()
+{
+    const qint64 elapsed = m_usageElapsed.nsecsElapsed();
+    m_usageElapsed.restart();
+
+    const quint32 cpu = elapsed > 0 ? m_worker->takeBusyTime()*100/elapsed : 0;
+    const quint32 budget = sConfig.get(CFG_QUINT32_SCRIPT_CPU_BUDGET);
+
+    emit usageChanged(tr("CPU %1 %, queued %2, dropped %3").arg(cpu).arg(m_worker->getQueued()).arg(m_worker->takeDropped()),
+                      cpu > budget);
+}
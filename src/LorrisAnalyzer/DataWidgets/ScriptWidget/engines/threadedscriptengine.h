@@ -0,0 +1,212 @@
+/**********************************************
+**    This file is part of Lorris
+**    http://tasssadar.github.com/Lorris/
+**
+**    See README and COPYING
+***********************************************/
+
+#ifndef THREADEDSCRIPTENGINE_H
+#define THREADEDSCRIPTENGINE_H
+
+#include <deque>
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QScriptEngine>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QVariantList>
+
+#include "../../../packet.h"
+#include "scriptengine.h"
+
+class PacketScriptClass;
+class ScriptWorker;
+
+// What happens with new messages when worker's queue is full,
+// stored in CFG_QUINT32_SCRIPT_QUEUE_POLICY
+enum ScriptQueuePolicy
+{
+    SCRIPT_DROP_OLDEST = 0,
+    SCRIPT_DROP_NEWEST,
+    SCRIPT_WAIT
+};
+
+struct ScriptMessage
+{
+    enum Type
+    {
+        MSG_DATA,
+        MSG_KEY,
+        MSG_RAW,
+        MSG_EVENT
+    };
+
+    ScriptMessage(quint8 msgType = MSG_DATA) : type(msgType), seq(0), dev(-1), cmd(-1), big_endian(true)
+    {
+    }
+
+    quint8 type;
+    QByteArray data;
+    QString text;       // key or event name
+    QVariantList args;  // event arguments
+    quint64 seq;        // sequence number of the packet, see Storage::addData()
+    qint32 dev;
+    qint32 cmd;
+    bool big_endian;
+};
+
+// QScriptEngine living in ScriptWorker's thread. Scripts have
+// no access to GUI objects there, widgets are used through
+// callWidget(name, method, args...), which is sent back to GUI thread.
+class WorkerScriptEngine : public QScriptEngine
+{
+    Q_OBJECT
+
+public:
+    WorkerScriptEngine(ScriptWorker *worker, Storage *storage);
+
+    // objects of the class are owned by the engine, so it has to be deleted afterwards
+    void setPacketClass(PacketScriptClass *packets) { m_packets = packets; }
+
+    void load(const QString& source);
+    void unload();
+
+public slots:
+    void processQueue();
+    void abort();
+
+private slots:
+    void freezeDetectorTimeout();
+
+private:
+    QScriptValue call(QScriptValue& fn, const QScriptValueList& args);
+    void finishCall(const QElapsedTimer& time);
+    void handleData(std::deque<ScriptMessage>& msgs, size_t& idx);
+    void setBigEndian(bool big_endian);
+    quint64 indexBase() const;
+
+    static QScriptValue __clearTerm(QScriptContext *context, QScriptEngine *engine);
+    static QScriptValue __appendTerm(QScriptContext *context, QScriptEngine *engine);
+    static QScriptValue __sendData(QScriptContext *context, QScriptEngine *engine);
+    static QScriptValue __throwException(QScriptContext *context, QScriptEngine *engine);
+    static QScriptValue __newTimer(QScriptContext *context, QScriptEngine *engine);
+    static QScriptValue __getData(QScriptContext *context, QScriptEngine *engine);
+    static QScriptValue __getDataCount(QScriptContext *context, QScriptEngine *engine);
+    static QScriptValue __callWidget(QScriptContext *context, QScriptEngine *engine);
+
+    static QByteArray toBytes(const QScriptValue& value);
+
+    ScriptWorker *m_worker;
+    Storage *m_storage;
+    PacketScriptClass *m_packets;
+    analyzer_packet m_packet;
+    bool m_processing;
+
+    // Sequence number of index 0 for getData() while data handlers run,
+    // so indexes the script got stay valid even if the storage drops packets
+    quint64 m_index_base;
+    bool m_has_index_base;
+
+    QScriptValue m_global;
+    QScriptValue m_on_data;
+    QScriptValue m_on_data_batch;
+    QScriptValue m_on_key;
+    QScriptValue m_on_raw;
+    QScriptValue m_on_script_exit;
+
+    QTimer m_freezeDetectTimer;
+};
+
+// Thread of one script. Messages are queued by post(), the queue
+// is bounded by CFG_QUINT32_SCRIPT_QUEUE_SIZE and full queue is handled
+// according to ScriptQueuePolicy. Everything the script wants
+// to do with GUI is emitted as signal.
+class ScriptWorker : public QThread
+{
+    Q_OBJECT
+
+    friend class WorkerScriptEngine;
+Q_SIGNALS:
+    void clearTerm();
+    void appendTerm(const QString& text);
+    void appendTermRaw(const QByteArray& data);
+    void SendData(const QByteArray& data);
+    void error(const QString& text);
+    void alert(const QString& text);
+    void callWidget(const QString& widget, const QString& method, const QVariantList& args);
+
+public:
+    ScriptWorker(const QString& source, Storage *storage, QObject *parent = 0);
+    ~ScriptWorker();
+
+    void post(const ScriptMessage& msg);
+    void stop();
+
+    // Time spent in script code in ns and number of dropped
+    // messages since the last call
+    quint64 takeBusyTime();
+    quint32 takeDropped();
+    quint32 getQueued();
+
+protected:
+    void run();
+
+private:
+    void take(std::deque<ScriptMessage>& msgs);
+    void addBusyTime(quint64 ns);
+
+    volatile bool m_run;
+    QString m_source;
+    Storage *m_storage;
+    WorkerScriptEngine *m_engine;
+
+    QMutex m_lock;
+    QWaitCondition m_space;
+    std::deque<ScriptMessage> m_queue;
+    quint32 m_max_queue;
+    quint32 m_policy;
+    bool m_scheduled;
+
+    quint64 m_busy;
+    quint32 m_dropped;
+};
+
+// ScriptEngine which runs QtScript in ScriptWorker, so that slow
+// script does not block the GUI. Results of onDataChanged are printed
+// to terminal when they arrive, dataChanged() itself returns nothing.
+class ThreadedScriptEngine : public ScriptEngine
+{
+    Q_OBJECT
+
+public:
+    ThreadedScriptEngine(WidgetArea *area, quint32 w_id, ScriptWidget *parent);
+    ~ThreadedScriptEngine();
+
+    void setSource(const QString& source);
+
+    QString dataChanged(analyzer_data *data, quint64 seq);
+
+    void onWidgetAdd(DataWidget *w);
+    void onWidgetRemove(DataWidget *w);
+    void callEventHandler(const QString& eventId, const QVariantList& args = QVariantList());
+    void onSave();
+
+public slots:
+    void keyPressed(const QString &key);
+    void rawData(const QByteArray& data);
+
+private slots:
+    void callWidget(const QString& name, const QString& method, const QVariantList& args);
+    void showAlert(const QString& text);
+    void updateUsage();
+
+private:
+    bool invoke(QObject *object, const QString& method, const QVariantList& args);
+
+    ScriptWorker *m_worker;
+    QTimer m_usageTimer;
+    QElapsedTimer m_usageElapsed;
+};
+
+#endif // THREADEDSCRIPTENGINE_H
@@ -1,12 +1,25 @@
 // You can use clearTerm() and appendTerm(string) to set term content
 // You can use sendData(Array of ints) to send data to device. It expects array of uint8s
+// When "Run in separate thread" is checked, widgets are not accessible directly,
+// use callWidget("widgetName", "method", args...) instead
 
 // This function gets called on data received
 // it should return string, which is automatically appended to terminal
+// data behaves like an array of bytes, which can be changed but not resized,
+// numbers can be read with data.getUInt16(pos), getInt32(pos), getFloat(pos),
+// getDouble(pos)...
 function onDataChanged(data, dev, cmd, index) {
     return "";
 }
 
+// If defined, this function is called instead of onDataChanged with
+// array of all packets received since the last screen update.
+// seqs[i] is sequence number of packets[i], it grows by one with every
+// received packet, so gaps are packets which did not pass the filter
+//function onDataChangedBatch(packets, seqs) {
+//    return "";
+//}
+
 // This function is called on key press in terminal.
 // Param is string
 function onKeyPress(key) {
@@ -6,6 +6,14 @@
 def onDataChanged(data, dev, cmd, index):
     return ""
 
+# If defined, this function is called instead of onDataChanged with
+# list of all packets received since the last screen update. Packets
+# are memoryviews, e.g. numpy.frombuffer(packets[0], dtype=numpy.uint16).
+# seqs[i] is sequence number of packets[i], it grows by one with every
+# received packet, so gaps are packets which did not pass the filter
+#def onDataChangedBatch(packets, seqs):
+#    return ""
+
 # This function is called on key press in terminal.
 # Param is string
 def onKeyPress(key):
@@ -11,8 +11,10 @@
 #include "scriptwidget.h"
 #include "scripteditor.h"
 #include "engines/qtscriptengine.h"
+#include "engines/threadedscriptengine.h"
 #include "../../../ui/terminal.h"
 #include "../../widgetarea.h"
+#include "../../storage.h"
 
 REGISTER_DATAWIDGET(WIDGET_SCRIPT, Script, NULL)
 W_TR(QT_TRANSLATE_NOOP("DataWidget", "Script"))
@@ -29,10 +31,15 @@ ScriptWidget::ScriptWidget(QWidget *parent) : DataWidget(parent)
     m_inputEdit->hide();
     layout->addWidget(m_inputEdit);
 
+    m_usageLabel = new QLabel(this);
+    m_usageLabel->hide();
+    layout->addWidget(m_usageLabel);
+
     resize(120, 100);
 
     m_engine = NULL;
     m_engine_type = ENGINE_QTSCRIPT;
+    m_threaded = false;
 }
 
 ScriptWidget::~ScriptWidget()
@@ -60,8 +67,12 @@ void ScriptWidget::setUp(Storage *storage)
     QAction *src_act = contextMenu->addAction(tr("Set source..."));
     m_inputAct = contextMenu->addAction(tr("Show input line"));
     m_inputAct->setCheckable(true);
+    m_threadAct = contextMenu->addAction(tr("Run in separate thread"));
+    m_threadAct->setCheckable(true);
+    m_threadAct->setToolTip(tr("Script does not block the GUI, but it can use widgets only through callWidget()."));
 
     connect(m_inputAct,           SIGNAL(triggered(bool)), SLOT(inputShowAct(bool)));
+    connect(m_threadAct,          SIGNAL(triggered(bool)), SLOT(threadAct(bool)));
     connect(m_inputEdit,          SIGNAL(keyPressed(int)), SLOT(inputLineKeyPressed(int)));
     connect(m_inputEdit,          SIGNAL(keyReleased(int)), SLOT(inputLineKeyReleased(int)));
     connect(src_act,              SIGNAL(triggered()), SLOT(setSourceTriggered()));
@@ -82,7 +93,12 @@ void ScriptWidget::setUp(Storage *storage)
 void ScriptWidget::createEngine()
 {
     delete m_engine;
-    m_engine = ScriptEngine::getEngine(m_engine_type, (WidgetArea*)parent(), getId(), this);
+
+    // only QtScript can have more instances in different threads
+    if(m_threaded && m_engine_type == ENGINE_QTSCRIPT)
+        m_engine = new ThreadedScriptEngine((WidgetArea*)parent(), getId(), this);
+    else
+        m_engine = ScriptEngine::getEngine(m_engine_type, (WidgetArea*)parent(), getId(), this);
 
     if(!m_engine && m_engine_type != ENGINE_QTSCRIPT)
     {
@@ -96,22 +112,72 @@ void ScriptWidget::createEngine()
     m_engine->setPos(pos().x(), pos().y());
     m_engine->setSize(size());
 
+    m_threadAct->setEnabled(m_engine_type == ENGINE_QTSCRIPT);
+    m_threadAct->setChecked(m_threaded);
+    m_usageLabel->hide();
+
     connect(m_terminal,    SIGNAL(keyPressed(QString)),         m_engine,   SLOT(keyPressed(QString)));
     connect(m_engine,      SIGNAL(clearTerm()),                 m_terminal, SLOT(clear()));
     connect(m_engine,      SIGNAL(appendTerm(QString)),         m_terminal, SLOT(appendText(QString)));
     connect(m_engine,      SIGNAL(appendTermRaw(QByteArray)),   m_terminal, SLOT(appendText(QByteArray)));
     connect(m_engine,      SIGNAL(SendData(QByteArray)),        this,       SIGNAL(SendData(QByteArray)));
     connect(m_engine,      SIGNAL(error(QString)),              this,       SLOT(blinkError(QString)));
+    connect(m_engine,      SIGNAL(usageChanged(QString,bool)),  this,       SLOT(showUsage(QString,bool)));
     connect(this,          SIGNAL(rawData(QByteArray)),         m_engine,   SLOT(rawData(QByteArray)));
 }
 
-void ScriptWidget::newData(analyzer_data *data, quint32 index)
+void ScriptWidget::newData(analyzer_data *data, quint64 seq)
 {
     // FIXME: is it correct?
     //if(!m_updating)
     //    return;
 
-    QString res = m_engine->dataChanged(data, index);
+    QString res = m_engine->dataChanged(data, seq);
+    if(!res.isEmpty())
+        m_terminal->appendText(res);
+}
+
+void ScriptWidget::processBatch(analyzer_data *last, const std::vector<quint64>& seqs)
+{
+    // Scripts have to see every packet, but the terminal
+    // is updated only once for the whole batch. Packets removed
+    // from the storage since they were received are skipped.
+    Storage *storage = widgetArea()->getStorage();
+
+    QString res;
+    QByteArray data;
+    if(m_engine->hasBatchHandler())
+    {
+        std::vector<QByteArray> packets;
+        std::vector<quint64> found;
+        packets.reserve(seqs.size());
+        found.reserve(seqs.size());
+
+        for(size_t i = 0; i < seqs.size(); ++i)
+        {
+            if(!storage->getBySeq(seqs[i], data))
+                continue;
+
+            packets.push_back(data);
+            found.push_back(seqs[i]);
+        }
+
+        if(!packets.empty())
+            res = m_engine->dataChangedBatch(packets, found, last->getPacket());
+    }
+    else
+    {
+        analyzer_data cur(QByteArray(), last->getPacket());
+        for(size_t i = 0; i < seqs.size(); ++i)
+        {
+            if(!storage->getBySeq(seqs[i], data))
+                continue;
+
+            cur.setData(data);
+            res += m_engine->dataChanged(&cur, seqs[i]);
+        }
+    }
+
     if(!res.isEmpty())
         m_terminal->appendText(res);
 }
@@ -124,6 +190,10 @@ void ScriptWidget::saveWidgetInfo(DataFileParser *file)
     file->writeBlockIdentifier("scriptWType");
     file->write((char*)&m_engine_type, sizeof(m_engine_type));
 
+    // separate thread
+    file->writeBlockIdentifier("scriptWThread");
+    file->writeVal(m_threaded);
+
     // source
     file->writeBlockIdentifier("scriptWSource");
     file->writeString(m_engine->getSource());
@@ -165,6 +235,10 @@ void ScriptWidget::loadWidgetInfo(DataFileParser *file)
     else
         m_engine_type = ENGINE_QTSCRIPT;
 
+    // separate thread
+    if(file->seekToNextBlock("scriptWThread", BLOCK_WIDGET))
+        m_threaded = file->readVal<bool>();
+
     QString source = "";
     // source
     if(file->seekToNextBlock("scriptWSource", BLOCK_WIDGET))
@@ -355,3 +429,25 @@ void ScriptWidget::inputLineKeyReleased(int keyCode)
     if(m_engine)
         m_engine->callEventHandler("inputLineKeyReleased", (QVariantList() << keyCode));
 }
+
+void ScriptWidget::threadAct(bool threaded)
+{
+    if(threaded == m_threaded)
+        return;
+
+    m_threaded = threaded;
+
+    QString source = m_engine->getSource();
+    createEngine();
+    clearErrors();
+    if(m_editor)
+        connect(m_engine, SIGNAL(error(QString)), m_editor, SLOT(addError(QString)));
+    setSourceDirect(source);
+}
+
+void ScriptWidget::showUsage(const QString& text, bool overBudget)
+{
+    m_usageLabel->setText(text);
+    m_usageLabel->setStyleSheet(overBudget ? "color: red" : "");
+    m_usageLabel->show();
+}
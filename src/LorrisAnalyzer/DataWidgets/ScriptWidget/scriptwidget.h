@@ -56,9 +56,12 @@ protected slots:
      void setSourceDirect(const QString& source);
      void inputLineKeyPressed(int keyCode);
      void inputLineKeyReleased(int keyCode);
+     void threadAct(bool threaded);
+     void showUsage(const QString& text, bool overBudget);
 
 protected:
-     void newData(analyzer_data *data, quint32 index);
+     void newData(analyzer_data *data, quint64 seq);
+     void processBatch(analyzer_data *last, const std::vector<quint64>& seqs);
      void moveEvent(QMoveEvent *);
      void resizeEvent(QResizeEvent *);
      void titleDoubleClick();
@@ -73,6 +76,9 @@ protected:
      Terminal *m_terminal;
      HookedLineEdit *m_inputEdit;
      QAction *m_inputAct;
+     QAction *m_threadAct;
+     QLabel *m_usageLabel;
+     bool m_threaded;
      QString m_filename;
      QString m_errors;
 };
@@ -155,9 +155,9 @@ void BarWidget::setValuePrivate(double val)
 {
     if(m_eval.isActive())
     {
-        QVariant res = m_eval.evaluate(QString::number(val));
-        if(res.isValid())
-            val = res.toDouble();
+        double res;
+        if(m_eval.evaluate(val, res))
+            val = res;
     }
 
     m_bar->setValue(val);
@@ -165,15 +165,14 @@ void CircleWidget::setValue(QVariant var)
 {
     if(m_eval.isActive())
     {
-        // .toString() on char type makes one
-        // character string instead of value transcript
+        // char types do not convert to double
         if ((int)var.type() == QMetaType::QChar ||
             (int)var.type() == QMetaType::UChar)
             var.convert(QVariant::Int);
 
-        QVariant res = m_eval.evaluate(var.toString());
-        if(res.isValid())
-            var.swap(res);
+        double res;
+        if(m_eval.evaluate(var.toDouble(), res))
+            var = QVariant(res);
     }
 
     float rad = toRad(var);
@@ -505,7 +505,7 @@ void DataWidget::dragMove(QMouseEvent *e, DataWidget *widget)
     emit updateMarker(widget);
 }
 
-void DataWidget::newData(analyzer_data *data, quint32 /*index*/)
+void DataWidget::newData(analyzer_data *data, quint64 /*seq*/)
 {
     if(!isUpdating() || !isAssigned() || m_info.pos >= (quint32)data->getData().length())
         return;
@@ -513,6 +513,11 @@ void DataWidget::newData(analyzer_data *data, quint32 /*index*/)
     processData(data);
 }
 
+void DataWidget::processBatch(analyzer_data *last, const std::vector<quint64>& seqs)
+{
+    newData(last, seqs.back());
+}
+
 void DataWidget::processData(analyzer_data */*data*/)
 {
 
@@ -189,7 +189,13 @@ public:
     void dragMove(QMouseEvent* e, DataWidget *widget);
 
 public slots:
-    virtual void newData(analyzer_data *data, quint32);
+    // seq is sequence number of the packet, see Storage::addData()
+    virtual void newData(analyzer_data *data, quint64 seq);
+    // Called once per display tick with sequence numbers of all packets which
+    // passed the filter since the last tick, last is the newest one. Widgets
+    // which show only the current value just need that one, others (e.g.
+    // scripts) can read the rest from Storage, see Storage::getBySeq().
+    virtual void processBatch(analyzer_data *last, const std::vector<quint64>& seqs);
     void setTitle(QString title);
     void lockTriggered();
     void remove();
@@ -184,28 +184,14 @@ void NumberWidget::setValue(QVariant var)
 
     if(m_eval.isActive())
     {
-        // .toString() on char type makes one
-        // character string instead of value transcript
+        // char types do not convert to double
         if ((int)var.type() == QMetaType::QChar ||
             (int)var.type() == QMetaType::UChar)
             var.convert(QVariant::Int);
 
-        QVariant res = m_eval.evaluate(var.toString());
-        if(res.isValid())
-        {
-            switch(res.type())
-            {
-                case QVariant::Int:
-                    n.setNum(res.toInt(), base[m_format]);
-                    break;
-                case QVariant::Double:
-                    n.setNum(res.toDouble(), fmt[m_format], m_digits);
-                    break;
-                default:
-                    n = res.toString();
-                    break;
-            }
-        }
+        double res;
+        if(m_eval.evaluate(var.toDouble(), res))
+            n.setNum(res, fmt[m_format], m_digits);
     }
     else
     {
@@ -0,0 +1,377 @@
+/**********************************************
+**    This file is part of Lorris
+**    http://tasssadar.github.com/Lorris/
+**
+**    See README and COPYING
+***********************************************/
+
+#include <algorithm>
+#include <string.h>
+#include <stddef.h>
+#include <QDir>
+#include <QDateTime>
+#include <QCoreApplication>
+#include <QCryptographicHash>
+
+#ifdef Q_OS_WIN
+ #include <io.h>
+#else
+ #include <unistd.h>
+#endif
+
+#include "capturejournal.h"
+#include "../misc/config.h"
+#include "../misc/datafileparser.h"
+
+#define JOURNAL_VERSION 1
+// Journal is abandoned if it was not touched for this long, in ms
+#define JOURNAL_STALE_TIME (60*1000)
+
+CaptureJournal::CaptureJournal(QObject *parent) : QThread(parent)
+{
+    QDir().mkpath(getFolder());
+
+    m_filename = nextFilename();
+    m_file.setFileName(m_filename);
+    if(!m_file.open(QIODevice::ReadWrite | QIODevice::Truncate))
+        throw tr("Cannot open file \"%1\"!").arg(m_filename);
+
+    m_failed = false;
+    m_clear = false;
+    m_rotate = false;
+    m_packet_count = 0;
+    writeHeader();
+
+    m_run = true;
+    start(QThread::LowPriority);
+}
+
+CaptureJournal::~CaptureJournal()
+{
+    stop(false);
+}
+
+QString CaptureJournal::nextFilename()
+{
+    static quint32 counter = 0;
+
+    return QString("%1capture_%2_%3_%4.ljrn")
+            .arg(getFolder())
+            .arg(QDateTime::currentDateTime().toString("yyyyMMdd_hhmmss"))
+            .arg(QCoreApplication::applicationPid())
+            .arg(counter++);
+}
+
+void CaptureJournal::addPacket(const QByteArray& data)
+{
+    QMutexLocker l(&m_lock);
+    m_packets.push_back(data);
+    ++m_packet_count;
+}
+
+quint32 CaptureJournal::getPacketCount()
+{
+    QMutexLocker l(&m_lock);
+    return m_packet_count;
+}
+
+void CaptureJournal::addSnapshot(const QByteArray& head, const QByteArray& tail)
+{
+    const quint32 len = head.size();
+
+    QByteArray snapshot;
+    snapshot.reserve(sizeof(len) + head.size() + tail.size());
+    snapshot.append((char*)&len, sizeof(len));
+    snapshot.append(head);
+    snapshot.append(tail);
+
+    QMutexLocker l(&m_lock);
+    m_snapshot = snapshot;
+}
+
+void CaptureJournal::clear()
+{
+    QMutexLocker l(&m_lock);
+    m_packets.clear();
+    m_packet_count = 0;
+    m_clear = true;
+}
+
+// packets must be all packets which should stay in the journal,
+// including those which were added but were not written yet
+void CaptureJournal::rotate(const std::vector<QByteArray>& packets)
+{
+    QMutexLocker l(&m_lock);
+    m_packets = packets;
+    m_packet_count = packets.size();
+    m_rotate = true;
+}
+
+void CaptureJournal::stop(bool remove)
+{
+    {
+        QMutexLocker l(&m_lock);
+        m_run = false;
+        m_cond.wakeOne();
+    }
+    wait();
+
+    if(m_file.isOpen())
+        m_file.close();
+    if(remove)
+        QFile::remove(m_filename);
+}
+
+void CaptureJournal::run()
+{
+    const unsigned long interval = (std::max)(1u, sConfig.get(CFG_QUINT32_JOURNAL_SYNC));
+
+    std::vector<QByteArray> packets;
+    QByteArray snapshot;
+    bool run = true;
+    while(run)
+    {
+        bool clear = false;
+        bool rotate = false;
+        {
+            QMutexLocker l(&m_lock);
+            if(m_run)
+                m_cond.wait(&m_lock, interval);
+
+            run = m_run;
+            clear = m_clear;
+            rotate = m_rotate;
+            m_clear = m_rotate = false;
+            packets.swap(m_packets);
+            snapshot.swap(m_snapshot);
+        }
+
+        if(m_failed)
+        {
+            packets.clear();
+            snapshot.clear();
+            continue;
+        }
+
+        // Old file is kept until the new one is complete
+        QString oldFile;
+        if(rotate && !clear)
+        {
+            m_file.close();
+            m_file.setFileName(nextFilename());
+            if(!m_file.open(QIODevice::ReadWrite | QIODevice::Truncate))
+            {
+                qWarning("Failed to create analyzer journal %s, journal is disabled",
+                         m_file.fileName().toLocal8Bit().constData());
+                m_file.setFileName(m_filename);
+                m_failed = true;
+                continue;
+            }
+            oldFile = m_filename;
+            m_filename = m_file.fileName();
+        }
+
+        // Snapshot has to stay in the journal after it is truncated
+        if(clear || rotate)
+        {
+            if(clear)
+                m_file.resize(0);
+            writeHeader();
+            if(snapshot.isEmpty())
+                snapshot = m_last_snapshot;
+        }
+
+        if(!snapshot.isEmpty())
+        {
+            writeRecord(JRNL_SNAPSHOT, snapshot);
+            m_last_snapshot = snapshot;
+            snapshot.clear();
+        }
+
+        if(!packets.empty())
+        {
+            quint32 size = sizeof(quint32);
+            for(size_t i = 0; i < packets.size(); ++i)
+                size += sizeof(quint32) + packets[i].size();
+
+            QByteArray data;
+            data.reserve(size);
+
+            const quint32 count = packets.size();
+            data.append((char*)&count, sizeof(count));
+            for(size_t i = 0; i < packets.size(); ++i)
+            {
+                const quint32 len = packets[i].size();
+                data.append((char*)&len, sizeof(len));
+                data.append(packets[i]);
+            }
+            packets.clear();
+
+            writeRecord(JRNL_PACKETS, data);
+        }
+
+        sync();
+
+        if(!oldFile.isEmpty() && !m_failed)
+            QFile::remove(oldFile);
+    }
+}
+
+void CaptureJournal::writeHeader()
+{
+    JournalHeader header;
+    memcpy(header.str, "LJRN", 4);
+    header.version = JOURNAL_VERSION;
+    header.header_size = sizeof(JournalHeader);
+    header.alive = QDateTime::currentMSecsSinceEpoch();
+
+    m_file.seek(0);
+    if(m_file.write((char*)&header, sizeof(header)) != sizeof(header))
+    {
+        qWarning("Failed to write analyzer journal %s, journal is disabled", m_filename.toLocal8Bit().constData());
+        m_failed = true;
+    }
+}
+
+void CaptureJournal::writeRecord(quint8 type, const QByteArray& data)
+{
+    JournalRecord rec;
+    rec.type = type;
+    rec.len = data.size();
+
+    const QByteArray md5 = QCryptographicHash::hash(data, QCryptographicHash::Md5);
+    std::copy(md5.data(), md5.data()+sizeof(rec.md5), rec.md5);
+
+    if(m_file.write((char*)&rec, sizeof(rec)) != sizeof(rec) || m_file.write(data) != data.size())
+    {
+        qWarning("Failed to write analyzer journal %s, journal is disabled", m_filename.toLocal8Bit().constData());
+        m_failed = true;
+    }
+}
+
+// Updates alive time and makes sure the data are on disk
+void CaptureJournal::sync()
+{
+    if(m_failed)
+        return;
+
+    const qint64 end = m_file.pos();
+    const quint64 alive = QDateTime::currentMSecsSinceEpoch();
+    m_file.seek(offsetof(JournalHeader, alive));
+    m_file.write((char*)&alive, sizeof(alive));
+    m_file.seek(end);
+
+    m_file.flush();
+#ifdef Q_OS_WIN
+    _commit(m_file.handle());
+#else
+    fsync(m_file.handle());
+#endif
+}
+
+QString CaptureJournal::getFolder()
+{
+    if(sConfig.get(CFG_BOOL_PORTABLE))
+        return "./data/journal/";
+    return Utils::storageLocation(Utils::DataLocation) + "/journal/";
+}
+
+QStringList CaptureJournal::findAbandoned()
+{
+    const qint64 stale = JOURNAL_STALE_TIME + 3*qint64(sConfig.get(CFG_QUINT32_JOURNAL_SYNC));
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+
+    QStringList res;
+    QDir dir(getFolder());
+    const QStringList files = dir.entryList(QStringList("*.ljrn"), QDir::Files, QDir::Name);
+    for(int i = 0; i < files.size(); ++i)
+    {
+        QFile file(dir.filePath(files[i]));
+        if(!file.open(QIODevice::ReadOnly))
+            continue;
+
+        JournalHeader header;
+        if(file.read((char*)&header, sizeof(header)) == sizeof(header) &&
+           strncmp(header.str, "LJRN", 4) == 0 && now - (qint64)header.alive < stale)
+        {
+            continue;
+        }
+        res << file.fileName();
+    }
+    return res;
+}
+
+bool CaptureJournal::readRecord(QFile& file, JournalRecord& rec, QByteArray& data)
+{
+    if(file.read((char*)&rec, sizeof(rec)) != sizeof(rec) || rec.len > file.size() - file.pos())
+        return false;
+
+    data = file.read(rec.len);
+    return (quint32)data.size() == rec.len &&
+        QCryptographicHash::hash(data, QCryptographicHash::Md5) == QByteArray::fromRawData(rec.md5, sizeof(rec.md5));
+}
+
+void CaptureJournal::compact(const QString& journal, const QString& output)
+{
+    QFile file(journal);
+    if(!file.open(QIODevice::ReadOnly))
+        throw tr("Cannot open file \"%1\"!").arg(journal);
+
+    JournalHeader header;
+    if(file.read((char*)&header, sizeof(header)) != sizeof(header) || strncmp(header.str, "LJRN", 4) != 0)
+        throw tr("This is not analyzer journal");
+
+    // Find the last snapshot first, the document has to be written
+    // before packets. Both passes stop at the first damaged record.
+    JournalRecord rec;
+    QByteArray data, snapshot;
+    file.seek(header.header_size);
+    while(readRecord(file, rec, data))
+    {
+        if(rec.type == JRNL_SNAPSHOT)
+            snapshot = data;
+    }
+
+    quint32 headLen = 0;
+    if(snapshot.size() < (int)sizeof(headLen))
+        throw tr("Journal does not contain structure of the data");
+    memcpy(&headLen, snapshot.constData(), sizeof(headLen));
+    if(headLen > snapshot.size() - sizeof(headLen))
+        throw tr("Journal does not contain structure of the data");
+
+    DataFileWriter writer(output, true, DATAFILE_ANALYZER);
+    writer.write(snapshot.mid(sizeof(headLen), headLen));
+
+    const quint32 inlineCount = 0;
+    writer.write(QByteArray((char*)&inlineCount, sizeof(inlineCount)));
+    writer.write(snapshot.mid(sizeof(headLen) + headLen));
+    snapshot.clear();
+
+    writer.beginPackets();
+
+    QByteArray part;
+    quint32 count = 0;
+    file.seek(header.header_size);
+    while(readRecord(file, rec, data))
+    {
+        quint32 recCount = 0;
+        if(rec.type != JRNL_PACKETS || data.size() < (int)sizeof(recCount))
+            continue;
+
+        memcpy(&recCount, data.constData(), sizeof(recCount));
+        part.append(data.constData() + sizeof(recCount), data.size() - sizeof(recCount));
+        count += recCount;
+
+        if(part.size() >= DATAFILE_PACKET_BLOCK_SIZE)
+        {
+            writer.writePacketBlock(part, count);
+            part.clear();
+            count = 0;
+        }
+    }
+
+    if(count != 0)
+        writer.writePacketBlock(part, count);
+
+    writer.finish();
+}
@@ -0,0 +1,112 @@
+/**********************************************
+**    This file is part of Lorris
+**    http://tasssadar.github.com/Lorris/
+**
+**    See README and COPYING
+***********************************************/
+
+#ifndef CAPTUREJOURNAL_H
+#define CAPTUREJOURNAL_H
+
+#include <vector>
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QByteArray>
+#include <QStringList>
+#include <QFile>
+
+#include "../misc/utils.h"
+
+// Journal file is JournalHeader followed by records. Each record
+// is JournalRecord and len bytes of data. Recovery reads records
+// until the first incomplete or damaged one.
+PACK_STRUCT(struct JournalHeader
+{
+    char str[4];             // must be "LJRN"
+    quint16 version;
+    quint16 header_size;
+    quint64 alive;           // ms since epoch, updated while the journal is open
+});
+
+PACK_STRUCT(struct JournalRecord
+{
+    quint8 type;             // enum JournalRecordTypes
+    quint32 len;
+    char md5[16];            // md5 of record's data
+});
+
+enum JournalRecordTypes
+{
+    // quint32 count, then count times (quint32 length, data),
+    // same as BLOCK_DATA of analyzer data file
+    JRNL_PACKETS     = 1,
+    // quint32 head length, head, tail - analyzer data file without
+    // packets, see Storage::serializeDocument()
+    JRNL_SNAPSHOT    = 2
+};
+
+// Append-only journal of analyzer's packets, so that they can be
+// recovered when Lorris crashes. Packets and snapshots of the rest
+// of the analyzer are only queued by the callers, the thread writes
+// them in one record per CFG_QUINT32_JOURNAL_SYNC interval and syncs
+// the file to disk afterwards. clear() truncates the journal.
+// rotate() starts a new file with the last snapshot and given packets,
+// so that the journal does not grow past the packet limit. The old file
+// is removed only after the new one is synced.
+class CaptureJournal : public QThread
+{
+    Q_OBJECT
+
+public:
+    // throws QString
+    CaptureJournal(QObject *parent = 0);
+    ~CaptureJournal();
+
+    void addPacket(const QByteArray& data);
+    void addSnapshot(const QByteArray& head, const QByteArray& tail);
+    void clear();
+    void rotate(const std::vector<QByteArray>& packets);
+
+    // Packets in the journal, including queued ones
+    quint32 getPacketCount();
+
+    // Writes everything queued and closes the file,
+    // which is removed if remove is true
+    void stop(bool remove);
+
+    static QString getFolder();
+
+    // Journals which were not closed properly and are not written anymore
+    static QStringList findAbandoned();
+
+    // Converts journal to compressed analyzer data file, throws QString
+    static void compact(const QString& journal, const QString& output);
+
+protected:
+    void run();
+
+private:
+    static QString nextFilename();
+    void writeHeader();
+    void writeRecord(quint8 type, const QByteArray& data);
+    void sync();
+
+    static bool readRecord(QFile& file, JournalRecord& rec, QByteArray& data);
+
+    QString m_filename;
+    QFile m_file;
+    bool m_failed;
+
+    QMutex m_lock;
+    QWaitCondition m_cond;
+    volatile bool m_run;
+    bool m_clear;
+    bool m_rotate;
+    quint32 m_packet_count;
+    std::vector<QByteArray> m_packets;
+    QByteArray m_snapshot;
+    QByteArray m_last_snapshot;
+};
+
+#endif // CAPTUREJOURNAL_H
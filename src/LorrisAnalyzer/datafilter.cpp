@@ -12,6 +12,12 @@
 #include "../misc/utils.h"
 #include "labellayout.h"
 #include "DataWidgets/datawidget.h"
+#include "../misc/bytesearch.h"
+#include "storage.h"
+#include "packetscriptclass.h"
+
+// how many packets are evaluated at once when updating match list
+#define MATCH_BLOCK 65536
 
 DataFilter::DataFilter(quint8 type, quint32 id, QString name, QObject *parent) : QObject(parent)
 {
@@ -19,7 +25,10 @@ DataFilter::DataFilter(quint8 type, quint32 id, QString name, QObject *parent) :
     m_id = id;
     m_name = name;
     m_layout = NULL;
-    m_lastIdx = 0;
+    m_lastSeq = 0;
+    m_storage = NULL;
+    m_matchedSeq = 0;
+    m_matchGeneration = 0;
 }
 
 DataFilter::~DataFilter()
@@ -56,7 +65,9 @@ void DataFilter::connectWidget(DataWidget *w, bool exclusive)
     disconnect(this, 0, w, 0); // prevent double-connect
     disconnect(w, 0, this, 0);
 
-    connect(this, SIGNAL(newData(analyzer_data*,quint32)), w, SLOT(newData(analyzer_data*,quint32)));
+    connect(this, SIGNAL(newData(analyzer_data*,quint64)), w, SLOT(newData(analyzer_data*,quint64)));
+    connect(this, SIGNAL(newDataBatch(analyzer_data*,std::vector<quint64>)),
+            w,    SLOT(processBatch(analyzer_data*,std::vector<quint64>)));
     connect(w,    SIGNAL(updateForMe()),                      SLOT(updateForWidget()));
     connect(w,    SIGNAL(mouseStatus(bool,data_widget_info,qint32)), SLOT(widgetMouseStatus(bool,data_widget_info,qint32)));
 }
@@ -66,36 +77,166 @@ void DataFilter::updateForWidget()
     Q_ASSERT(sender() && sender()->inherits("DataWidget"));
 
     if(m_lastData.hasData())
-        ((DataWidget*)sender())->newData(&m_lastData, m_lastIdx);
+        ((DataWidget*)sender())->newData(&m_lastData, m_lastSeq);
 }
 
 void DataFilter::sendLastData()
 {
     if(m_lastData.hasData())
-        emit newData(&m_lastData, m_lastIdx);
+        emit newData(&m_lastData, m_lastSeq);
 }
 
 void DataFilter::clearLastData()
 {
-    m_lastData.setData(NULL);
+    m_lastData.setData(QByteArray());
+    m_batch.clear();
 }
 
-void DataFilter::handleData(analyzer_data *data, quint32 idx)
+void DataFilter::handleData(analyzer_data *data, quint64 seq)
 {
-    if(!m_layout || !isOkay(data))
+    if(!m_layout)
+        return;
+
+    // The layout and widgets are updated in flush(),
+    // which is called by FilterTabWidget's display timer.
+    // Packets from Storage are matched there, once per batch.
+    if(m_storage)
+    {
+        m_lastData.setPacket(data->getPacket());
+        m_batch.push_back(seq);
+        return;
+    }
+
+    if(!isOkay(data))
         return;
 
-    m_layout->SetData(data);
     m_lastData.copy(data);
-    m_lastIdx = idx;
+    m_lastSeq = seq;
+    m_batch.push_back(seq);
+}
+
+void DataFilter::flush()
+{
+    if(m_storage && !m_batch.empty())
+        matchBatch();
+
+    if(m_batch.empty() || !m_lastData.hasData())
+        return;
+
+    m_layout->SetData(&m_lastData);
+    emit newDataBatch(&m_lastData, m_batch);
+    m_batch.clear();
+}
+
+// Removes packets which don't match from m_batch and
+// loads the last one which does to m_lastData
+void DataFilter::matchBatch()
+{
+    size_t res = 0;
+    if(matchesAll())
+    {
+        const quint64 first = m_storage->getFirstSeq();
+        for(size_t i = 0; i < m_batch.size(); ++i)
+            if(m_batch[i] >= first)
+                m_batch[res++] = m_batch[i];
+    }
+    else
+    {
+        updateMatches();
+        for(size_t i = 0; i < m_batch.size(); ++i)
+            if(std::binary_search(m_matches.begin(), m_matches.end(), m_batch[i]))
+                m_batch[res++] = m_batch[i];
+    }
+    m_batch.resize(res);
+
+    // Packets may have been removed by packet limit since
+    QByteArray data;
+    while(!m_batch.empty() && !m_storage->getBySeq(m_batch.back(), data))
+        m_batch.pop_back();
+
+    if(m_batch.empty())
+        return;
+
+    m_lastData.setData(data);
+    m_lastSeq = m_batch.back();
+}
+
+void DataFilter::match(const analyzer_span& span, quint8 *res)
+{
+    analyzer_data cur(QByteArray(), span.packet);
+    for(quint32 i = 0; i < span.count(); ++i)
+    {
+        cur.setData(QByteArray::fromRawData(span.data[i], span.sizes[i]));
+        res[i] = isOkay(&cur);
+    }
+}
+
+void DataFilter::setStorage(Storage *storage)
+{
+    m_storage = storage;
+    invalidateMatches();
+}
+
+void DataFilter::invalidateMatches()
+{
+    m_matches.clear();
+    m_matchedSeq = 0;
+    ++m_matchGeneration;
+}
+
+void DataFilter::updateMatches()
+{
+    if(!m_storage || matchesAll())
+        return;
 
-    emit newData(data, idx);
+    const quint64 first = m_storage->getFirstSeq();
+    while(!m_matches.empty() && m_matches.front() < first)
+        m_matches.pop_front();
+
+    while(true)
+    {
+        m_storage->getSpanFrom(m_matchedSeq, MATCH_BLOCK, m_span);
+
+        const quint32 count = m_span.count();
+        if(count == 0)
+            break;
+
+        m_matchRes.resize(count);
+        match(m_span, &m_matchRes[0]);
+
+        for(quint32 i = 0; i < count; ++i)
+            if(m_matchRes[i])
+                m_matches.push_back(m_span.first_seq + i);
+        m_matchedSeq = m_span.first_seq + count;
+    }
+}
+
+void DataFilter::getMatchSeqs(quint64 from, quint64 to, std::vector<quint64>& res)
+{
+    res.clear();
+    if(!m_storage || to <= from)
+        return;
+
+    if(matchesAll())
+    {
+        const quint64 end = (std::min)(to, m_storage->getNextSeq());
+        for(quint64 seq = (std::max)(from, m_storage->getFirstSeq()); seq < end; ++seq)
+            res.push_back(seq);
+        return;
+    }
+
+    updateMatches();
+
+    std::deque<quint64>::iterator itr = std::lower_bound(m_matches.begin(), m_matches.end(), from);
+    std::deque<quint64>::iterator end = std::lower_bound(itr, m_matches.end(), to);
+    res.insert(res.end(), itr, end);
 }
 
 void DataFilter::setHeader(analyzer_header *header)
 {
     if(m_layout)
         m_layout->setHeader(header);
+    invalidateMatches();
 }
 
 void DataFilter::setAreaAndLayout(QScrollArea *a, ScrollDataLayout *l)
@@ -116,12 +257,18 @@ void DataFilter::save(DataFileParser *file)
     file->writeVal(m_type);
     file->writeVal(m_id);
     file->writeString(m_name);
-    file->writeVal(m_lastIdx);
+
+    // Files keep index of the last packet
+    quint32 idx = 0;
+    if(m_storage)
+        m_storage->seqToIndex(m_lastSeq, idx);
+    file->writeVal(idx);
 }
 
 void DataFilter::load(DataFileParser *file)
 {
-    m_lastIdx = file->readVal<quint32>();
+    const quint32 idx = file->readVal<quint32>();
+    m_lastSeq = (m_storage ? m_storage->getFirstSeq() : 0) + idx;
 }
 
 void DataFilter::widgetMouseStatus(bool in, const data_widget_info& info, qint32 parent)
@@ -188,12 +335,27 @@ ConditionFilter::~ConditionFilter()
 
 bool ConditionFilter::isOkay(analyzer_data *data)
 {
+    if(!data->getPacket())
+        return false;
+
     for(quint32 i = 0; i < m_conditions.size(); ++i)
         if(!m_conditions[i]->isOkay(data))
             return false;
     return !m_conditions.empty();
 }
 
+void ConditionFilter::match(const analyzer_span& span, quint8 *res)
+{
+    // conditions read the layout of the packet, without it nothing matches
+    const bool any = !m_conditions.empty() && span.packet;
+    std::fill(res, res + span.count(), quint8(any));
+    if(!any)
+        return;
+
+    for(quint32 i = 0; i < m_conditions.size(); ++i)
+        m_conditions[i]->match(span, res);
+}
+
 void ConditionFilter::removeCondition(FilterCondition *c)
 {
     for(std::vector<FilterCondition*>::iterator itr = m_conditions.begin(); itr != m_conditions.end(); ++itr)
@@ -202,6 +364,7 @@ void ConditionFilter::removeCondition(FilterCondition *c)
         {
             delete *itr;
             m_conditions.erase(itr);
+            invalidateMatches();
             return;
         }
     }
@@ -238,6 +401,7 @@ void ConditionFilter::load(DataFileParser *file)
             }
         }
     }
+    invalidateMatches();
 }
 
 EmptyFilter::EmptyFilter(quint32 id, QString name, QObject *parent) :
@@ -245,6 +409,11 @@ EmptyFilter::EmptyFilter(quint32 id, QString name, QObject *parent) :
 {
 }
 
+void EmptyFilter::match(const analyzer_span& span, quint8 *res)
+{
+    std::fill(res, res + span.count(), 1);
+}
+
 FilterCondition *FilterCondition::createCondition(quint8 type)
 {
     switch(type)
@@ -273,12 +442,58 @@ void FilterCondition::load(DataFileParser* /*file*/)
 
 }
 
+void FilterCondition::match(const analyzer_span& span, quint8 *res)
+{
+    analyzer_data cur(QByteArray(), span.packet);
+    for(quint32 i = 0; i < span.count(); ++i)
+    {
+        if(!res[i])
+            continue;
+
+        cur.setData(QByteArray::fromRawData(span.data[i], span.sizes[i]));
+        res[i] = isOkay(&cur);
+    }
+}
+
+// res[i] &= (byte at pos >> shift) == value, without branching per packet.
+// Bytes are first gathered into a column, which is then compared with SIMD.
+static void matchByte(const analyzer_span& span, qint64 pos, quint8 shift, int value, quint8 *res)
+{
+    const quint32 count = span.count();
+    if(count == 0)
+        return;
+
+    if(pos < 0 || value < 0 || value > 0xFF)
+    {
+        std::fill(res, res + count, 0);
+        return;
+    }
+
+    // packets which are too short get a value which can't match
+    const quint8 miss = ~quint8(value);
+
+    std::vector<quint8> col(count);
+    for(quint32 i = 0; i < count; ++i)
+    {
+        const bool in = quint64(pos) < span.sizes[i];
+        const quint8 b = quint8(span.data[i][in ? pos : 0]) >> shift;
+        col[i] = in ? b : miss;
+    }
+
+    ByteSearch::andEqual(&col[0], count, quint8(value), res);
+}
+
 bool DevFilterCondition::isOkay(analyzer_data *data)
 {
     quint8 id;
     return data->getDeviceId(id) && id == m_dev;
 }
 
+void DevFilterCondition::match(const analyzer_span& span, quint8 *res)
+{
+    matchByte(span, span.packet->layout.dev_pos, 0, m_dev, res);
+}
+
 QString DevFilterCondition::getDesc() const
 {
     return QObject::tr("Device == 0x%1").arg(m_dev, 2, 16, QChar('0'));
@@ -306,6 +521,12 @@ bool CmdFilterCondition::isOkay(analyzer_data *data)
     return data->getCmd(cmd) && cmd == m_cmd;
 }
 
+void CmdFilterCondition::match(const analyzer_span& span, quint8 *res)
+{
+    const analyzer_layout& l = span.packet->layout;
+    matchByte(span, l.cmd_pos, l.cmd_shift, m_cmd, res);
+}
+
 QString CmdFilterCondition::getDesc() const
 {
     return QObject::tr("Command == 0x%1").arg(m_cmd, 2, 16, QChar('0'));
@@ -337,6 +558,11 @@ bool ByteFilterCondition::isOkay(analyzer_data *data)
     }
 }
 
+void ByteFilterCondition::match(const analyzer_span& span, quint8 *res)
+{
+    matchByte(span, m_pos, 0, m_byte, res);
+}
+
 QString ByteFilterCondition::getDesc() const
 {
     return QObject::tr("Byte at idx %1 == 0x%2").arg(m_pos).arg(m_byte, 2, 16, QChar('0'));
@@ -370,6 +596,11 @@ ScriptFilterCondition::ScriptFilterCondition(int engine) : FilterCondition(COND_
                   "    return false;\n"
                   "}\n");
     m_engine.pushContext();
+    m_packets.reset(new PacketScriptClass(&m_engine));
+}
+
+ScriptFilterCondition::~ScriptFilterCondition()
+{
 }
 
 void ScriptFilterCondition::setScript(const QString &script)
@@ -395,7 +626,7 @@ void ScriptFilterCondition::setScript(const QString &script)
     }
 
     QScriptValueList args;
-    args.push_back(m_engine.newArray());
+    args.push_back(m_packets->newPacket(QByteArray(), NULL));
     args << -1 << -1;
 
     m_func.call(QScriptValue(), args);
@@ -413,14 +644,8 @@ bool ScriptFilterCondition::isOkay(analyzer_data *data)
     if(!m_func.isFunction())
         return false;
 
-    const QByteArray& pkt_data = data->getData();
-
-    QScriptValue jsData = m_engine.newArray(pkt_data.size());
-    for(qint32 i = 0; i < pkt_data.size(); ++i)
-        jsData.setProperty(i, QScriptValue(&m_engine, (quint8)pkt_data[i]));
-
     QScriptValueList args;
-    args.push_back(jsData);
+    args.push_back(m_packets->newPacket(*data));
 
     quint8 res = 0;
     if(data->getDeviceId(res)) args << res;
@@ -10,15 +10,19 @@
 
 #include <QString>
 #include <vector>
+#include <deque>
 #include <QScriptEngine>
+#include <QScopedPointer>
 
 #include "../misc/datafileparser.h"
 #include "packet.h"
 
 class QScrollArea;
+class Storage;
 class analyzer_data;
 class ScrollDataLayout;
 class DataWidget;
+class PacketScriptClass;
 struct data_widget_info;
 
 enum filterCondition
@@ -41,6 +45,8 @@ public:
 
     quint8 getType() const { return m_type; }
     virtual bool isOkay(analyzer_data *data) = 0;
+    // res[i] &= isOkay(span packet i), res contains only 0 or 1
+    virtual void match(const analyzer_span& span, quint8 *res);
     virtual QString getDesc() const = 0;
 
     virtual void save(DataFileParser *file);
@@ -59,6 +65,7 @@ public:
     }
 
     bool isOkay(analyzer_data *data);
+    void match(const analyzer_span& span, quint8 *res);
     void save(DataFileParser *file);
     void load(DataFileParser *file);
 
@@ -80,6 +87,7 @@ public:
     }
 
     bool isOkay(analyzer_data *data);
+    void match(const analyzer_span& span, quint8 *res);
     void save(DataFileParser *file);
     void load(DataFileParser *file);
 
@@ -102,6 +110,7 @@ public:
     }
 
     bool isOkay(analyzer_data *data);
+    void match(const analyzer_span& span, quint8 *res);
     void save(DataFileParser *file);
     void load(DataFileParser *file);
 
@@ -121,6 +130,7 @@ class ScriptFilterCondition : public FilterCondition
 {
 public:
     ScriptFilterCondition(int engine);
+    ~ScriptFilterCondition();
 
     bool isOkay(analyzer_data *data);
     void save(DataFileParser *file);
@@ -137,6 +147,8 @@ public:
 private:
     QString m_script;
     int m_lang;
+    // Must outlive objects in m_engine
+    QScopedPointer<PacketScriptClass> m_packets;
     QScriptEngine m_engine;
     QScriptValue m_func;
     QString m_error;
@@ -155,7 +167,8 @@ class DataFilter : public QObject
     Q_OBJECT
 
 Q_SIGNALS:
-    void newData(analyzer_data *data, quint32 idx);
+    void newData(analyzer_data *data, quint64 seq);
+    void newDataBatch(analyzer_data *last, const std::vector<quint64>& seqs);
     void activateTab();
 
 public:
@@ -165,19 +178,35 @@ public:
     static DataFilter *createFilter(quint8 type, quint32 id, const QString& name, QObject *parent);
 
     virtual bool isOkay(analyzer_data *data) = 0;
+    // Evaluates the filter on all packets in span, res[i] is set to 0 or 1.
+    // res must have space for span.count() items.
+    virtual void match(const analyzer_span& span, quint8 *res);
+    virtual bool matchesAll() const { return false; }
 
     virtual void save(DataFileParser *file);
     virtual void load(DataFileParser *file);
 
+    // Filter keeps list of packets from Storage which it matches. New packets
+    // are evaluated only once, the list has to be invalidated when
+    // the filter changes.
+    void setStorage(Storage *storage);
+    void invalidateMatches();
+    // Sequence numbers of matching packets in [from, to)
+    void getMatchSeqs(quint64 from, quint64 to, std::vector<quint64>& res);
+    // Changes every time the list is invalidated
+    quint32 getMatchGeneration() const { return m_matchGeneration; }
+
     void setHeader(analyzer_header *header);
     void setAreaAndLayout(QScrollArea *a, ScrollDataLayout *l);
-    void handleData(analyzer_data *data, quint32 idx);
+    // seq is sequence number of the packet, see Storage::addData()
+    void handleData(analyzer_data *data, quint64 seq);
+    void flush();
 
     quint8 getType() const { return m_type; }
     QString getName() const { return m_name; }
     quint32 getId() const { return m_id; }
     void setName(const QString& name) { m_name = name; }
-    quint32 getLastIdx() const { return m_lastIdx; }
+    quint64 getLastSeq() const { return m_lastSeq; }
 
     void sendLastData();
     void clearLastData();
@@ -189,6 +218,9 @@ protected slots:
     void layoutContextMenu(const QPoint& pos);
 
 protected:
+    void updateMatches();
+    void matchBatch();
+
     QString m_name;
     quint32 m_id;
     quint8 m_type;
@@ -196,7 +228,15 @@ protected:
     ScrollDataLayout *m_layout;
     QScrollArea *m_area;
     analyzer_data m_lastData;
-    quint32 m_lastIdx;
+    quint64 m_lastSeq;
+    std::vector<quint64> m_batch;  // sequence numbers, matched in flush() if m_storage is set
+
+    Storage *m_storage;
+    std::deque<quint64> m_matches; // sequence numbers, see StorageData::firstSeq()
+    quint64 m_matchedSeq;          // packets before this one are already in m_matches
+    quint32 m_matchGeneration;
+    analyzer_span m_span;
+    std::vector<quint8> m_matchRes;
 };
 
 class ConditionFilter : public DataFilter
@@ -206,12 +246,14 @@ public:
     ~ConditionFilter();
 
     bool isOkay(analyzer_data *data);
+    void match(const analyzer_span& span, quint8 *res);
     void save(DataFileParser *file);
     void load(DataFileParser *file);
 
     void addCondition(FilterCondition *c)
     {
         m_conditions.push_back(c);
+        invalidateMatches();
     }
     void removeCondition(FilterCondition *c);
 
@@ -228,6 +270,8 @@ public:
     EmptyFilter(quint32 id, QString name, QObject *parent);
 
     bool isOkay(analyzer_data *) { return true; }
+    void match(const analyzer_span& span, quint8 *res);
+    bool matchesAll() const { return true; }
 };
 
 
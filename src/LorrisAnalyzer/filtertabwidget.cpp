@@ -17,6 +17,7 @@
 
 #include "filtertabwidget.h"
 #include "packet.h"
+#include "storage.h"
 #include "DataWidgets/datawidget.h"
 #include "../misc/datafileparser.h"
 #include "labellayout.h"
@@ -28,6 +29,7 @@ FilterTabWidget::FilterTabWidget(QWidget *parent) :
 {
     m_filterIdCounter = 0;
     m_header = NULL;
+    m_storage = NULL;
 
     setTabPosition(QTabWidget::South);
 
@@ -38,6 +40,9 @@ FilterTabWidget::FilterTabWidget(QWidget *parent) :
     setCornerWidget(btn, Qt::BottomLeftCorner);
 
     connect(btn, SIGNAL(clicked()), SLOT(showSettings()));
+
+    m_flushTimer.setSingleShot(true);
+    connect(&m_flushTimer, SIGNAL(timeout()), SLOT(flushData()));
 }
 
 FilterTabWidget::~FilterTabWidget()
@@ -83,6 +88,8 @@ void FilterTabWidget::Load(DataFileParser *file, bool skip)
         if(!f)
             continue;
 
+        // last packet is saved as index, storage is needed to find it
+        f->setStorage(m_storage);
         f->load(file);
         addFilter(f);
     }
@@ -206,6 +213,13 @@ void FilterTabWidget::setHeader(analyzer_header *h)
         m_filters[i]->setHeader(h);
 }
 
+void FilterTabWidget::setStorage(Storage *storage)
+{
+    m_storage = storage;
+    for(quint32 i = 0; i < m_filters.size(); ++i)
+        m_filters[i]->setStorage(storage);
+}
+
 void FilterTabWidget::removeAll()
 {
     m_filterIdCounter = 0;
@@ -220,10 +234,21 @@ void FilterTabWidget::reset(analyzer_header *header)
     removeAll();
 }
 
-void FilterTabWidget::handleData(analyzer_data *data, quint32 index)
+void FilterTabWidget::handleData(analyzer_data *data, quint64 seq)
+{
+    for(quint32 i = 0; i < m_filters.size(); ++i)
+        m_filters[i]->handleData(data, seq);
+
+    // Packets can come much faster than anyone can see,
+    // so filters pass them on only once per display tick
+    if(!m_flushTimer.isActive())
+        m_flushTimer.start(1000 / qMax(1U, sConfig.get(CFG_QUINT32_ANALYZER_DISPLAY_RATE)));
+}
+
+void FilterTabWidget::flushData()
 {
     for(quint32 i = 0; i < m_filters.size(); ++i)
-        m_filters[i]->handleData(data, index);
+        m_filters[i]->flush();
 }
 
 void FilterTabWidget::showSettings()
@@ -255,6 +280,7 @@ void FilterTabWidget::addFilter(DataFilter *f)
     addTab(area, f->getName());
 
     f->setAreaAndLayout(area, layout);
+    f->setStorage(m_storage);
     m_filters.push_back(f);
 
     connect(f, SIGNAL(activateTab()), SLOT(activateTab()));
@@ -318,9 +344,10 @@ DataFilter *FilterTabWidget::getFilter(quint32 id) const
 void FilterTabWidget::sendLastData()
 {
     DataFilter *f;
-    quint32 idx;
+    quint64 seq;
 
     analyzer_data data;
+    QByteArray packet;
     Q_ASSERT(parent()->inherits("LorrisAnalyzer"));
 
     data.setPacket(analyzer()->getPacket());
@@ -328,11 +355,14 @@ void FilterTabWidget::sendLastData()
     for(quint32 i = 0; i < m_filters.size(); ++i)
     {
         f = m_filters[i];
-        idx = f->getLastIdx();
+        seq = f->getLastSeq();
+
+        if(!m_storage || !m_storage->getBySeq(seq, packet))
+            continue;
 
-        data.setData(analyzer()->getDataAt(idx));
+        data.setData(packet);
         if(data.hasData())
-            f->handleData(&data, idx);
+            f->handleData(&data, seq);
     }
 }
 
@@ -512,6 +542,7 @@ void FilterDialog::on_typeBox_currentIndexChanged(int idx)
         }
     }
     delete c;
+    f->invalidateMatches();
 
     QTreeWidgetItem *it = ui->condTree->currentItem();
     it->setText(0, newCond->getDesc());
@@ -531,6 +562,7 @@ void FilterDialog::on_devEdit_textEdited(const QString &text)
             return;
         ((DevFilterCondition*)c)->setDev(res);
         ui->condTree->currentItem()->setText(0, c->getDesc());
+        conditionChanged();
     }
 }
 
@@ -546,6 +578,7 @@ void FilterDialog::on_cmdEdit_textEdited(const QString &text)
             return;
         ((CmdFilterCondition*)c)->setCmd(res);
         ui->condTree->currentItem()->setText(0, c->getDesc());
+        conditionChanged();
     }
 }
 
@@ -561,6 +594,7 @@ void FilterDialog::on_byteValEdit_textEdited(const QString &text)
             return;
         ((ByteFilterCondition*)c)->setByte(res);
         ui->condTree->currentItem()->setText(0, c->getDesc());
+        conditionChanged();
     }
 }
 
@@ -572,6 +606,7 @@ void FilterDialog::on_bytePosBox_valueChanged(int val)
 
     ((ByteFilterCondition*)c)->setPos(val);
     ui->condTree->currentItem()->setText(0, c->getDesc());
+    conditionChanged();
 }
 
 void FilterDialog::on_nameEdit_textEdited(const QString &text)
@@ -630,6 +665,7 @@ void FilterDialog::on_applyBtn_clicked()
     sc->setScript(m_editor->getText());
     m_editor->setModified(false);
     ui->applyBtn->setEnabled(false);
+    conditionChanged();
 
     QString error = sc->getError();
     if(!error.isEmpty())
@@ -644,6 +680,13 @@ void FilterDialog::scriptModified()
     ui->applyBtn->setEnabled(true);
 }
 
+void FilterDialog::conditionChanged()
+{
+    ConditionFilter *f = getCurrFilter();
+    if(f)
+        f->invalidateMatches();
+}
+
 FilterCondition *FilterDialog::getCurrCondition()
 {
     QTreeWidgetItem *it = ui->condTree->currentItem();
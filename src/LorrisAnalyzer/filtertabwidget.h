@@ -10,6 +10,7 @@
 
 #include <QTabWidget>
 #include <QFrame>
+#include <QTimer>
 
 #include "datafilter.h"
 #include "lorrisanalyzer.h"
@@ -37,6 +38,7 @@ public:
     void removeAll();
 
     void setHeader(analyzer_header *h);
+    void setStorage(Storage *storage);
     void Save(DataFileParser *file);
     void Load(DataFileParser *file, bool skip);
     void loadLegacy(DataFileParser *file);
@@ -59,19 +61,22 @@ public:
     void clearLastData();
 
 public slots:
-    void handleData(analyzer_data *data, quint32 index);
+    void handleData(analyzer_data *data, quint64 seq);
 
 private slots:
     void showSettings();
     void activateTab();
+    void flushData();
 
 private:
     void addEmptyFilter();
     inline LorrisAnalyzer *analyzer() const { return (LorrisAnalyzer*)parent(); }
 
     analyzer_header *m_header;
+    Storage *m_storage;
     std::vector<DataFilter*> m_filters;
     quint32 m_filterIdCounter;
+    QTimer m_flushTimer;
 };
 
 class FilterDialog : public QDialog, private Ui::FilterDialog
@@ -107,6 +112,7 @@ private:
     void fillCondData(FilterCondition *c);
     FilterCondition *getCurrCondition();
     ConditionFilter *getCurrFilter();
+    void conditionChanged();
 
     Ui::FilterDialog *ui;
     EditorWidget *m_editor;
@@ -0,0 +1,400 @@
+/**********************************************
+**    This file is part of Lorris
+**    http://tasssadar.github.com/Lorris/
+**
+**    See README and COPYING
+***********************************************/
+
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <QCoreApplication>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QStringList>
+
+#include "headlesscapture.h"
+#include "storage.h"
+#include "packetparser.h"
+#include "../misc/datafileparser.h"
+#include "../connection/connectionmgr2.h"
+#include "../connection/serialport.h"
+#include "../connection/tcpsocket.h"
+
+// How often is the stop flag and time rotation checked, in ms
+#define STATUS_INTERVAL 200
+// Delay before the connection is opened again after it was lost, in ms
+#define RECONNECT_DELAY 2000
+
+static volatile sig_atomic_t stopRequested = 0;
+
+static void stopHandler(int)
+{
+    stopRequested = 1;
+}
+
+HeadlessCapture::HeadlessCapture(QObject *parent) : QObject(parent),
+    m_packet(&m_header, true)
+{
+    m_writer = NULL;
+    m_file_counter = 0;
+    m_pending_count = 0;
+    m_total_count = 0;
+    m_rotate_size = 0;
+    m_rotate_time = 0;
+
+    m_storage = new Storage(NULL);
+    m_parser = new PacketParser(m_storage, this);
+
+    m_reconnectTimer.setSingleShot(true);
+    QObject::connect(&m_reconnectTimer, SIGNAL(timeout()), SLOT(openConnection()));
+    QObject::connect(&m_statusTimer, SIGNAL(timeout()), SLOT(checkStatus()));
+}
+
+HeadlessCapture::~HeadlessCapture()
+{
+    if(m_conn)
+    {
+        m_conn->disconnect(this);
+        m_conn->Close();
+        m_conn.reset();
+    }
+
+    closeFile();
+
+    delete m_parser;
+    delete m_storage;
+}
+
+// desc is TYPE,key=value,... where TYPE and keys are the same
+// as in connection config, see ConnectionManager2::applyConfig
+void HeadlessCapture::setConnection(const QString &desc)
+{
+    QStringList parts = desc.split(",", QString::SkipEmptyParts);
+    if(parts.isEmpty())
+        throw tr("Connection is not specified");
+
+    const QString type = parts.takeFirst().trimmed();
+
+    m_conn_cfg.clear();
+    for(int i = 0; i < parts.size(); ++i)
+    {
+        const int idx = parts[i].indexOf('=');
+        if(idx <= 0)
+            throw tr("Invalid connection setting \"%1\"").arg(parts[i]);
+        m_conn_cfg[parts[i].left(idx).trimmed()] = parts[i].mid(idx+1).trimmed();
+    }
+
+    // Existing or enumerated connections are used first, new ones are not
+    // added to the manager, so that they are not saved to config
+    ConnectionPointer<Connection> conn;
+    if(type == "serial_port")
+    {
+        conn = sConMgr2.getConnWithConfig(CONNECTION_SERIAL_PORT, m_conn_cfg);
+        if(!conn)
+            conn.reset(new SerialPort());
+    }
+    else if(type == "tcp_client")
+    {
+        conn = sConMgr2.getConnWithConfig(CONNECTION_TCP_SOCKET, m_conn_cfg);
+        if(!conn)
+            conn.reset(new TcpSocket());
+    }
+#ifdef HAVE_LIBYB
+    else if(type == "usb_yb_acm")
+    {
+        conn = sConMgr2.getConnWithConfig(CONNECTION_USB_ACM2, m_conn_cfg);
+        if(!conn)
+            throw tr("USB device was not found");
+    }
+#endif
+    else
+        throw tr("Unknown connection type \"%1\"").arg(type);
+
+    if(!conn->applyConfig(m_conn_cfg))
+        throw tr("Invalid connection settings");
+
+    m_conn = conn.staticCast<PortConnection>();
+    QObject::connect(m_conn.data(), SIGNAL(dataRead(QByteArray)), SLOT(readData(QByteArray)));
+    QObject::connect(m_conn.data(), SIGNAL(stateChanged(ConnectionState)), SLOT(connStateChanged(ConnectionState)));
+    QObject::connect(m_conn.data(), SIGNAL(destroying()), SLOT(connectionDestroyed()));
+}
+
+// Only packet structure is used, the rest of the document (filters,
+// widgets...) is copied to the output files
+void HeadlessCapture::loadStructure(const QString &filename)
+{
+    QFile file(filename);
+    if(!file.open(QIODevice::ReadOnly))
+        throw tr("Cannot open file \"%1\"!").arg(filename);
+
+    bool legacy = false;
+    QByteArray data = DataFileBuilder::readAndCheck(file, DATAFILE_ANALYZER, &legacy);
+    file.close();
+
+    if(legacy)
+        throw tr("Structure file has old format, open it in Lorris and save it again");
+
+    DataFileParser buffer(&data, QIODevice::ReadOnly);
+
+    if(!buffer.seekToNextBlock("analyzerHeaderV2", BLOCK_COLLAPSE_STATUS))
+        throw tr("File \"%1\" does not contain packet structure").arg(filename);
+    buffer.read((char*)&m_header.length, sizeof(analyzer_header));
+
+    if(buffer.seekToNextBlock("analyzerPacket", BLOCK_COLLAPSE_STATUS))
+        buffer.read((char*)&m_packet.big_endian, sizeof(bool));
+
+    if(buffer.seekToNextBlock(BLOCK_STATIC_DATA, BLOCK_DEVICE_TABS))
+    {
+        quint8 static_len = 0;
+        buffer.read((char*)&static_len, sizeof(quint8));
+
+        m_header.static_len = static_len;
+        m_packet.static_data.resize(static_len);
+        if(static_len)
+            buffer.read((char*)m_packet.static_data.data(), static_len);
+    }
+
+    if(!buffer.seekToNextBlock(BLOCK_DATA, 0))
+        throw tr("File \"%1\" is damaged").arg(filename);
+
+    m_head = data.left(buffer.pos());
+
+    // skip packets stored in the structure file
+    quint32 count = 0;
+    buffer.read((char*)&count, sizeof(count));
+    for(quint32 i = 0; i < count && !buffer.atEnd(); ++i)
+    {
+        quint32 len = 0;
+        buffer.read((char*)&len, sizeof(len));
+        buffer.seek(buffer.pos() + len);
+    }
+
+    m_tail = data.mid(buffer.pos());
+    buffer.close();
+
+    m_packet.compile();
+    m_storage->setPacket(&m_packet);
+    m_parser->setPacket(&m_packet);
+}
+
+void HeadlessCapture::setRotation(quint32 sizeMB, quint32 minutes)
+{
+    m_rotate_size = qint64(sizeMB)*1024*1024;
+    m_rotate_time = qint64(minutes)*60*1000;
+}
+
+void HeadlessCapture::start()
+{
+    openFile();
+    openConnection();
+    m_statusTimer.start(STATUS_INTERVAL);
+}
+
+void HeadlessCapture::openConnection()
+{
+    // Missing connections are opened when the device appears
+    if(m_conn)
+        m_conn->OpenConcurrent();
+}
+
+void HeadlessCapture::connStateChanged(ConnectionState state)
+{
+    switch(state)
+    {
+        case st_connected:
+            printf("Connected to %s\n", m_conn->GetIDString().toLocal8Bit().constData());
+            break;
+        case st_missing:
+            fprintf(stderr, "Device is missing, waiting for it\n");
+            openConnection();
+            break;
+        case st_disconnected:
+            if(stopRequested || m_reconnectTimer.isActive())
+                break;
+            fprintf(stderr, "Connection is not open, trying again in %d s\n", RECONNECT_DELAY/1000);
+            m_reconnectTimer.start(RECONNECT_DELAY);
+            break;
+        default:
+            break;
+    }
+}
+
+void HeadlessCapture::connectionDestroyed()
+{
+    // Strong references must be abandoned without release
+    m_conn.take();
+    fprintf(stderr, "Connection was removed, stopping capture\n");
+    stopRequested = 1;
+}
+
+void HeadlessCapture::readData(const QByteArray &data)
+{
+    m_parser->newData(data, false, m_conn->readTime());
+
+    // Storage is emptied after every chunk, so that memory
+    // use does not grow during long captures
+    const quint32 count = m_storage->getSize();
+    for(quint32 i = 0; i < count; ++i)
+    {
+        const QByteArray d = m_storage->get(i);
+        const quint32 len = d.size();
+        m_pending.append((char*)&len, sizeof(len));
+        m_pending.append(d);
+        m_pending_times.push_back(m_storage->getTime(i));
+    }
+    m_pending_count += count;
+    m_storage->Clear();
+
+    if(m_pending.size() >= DATAFILE_PACKET_BLOCK_SIZE)
+        writePending();
+}
+
+void HeadlessCapture::writePending()
+{
+    if(m_pending_count == 0 || !m_writer)
+        return;
+
+    try {
+        DataFileWriter::appendPacketTimes(m_pending, &m_pending_times[0], m_pending_count);
+        m_writer->writePacketBlock(m_pending, m_pending_count);
+    } catch(const QString& ex) {
+        fprintf(stderr, "%s\n", ex.toLocal8Bit().constData());
+        stopRequested = 1;
+    }
+
+    m_total_count += m_pending_count;
+    m_pending.clear();
+    m_pending_times.clear();
+    m_pending_count = 0;
+
+    if(m_rotate_size != 0 && m_writer->getWrittenSize() >= m_rotate_size)
+        rotate();
+}
+
+void HeadlessCapture::checkStatus()
+{
+    if(stopRequested)
+    {
+        m_statusTimer.stop();
+        closeFile();
+        QCoreApplication::quit();
+        return;
+    }
+
+    if(m_rotate_time != 0 && m_file_time.elapsed() >= m_rotate_time)
+        rotate();
+}
+
+void HeadlessCapture::rotate()
+{
+    closeFile();
+    try {
+        openFile();
+    } catch(const QString& ex) {
+        fprintf(stderr, "%s\n", ex.toLocal8Bit().constData());
+        stopRequested = 1;
+    }
+}
+
+void HeadlessCapture::openFile()
+{
+    QString filename = m_output;
+    if(m_rotate_size != 0 || m_rotate_time != 0)
+    {
+        QFileInfo info(m_output);
+        filename = QString("%1/%2_%3_%4.%5")
+                .arg(info.path())
+                .arg(info.completeBaseName())
+                .arg(m_file_counter++, 4, 10, QChar('0'))
+                .arg(QDateTime::currentDateTime().toString("yyyyMMdd_hhmmss"))
+                .arg(info.suffix().isEmpty() ? QString("cldta") : info.suffix());
+    }
+
+    try {
+        m_writer = new DataFileWriter(filename, true, DATAFILE_ANALYZER);
+        m_writer->write(m_head);
+
+        const quint32 inlineCount = 0;
+        m_writer->write(QByteArray((char*)&inlineCount, sizeof(inlineCount)));
+        m_writer->write(m_tail);
+        m_writer->beginPackets(true);
+    } catch(const QString&) {
+        delete m_writer;
+        m_writer = NULL;
+        throw;
+    }
+
+    m_total_count = 0;
+    m_file_time.start();
+    printf("Writing to %s\n", filename.toLocal8Bit().constData());
+}
+
+void HeadlessCapture::closeFile()
+{
+    if(!m_writer)
+        return;
+
+    writePending();
+
+    try {
+        m_writer->finish();
+        printf("Finished %s, %llu packets\n", m_writer->getFilename().toLocal8Bit().constData(),
+               (unsigned long long)m_total_count);
+    } catch(const QString& ex) {
+        fprintf(stderr, "%s\n", ex.toLocal8Bit().constData());
+    }
+
+    delete m_writer;
+    m_writer = NULL;
+}
+
+int HeadlessCapture::run(int argc, char *argv[])
+{
+    QString output, conn, structure;
+    quint32 rotateSize = 0, rotateTime = 0;
+    for(int i = 1; i < argc; ++i)
+    {
+        const char *val = strchr(argv[i], '=');
+        if(!val)
+            continue;
+        ++val;
+
+        if(strstr(argv[i], "--capture=") == argv[i])
+            output = QString::fromLocal8Bit(val);
+        else if(strstr(argv[i], "--conn=") == argv[i])
+            conn = QString::fromLocal8Bit(val);
+        else if(strstr(argv[i], "--struct=") == argv[i])
+            structure = QString::fromLocal8Bit(val);
+        else if(strstr(argv[i], "--rotate-size=") == argv[i])
+            rotateSize = QString(val).toUInt();
+        else if(strstr(argv[i], "--rotate-time=") == argv[i])
+            rotateTime = QString(val).toUInt();
+    }
+
+    if(output.isEmpty() || conn.isEmpty() || structure.isEmpty())
+    {
+        fprintf(stderr, "--capture requires --conn and --struct, see --help\n");
+        return 1;
+    }
+
+    QCoreApplication a(argc, argv);
+    ConnectionManager2 conmgr(&a);
+
+    signal(SIGINT, stopHandler);
+    signal(SIGTERM, stopHandler);
+
+    try {
+        HeadlessCapture capture;
+        capture.loadStructure(structure);
+        capture.setConnection(conn);
+        capture.setOutput(output);
+        capture.setRotation(rotateSize, rotateTime);
+        capture.start();
+
+        return a.exec();
+    } catch(const QString& ex) {
+        fprintf(stderr, "%s\n", ex.toLocal8Bit().constData());
+        return 1;
+    }
+}
@@ -0,0 +1,91 @@
+/**********************************************
+**    This file is part of Lorris
+**    http://tasssadar.github.com/Lorris/
+**
+**    See README and COPYING
+***********************************************/
+
+#ifndef HEADLESSCAPTURE_H
+#define HEADLESSCAPTURE_H
+
+#include <vector>
+#include <QObject>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QVariant>
+
+#include "packet.h"
+#include "../connection/connection.h"
+
+class Storage;
+class PacketParser;
+class DataFileWriter;
+
+// Capture without GUI, started by --capture. Packets are parsed by
+// PacketParser into Storage, which is drained after every received
+// chunk into compressed analyzer data file with packet index. Output
+// is rotated by size or time, a file is valid once it is finished.
+class HeadlessCapture : public QObject
+{
+    Q_OBJECT
+
+public:
+    HeadlessCapture(QObject *parent = 0);
+    ~HeadlessCapture();
+
+    // These throw QString
+    void setConnection(const QString& desc);
+    void loadStructure(const QString& filename);
+
+    void setOutput(const QString& filename) { m_output = filename; }
+    void setRotation(quint32 sizeMB, quint32 minutes);
+
+    void start();
+
+    // Parses --capture, --conn, --struct and --rotate-* arguments,
+    // runs the capture until SIGINT/SIGTERM and returns exit code
+    static int run(int argc, char *argv[]);
+
+private slots:
+    void readData(const QByteArray& data);
+    void connStateChanged(ConnectionState state);
+    void openConnection();
+    void connectionDestroyed();
+    void checkStatus();
+
+private:
+    void openFile();
+    void closeFile();
+    void rotate();
+    void writePending();
+
+    ConnectionPointer<PortConnection> m_conn;
+    QHash<QString, QVariant> m_conn_cfg;
+
+    analyzer_header m_header;
+    analyzer_packet m_packet;
+    Storage *m_storage;
+    PacketParser *m_parser;
+
+    // document of the structure file, split at BLOCK_DATA
+    QByteArray m_head;
+    QByteArray m_tail;
+
+    QString m_output;
+    quint32 m_file_counter;
+    DataFileWriter *m_writer;
+    QByteArray m_pending;
+    std::vector<qint64> m_pending_times;
+    quint32 m_pending_count;
+    quint64 m_total_count;
+
+    qint64 m_rotate_size;
+    qint64 m_rotate_time;
+    QElapsedTimer m_file_time;
+
+    QTimer m_statusTimer;
+    QTimer m_reconnectTimer;
+};
+
+#endif // HEADLESSCAPTURE_H
@@ -0,0 +1,100 @@
+/**********************************************
+**    This file is part of Lorris
+**    http://tasssadar.github.com/Lorris/
+**
+**    See README and COPYING
+***********************************************/
+
+#include "ingestthread.h"
+#include "packetparser.h"
+#include "storage.h"
+
+IngestThread::IngestThread(PacketParser *parser, Storage *storage, QObject *parent) :
+    QThread(parent), m_run(0)
+{
+    m_parser = parser;
+    m_storage = storage;
+    m_has_pending = false;
+}
+
+IngestThread::~IngestThread()
+{
+    stop();
+}
+
+void IngestThread::feed(const QByteArray& data, qint64 time)
+{
+    IngestChunk c = { data, time };
+
+    QMutexLocker l(&m_lock);
+    m_input.push_back(c);
+    m_cond.wakeOne();
+
+    if(!shouldRun())
+    {
+        m_run.fetchAndStoreRelease(1);
+        start();
+    }
+}
+
+void IngestThread::stop()
+{
+    {
+        QMutexLocker l(&m_lock);
+        if(!shouldRun())
+            return;
+        m_run.fetchAndStoreRelease(0);
+        m_cond.wakeOne();
+    }
+    wait();
+}
+
+void IngestThread::run()
+{
+    std::vector<IngestChunk> input;
+    while(shouldRun())
+    {
+        {
+            QMutexLocker l(&m_lock);
+            if(m_input.empty() && shouldRun())
+            {
+                // If something is waiting for space in the channel,
+                // only sleep for a while and try again
+                if(m_has_pending)
+                    m_cond.wait(&m_lock, 10);
+                else
+                    m_cond.wait(&m_lock);
+            }
+            input.swap(m_input);
+        }
+
+        for(size_t i = 0; i < input.size() && shouldRun(); ++i)
+        {
+            const quint64 first = m_storage->getNextSeq();
+            m_parser->newData(input[i].data, false, input[i].time);
+            const quint64 last = m_storage->getNextSeq();
+
+            if(last <= first)
+                continue;
+
+            // Pending range is just extended, even if there is a gap
+            // (storage cleared or packets added from GUI thread) -
+            // GUI skips sequence numbers which are no longer in storage.
+            if(!m_has_pending)
+            {
+                m_pending.first = first;
+                m_has_pending = true;
+            }
+            m_pending.last = last;
+        }
+        input.clear();
+
+        flushPending();
+    }
+}
+
+void IngestThread::flushPending()
+{
+    if(m_has_pending && m_channel.send(m_pending))
+        m_has_pending = false;
+}
@@ -0,0 +1,76 @@
+/**********************************************
+**    This file is part of Lorris
+**    http://tasssadar.github.com/Lorris/
+**
+**    See README and COPYING
+***********************************************/
+
+#ifndef INGESTTHREAD_H
+#define INGESTTHREAD_H
+
+#include <vector>
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QAtomicInt>
+#include <QByteArray>
+
+#include "../misc/threadchannel.h"
+
+class PacketParser;
+class Storage;
+
+// Received data and their time, see PortConnection::readTime()
+struct IngestChunk
+{
+    QByteArray data;
+    qint64 time;
+};
+
+// Range of packets added to Storage, in sequence numbers
+// (see StorageData::firstSeq()), last is exclusive.
+struct IngestRange
+{
+    quint64 first;
+    quint64 last;
+};
+
+// Runs PacketParser on received data, so that framing and
+// appending packets to Storage is not done on GUI thread.
+// New packets are announced through channel(), which has to be
+// read from GUI thread. If GUI does not keep up and the channel
+// is full, the ranges are merged until there is space again.
+class IngestThread : public QThread
+{
+    Q_OBJECT
+
+public:
+    IngestThread(PacketParser *parser, Storage *storage, QObject *parent = 0);
+    ~IngestThread();
+
+    void feed(const QByteArray& data, qint64 time);
+    void stop();
+
+    SpscThreadChannel<IngestRange> *channel() { return &m_channel; }
+
+protected:
+    void run();
+
+private:
+    void flushPending();
+    bool shouldRun() { return m_run.fetchAndAddAcquire(0) != 0; }
+
+    QAtomicInt m_run;
+    PacketParser *m_parser;
+    Storage *m_storage;
+
+    QMutex m_lock;
+    QWaitCondition m_cond;
+    std::vector<IngestChunk> m_input;
+
+    bool m_has_pending;
+    IngestRange m_pending;
+    SpscThreadChannel<IngestRange> m_channel;
+};
+
+#endif // INGESTTHREAD_H
@@ -24,6 +24,7 @@
 #include <QFileDialog>
 #include <QStringBuilder>
 #include <QToolBar>
+#include <QDateTime>
 
 #include "lorrisanalyzer.h"
 #include "sourcedialog.h"
@@ -37,6 +38,10 @@
 #include "widgetfactory.h"
 #include "searchwidget.h"
 #include "../ui/floatinginputdialog.h"
+#include "capturejournal.h"
+
+// How often is the rest of analyzer written to the journal, in ms
+#define JOURNAL_SNAPSHOT_INTERVAL (30*1000)
 
 #include "ui_lorrisanalyzer.h"
 
@@ -47,7 +52,8 @@ static bool sortDataWidget(DataWidgetAddBtn *a, DataWidgetAddBtn *b)
 
 LorrisAnalyzer::LorrisAnalyzer()
     : ui(new Ui::LorrisAnalyzer),
-     m_storage(this), m_parser(&m_storage, this), m_connectButton(0)
+     m_storage(this), m_parser(&m_storage, this),
+     m_ingest(&m_parser, &m_storage), m_connectButton(0)
 {
     ui->setupUi(this);
 
@@ -63,12 +69,15 @@ LorrisAnalyzer::LorrisAnalyzer()
     connect(ui->playFrame,       SIGNAL(enablePosSet(bool)),    ui->timeSlider, SLOT(setEnabled(bool)));
     connect(ui->dataArea,        SIGNAL(updateData()),      SLOT(updateData()));
     connect(ui->limitBtn,        SIGNAL(clicked()),         SLOT(setPacketLimit()));
-    connect(&m_parser,           SIGNAL(packetReceived(analyzer_data*,quint32)), SIGNAL(newData(analyzer_data*,quint32)));
+    connect(&m_parser,           SIGNAL(packetReceived(analyzer_data*,quint64)), SIGNAL(newData(analyzer_data*,quint64)));
     connect(ui->dataArea,        SIGNAL(mouseStatus(bool,data_widget_info,qint32)),
                                  SLOT(widgetMouseStatus(bool,data_widget_info, qint32)));
-    connect(this,                SIGNAL(newData(analyzer_data*,quint32)), ui->filterTabs,
-                                 SLOT(handleData(analyzer_data*, quint32)));
+    connect(this,                SIGNAL(newData(analyzer_data*,quint64)), ui->filterTabs,
+                                 SLOT(handleData(analyzer_data*, quint64)));
     connect(&m_storage,          SIGNAL(onPacketLimitChanged(int)), SLOT(onPacketLimitChanged(int)));
+    connect(&m_storage,          SIGNAL(dataError(QString)), SLOT(storageError(QString)), Qt::QueuedConnection);
+    connect(m_ingest.channel(),  SIGNAL(dataReceived()),    SLOT(packetsReady()));
+    connect(&m_journalTimer,     SIGNAL(timeout()),         SLOT(writeJournalSnapshot()));
 
 
     int h = ui->collapseLeft->fontMetrics().height()+10;
@@ -135,6 +144,7 @@ LorrisAnalyzer::LorrisAnalyzer()
     connect(importAct,      SIGNAL(triggered()),     SLOT(importBinAct()));
 
     ui->dataArea->setAnalyzerAndStorage(this, &m_storage);
+    ui->filterTabs->setStorage(&m_storage);
 
     QWidget *tmp = new QWidget(this);
     QVBoxLayout *widgetBtnL = new QVBoxLayout(tmp);
@@ -165,6 +175,8 @@ LorrisAnalyzer::LorrisAnalyzer()
     setAreaVisibility(AREA_TOP, true);
 
     m_data_changed = false;
+    m_journalFailed = false;
+    m_journalTimer.setInterval(JOURNAL_SNAPSHOT_INTERVAL);
 
     m_connectButton = new ConnectButton(ui->connectButton);
     connect(m_connectButton, SIGNAL(connectionChosen(ConnectionPointer<Connection>)), this, SLOT(setConnection(ConnectionPointer<Connection>)));
@@ -174,6 +186,9 @@ LorrisAnalyzer::~LorrisAnalyzer()
 {
     qApp->removeEventFilter(this);
 
+    // must not touch m_packet while it is deleted below
+    m_ingest.stop();
+
     delete m_searchWidget;
 
     if(m_packet)
@@ -193,9 +208,66 @@ void LorrisAnalyzer::connectedStatus(bool)
 
 void LorrisAnalyzer::readData(const QByteArray& data)
 {
+    if(!m_journalFailed && !m_storage.hasJournal() && sConfig.get(CFG_BOOL_ANALYZER_JOURNAL))
+        startJournal();
+
+    // Packets are parsed and stored in m_ingest's thread,
+    // packetsReady() is called when there are some new.
+    m_ingest.feed(data, m_con ? m_con->readTime() : Utils::monotonicTime());
+}
+
+void LorrisAnalyzer::startJournal()
+{
+    try {
+        m_storage.startJournal();
+    } catch(const QString& ex) {
+        qWarning("Can't start analyzer journal: %s", ex.toLocal8Bit().constData());
+        m_journalFailed = true;
+        return;
+    }
+
+    writeJournalSnapshot();
+    m_journalTimer.start();
+}
+
+void LorrisAnalyzer::writeJournalSnapshot()
+{
+    if(!m_storage.hasJournal())
+    {
+        m_journalTimer.stop();
+        return;
+    }
+    m_storage.writeJournalSnapshot(ui->dataArea, ui->filterTabs);
+}
+
+void LorrisAnalyzer::packetsReady()
+{
+    m_ingestRanges.clear();
+    m_ingest.channel()->receive(m_ingestRanges);
+    if(m_ingestRanges.empty())
+        return;
+
     bool atMax = (m_curIndex == ui->timeSlider->maximum());
-    bool update = atMax || (m_storage.getSize() >= (quint32)m_storage.getPacketLimit());
-    if(!m_parser.newData(data, update))
+    bool update = atMax || m_storage.isFull();
+
+    if(update)
+    {
+        for(size_t i = 0; i < m_ingestRanges.size(); ++i)
+        {
+            const IngestRange& r = m_ingestRanges[i];
+            QByteArray data;
+            for(quint64 seq = qMax(r.first, m_storage.getFirstSeq()); seq < r.last; ++seq)
+            {
+                if(!m_storage.getBySeq(seq, data))
+                    continue;
+
+                m_curData.setData(data);
+                emit newData(&m_curData, seq);
+            }
+        }
+    }
+
+    if(m_storage.isEmpty())
         return;
 
     m_data_changed = true;
@@ -233,6 +305,11 @@ void LorrisAnalyzer::onTabShow(const QString& filename)
         this->doNewSource();
 }
 
+void LorrisAnalyzer::onSettingsChanged()
+{
+    m_storage.updateHotWindow();
+}
+
 void LorrisAnalyzer::doNewSource()
 {
     if(!askToSave())
@@ -252,11 +329,15 @@ void LorrisAnalyzer::doNewSource()
         case 0:
         {
             analyzer_packet *packet = SourceDialog::getStructure(NULL, m_con.data());
-
-            m_parser.setPaused(false);
             if(!packet)
+            {
+                m_parser.setPaused(false);
                 break;
+            }
 
+            // The ingest thread must not see the old packet
+            // after it is deleted, parser stays paused till then
+            m_parser.setPacket(packet);
             if(m_packet)
             {
                 delete m_packet->header;
@@ -266,6 +347,7 @@ void LorrisAnalyzer::doNewSource()
             resetDevAndStorage(packet);
             setPacket(packet);
             m_data_changed = true;
+            m_parser.setPaused(false);
             break;
         }
         case 1:
@@ -286,6 +368,7 @@ void LorrisAnalyzer::doNewSource()
 
 void LorrisAnalyzer::importBinary(const QString& filename, bool reset)
 {
+    m_parser.setPaused(true);
     analyzer_packet *packet = SourceDialog::getStructure(reset ? NULL : m_packet, NULL, filename);
     if(!packet)
     {
@@ -293,6 +376,7 @@ void LorrisAnalyzer::importBinary(const QString& filename, bool reset)
         return;
     }
 
+    m_parser.setPacket(packet);
     if(m_packet)
     {
         delete m_packet->header;
@@ -306,7 +390,6 @@ void LorrisAnalyzer::importBinary(const QString& filename, bool reset)
     else
     {
         ui->filterTabs->setHeader(packet->header);
-        m_parser.setPacket(packet);
         m_storage.setPacket(packet);
     }
 
@@ -410,8 +493,15 @@ void LorrisAnalyzer::updateData()
 
     if((quint32)m_curIndex < m_storage.getSize())
     {
-        m_curData.setData(m_storage.get(m_curIndex));
-        emit newData(&m_curData, m_curIndex);
+        // receive time of the packet
+        const qint64 time = m_storage.getTime(m_curIndex);
+        ui->timeSlider->setToolTip(time == 0 ? QString() :
+            QDateTime::fromMSecsSinceEpoch(time/1000).toString("yyyy-MM-dd hh:mm:ss.zzz") +
+            QString("%1").arg(time%1000, 3, 10, QChar('0')));
+
+        quint64 seq = 0;
+        m_curData.setData(m_storage.get(m_curIndex, &seq));
+        emit newData(&m_curData, seq);
     }
 }
 
@@ -425,24 +515,31 @@ analyzer_data *LorrisAnalyzer::getLastData(quint32 &idx)
     return &m_curData;
 }
 
-QByteArray *LorrisAnalyzer::getDataAt(quint32 idx)
+QByteArray LorrisAnalyzer::getDataAt(quint32 idx)
 {
     if(idx >= m_storage.getSize())
-        return NULL;
+        return QByteArray();
 
     return m_storage.get(idx);
 }
 
 bool LorrisAnalyzer::load(QString &name, quint8 mask)
 {
+    // Storage::loadFromFile() deletes or changes the old packet,
+    // which the ingest thread's parser reads while it is not paused
+    m_parser.setPaused(true);
+
     quint32 idx = 0;
     analyzer_packet *packet = m_storage.loadFromFile(&name, mask, ui->dataArea, ui->filterTabs, idx);
     if(!packet)
+    {
+        m_parser.setPaused(false);
         return false;
+    }
 
     // old packet deleted in Storage::loadFromFile()
-    setPacket(packet);
     m_parser.setPacket(packet);
+    setPacket(packet);
 
     if(!ui->filterTabs->count())
         ui->filterTabs->reset(packet->header);
@@ -726,8 +823,9 @@ void LorrisAnalyzer::updateForWidget()
 
     if(m_curIndex && (quint32)m_curIndex < m_storage.getSize())
     {
-        m_curData.setData(m_storage.get(m_curIndex));
-        ((DataWidget*)sender())->newData(&m_curData, m_curIndex);
+        quint64 seq = 0;
+        m_curData.setData(m_storage.get(m_curIndex, &seq));
+        ((DataWidget*)sender())->newData(&m_curData, seq);
     }
 }
 
@@ -869,6 +967,11 @@ void LorrisAnalyzer::onPacketLimitChanged(int /*limit*/)
         indexChanged(m_storage.getMaxIdx());
 }
 
+void LorrisAnalyzer::storageError(const QString& error)
+{
+    Utils::showErrorBox(error);
+}
+
 void LorrisAnalyzer::setEnableSearchWidget(bool enable)
 {
     m_enableSearchWidget = enable;
@@ -10,6 +10,7 @@
 
 #include <QMutex>
 #include <QTime>
+#include <QTimer>
 
 #include "../WorkTab/WorkTab.h"
 #include "packet.h"
@@ -17,6 +18,7 @@
 #include "../ui/connectbutton.h"
 #include "storage.h"
 #include "packetparser.h"
+#include "ingestthread.h"
 
 class QVBoxLayout;
 class QHBoxLayout;
@@ -46,7 +48,8 @@ class LorrisAnalyzer : public PortConnWorkTab
     Q_OBJECT
 
 Q_SIGNALS:
-    void newData(analyzer_data *data, quint32 index);
+    // seq is sequence number of the packet, see Storage::addData()
+    void newData(analyzer_data *data, quint64 seq);
     void SendData(const QByteArray& data);
     void rawData(const QByteArray& data);
     void tinyWidgetBtn(bool tiny);
@@ -60,7 +63,7 @@ public:
     bool isAreaVisible(quint8 area);
     void setAreaVisibility(quint8 area, bool visible);
     analyzer_data *getLastData(quint32& idx);
-    QByteArray *getDataAt(quint32 idx);
+    QByteArray getDataAt(quint32 idx);
     analyzer_packet *getPacket() const { return m_packet; }
     void setEnableSearchWidget(bool enable);
 
@@ -77,6 +80,7 @@ public:
 
 public slots:
     void onTabShow(const QString& filename);
+    void onSettingsChanged();
     bool onTabClose();
     void updateData();
     void widgetMouseStatus(bool in, const data_widget_info &, qint32 parent);
@@ -110,11 +114,15 @@ private slots:
     void connectedStatus(bool connected);
     void indexChanged(int value);
     void onPacketLimitChanged(int limit);
+    void storageError(const QString& error);
 
     void updateForWidget();
+    void packetsReady();
+    void writeJournalSnapshot();
 
 private:
     void readData(const QByteArray& data);
+    void startJournal();
     bool load(QString& name, quint8 mask);
     void importBinary(const QString& filename, bool reset = true);
     void resetDevAndStorage(analyzer_packet *packet = NULL);
@@ -125,6 +133,11 @@ private:
     Storage m_storage;
     analyzer_packet *m_packet;
     PacketParser m_parser;
+    IngestThread m_ingest;
+    std::vector<IngestRange> m_ingestRanges;
+
+    QTimer m_journalTimer;
+    bool m_journalFailed;
 
     bool m_data_changed;
     qint32 m_curIndex;
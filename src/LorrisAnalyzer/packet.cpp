@@ -5,10 +5,12 @@
 **    See README and COPYING
 ***********************************************/
 
+#include <string.h>
+
 #include "packet.h"
 #include "../common.h"
 
-analyzer_data::analyzer_data(QByteArray *data, analyzer_packet *packet)
+analyzer_data::analyzer_data(const QByteArray& data, analyzer_packet *packet)
 {
     m_packet = packet;
     m_data = data;
@@ -16,8 +18,7 @@ analyzer_data::analyzer_data(QByteArray *data, analyzer_packet *packet)
 
 void analyzer_data::clear()
 {
-    if(m_data)
-        m_data->clear();
+    m_data.clear();
 }
 
 void analyzer_data::copy(analyzer_data *other)
@@ -26,158 +27,189 @@ void analyzer_data::copy(analyzer_data *other)
     m_packet = other->m_packet;
 }
 
-quint32 analyzer_data::addData(char *d_itr, char *d_end, quint32 &itr)
+quint32 analyzer_data::addData(const char *d_itr, const char *d_end, quint32 &itr)
 {
     if(!m_packet)
         return 0;
 
-    QByteArray static_data = m_packet->getStaticData();
+    const quint32 avail = d_end - d_itr;
+    const quint32 static_len = m_packet->header->static_len;
 
     quint32 read = 0;
-    for(; itr < (quint32)static_data.length() && d_itr+read != d_end;)
+    if(itr < static_len)
     {
-        if(*(d_itr+read) != static_data[itr])
-            return read;
-        (*m_data)[itr++] = *(d_itr+read++);
+        read = (std::min)(static_len - itr, avail);
+        if(memcmp(d_itr, &m_packet->static_data[itr], read) != 0)
+            return 0;
+
+        m_data.resize(itr + read);
+        memcpy(m_data.data() + itr, d_itr, read);
+        itr += read;
     }
 
+    // Length can be read from header only after
+    // the header is copied, so do it in two steps
     bool readFromHeader = false;
-    quint32 len = getLenght(&readFromHeader);
-    quint32 var_len = 0;
-
-    quint8 lenRead = m_packet->header->hasLen();
-
-    for(quint32 i = itr; i < len && d_itr+read != d_end; ++i)
+    while(read != avail)
     {
-        if(!readFromHeader && lenRead == DATA_LEN && getLenFromHeader(var_len))
-        {
-            len += var_len;
-            lenRead = 0;
-        }
-
-        (*m_data)[itr++] = *(d_itr+read++);
+        const quint32 len = getLenght(&readFromHeader);
+        if(itr >= len)
+            break;
+
+        const quint32 chunk = (std::min)(len - itr, avail - read);
+        m_data.resize(itr + chunk);
+        memcpy(m_data.data() + itr, d_itr + read, chunk);
+        itr += chunk;
+        read += chunk;
+
+        if(readFromHeader)
+            break;
     }
     return read;
 }
 
-quint32 analyzer_data::getLenght(bool *readFromHeader)
+quint32 analyzer_data::getLenght(bool *readFromHeader) const
 {
-    if(m_packet->header->hasLen())
-    {
-        quint32 res = 0;
-        if(getLenFromHeader(res))
-        {
-            if(readFromHeader)
-                *readFromHeader = true;
-            return res + m_packet->header->length;
-        }
-        else
-        {
-            if(readFromHeader)
-                *readFromHeader = false;
-            return m_packet->header->length;
-        }
-    }
-    else
-        return m_packet->header->packet_length;
+    const analyzer_layout& l = m_packet->layout;
+    if(!l.has_len)
+        return l.packet_length;
+
+    quint32 res = 0;
+    const bool fromHeader = getLenFromHeader(res);
+    if(readFromHeader)
+        *readFromHeader = fromHeader;
+    return fromHeader ? res + l.header_length : l.header_length;
 }
 
-bool analyzer_data::isValid(quint32 itr)
+bool analyzer_data::isValid(quint32 itr) const
 {
     if(!m_packet)
         return false;
 
-    QByteArray static_data = m_packet->getStaticData();
+    const analyzer_layout& l = m_packet->layout;
+    const quint32 static_len = m_packet->header->static_len;
 
-    if(m_data->isEmpty() || itr < (quint32)static_data.length())
+    if(m_data.isEmpty() || itr < static_len)
         return false;
 
-    quint32 static_pos = m_packet->header->findDataPos(DATA_STATIC);
-    for(quint8 i = 0; i < static_data.length(); ++i)
+    if(static_len != 0 && l.static_pos >= 0 &&
+       (l.static_pos + static_len > (quint32)m_data.size() ||
+        memcmp(m_data.constData() + l.static_pos, &m_packet->static_data[0], static_len) != 0))
     {
-        if((*m_data)[static_pos++] != static_data[i])
-            return false;
+        return false;
     }
 
-    if(itr != getLenght())
+    return itr == getLenght();
+}
+
+bool analyzer_data::getDeviceId(quint8& id) const
+{
+    const qint32 pos = m_packet->layout.dev_pos;
+    if(pos < 0 || pos >= m_data.size())
         return false;
+
+    id = (quint8)m_data.constData()[pos];
     return true;
 }
 
-bool analyzer_data::getDeviceId(quint8& id)
+bool analyzer_data::getCmd(quint8 &cmd) const
 {
-    if(!(m_packet->header->data_mask & DATA_DEVICE_ID))
+    const analyzer_layout& l = m_packet->layout;
+    if(l.cmd_pos < 0 || l.cmd_pos >= m_data.size())
         return false;
 
-    id = (quint8)m_data->at(m_packet->header->findDataPos(DATA_DEVICE_ID));
+    cmd = quint8(m_data.constData()[l.cmd_pos]) >> l.cmd_shift;
     return true;
 }
 
-bool analyzer_data::getCmd(quint8 &cmd)
+bool analyzer_data::getLenFromHeader(quint32& len) const
 {
-    if(!m_packet->header->hasOpcode())
+    const analyzer_layout& l = m_packet->layout;
+    if(l.len_pos < 0 || l.len_pos + l.len_size > m_data.size())
         return false;
 
-    if(m_packet->header->data_mask & DATA_OPCODE)
-        cmd = (quint8)m_data->at(m_packet->header->findDataPos(DATA_OPCODE));
-    else
-    {
-        int pos = m_packet->header->findDataPos(DATA_AVAKAR);
-        if(pos < 0 || pos >= m_data->size())
-            return false;
-        cmd = quint8(m_data->at(pos)) >> 4;
-    }
+    len = l.read_len(m_data.constData() + l.len_pos) + l.len_offset;
     return true;
 }
 
-bool analyzer_data::getLenFromHeader(quint32& len)
+static quint32 readLen8(const char *data)
 {
-    if(m_packet->header->data_mask & DATA_LEN)
+    return quint8(*data);
+}
+
+static quint32 readLenAvakar(const char *data)
+{
+    return quint8(*data) & 0xF;
+}
+
+template <typename T, bool big_endian>
+static quint32 readLen(const char *data)
+{
+    T val;
+    memcpy(&val, data, sizeof(T));
+    if(big_endian)
+        Utils::swapEndian(val);
+    return val;
+}
+
+void analyzer_layout::compile(analyzer_header *header, bool big_endian)
+{
+    static_pos = dev_pos = cmd_pos = len_pos = -1;
+    cmd_shift = 0;
+    len_size = 0;
+    len_offset = 0;
+    has_len = false;
+    header_length = packet_length = 0;
+    read_len = NULL;
+
+    if(!header)
+        return;
+
+    header_length = header->length;
+    packet_length = header->packet_length;
+    len_offset = header->len_offset;
+    has_len = header->hasLen();
+
+    if(header->data_mask & DATA_STATIC)
+        static_pos = header->findDataPos(DATA_STATIC);
+
+    if(header->data_mask & DATA_DEVICE_ID)
+        dev_pos = header->findDataPos(DATA_DEVICE_ID);
+
+    if(header->data_mask & DATA_OPCODE)
+        cmd_pos = header->findDataPos(DATA_OPCODE);
+    else if(header->data_mask & DATA_AVAKAR)
     {
-        try
-        {
-            quint32 pos = m_packet->header->findDataPos(DATA_LEN);
-            if(!m_data || pos >= m_data->size())
-                return false;
-
-            switch(m_packet->header->len_fmt)
-            {
-                case 0: len = getUInt8(pos);  break;
-                case 1: len = getUInt16(pos); break;
-                case 2: len = getUInt32(pos); break;
-                default: return false;
-            }
-            len += m_packet->header->len_offset;
-        }
-        catch(const char*)
-        {
-            return false;
-        }
+        cmd_pos = header->findDataPos(DATA_AVAKAR);
+        cmd_shift = 4;
     }
-    else if(m_packet->header->data_mask & DATA_AVAKAR)
+
+    if(header->data_mask & DATA_LEN)
     {
-        try
-        {
-            quint32 pos = m_packet->header->findDataPos(DATA_AVAKAR);
-            len = (getUInt8(pos) & 0xF) + m_packet->header->len_offset;
-        }
-        catch(const char*)
+        len_pos = header->findDataPos(DATA_LEN);
+        len_size = 1 << header->len_fmt;
+        switch(header->len_fmt)
         {
-            return false;
+            case 0: read_len = readLen8; break;
+            case 1: read_len = big_endian ? readLen<quint16, true> : readLen<quint16, false>; break;
+            case 2: read_len = big_endian ? readLen<quint32, true> : readLen<quint32, false>; break;
+            default: len_pos = -1; break;
         }
     }
-    else
-        return false;
-
-    return true;
+    else if(header->data_mask & DATA_AVAKAR)
+    {
+        len_pos = header->findDataPos(DATA_AVAKAR);
+        len_size = 1;
+        read_len = readLenAvakar;
+    }
 }
 
 QString analyzer_data::getString(quint32 pos)
 {
     QString str = "";
-    if(pos >= (quint32)m_data->length())
+    if(pos >= (quint32)m_data.length())
         return str;
-    for(; pos < (quint32)m_data->length() && m_data->at(pos) != '\0'; ++pos)
-        str.append(QChar(m_data->at(pos)));
+    for(; pos < (quint32)m_data.length() && m_data.at(pos) != '\0'; ++pos)
+        str.append(QChar(m_data.at(pos)));
     return str;
 }
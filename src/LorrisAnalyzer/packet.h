@@ -158,6 +158,33 @@ struct analyzer_header_v1
     quint8 order[4];
 };
 
+// Header structure compiled to flat offsets, so that analyzer_data
+// does not have to walk analyzer_header::order for every packet.
+// Positions are -1 when the packet does not have that field.
+struct analyzer_layout
+{
+    typedef quint32 (*len_reader)(const char *data);
+
+    analyzer_layout()
+    {
+        compile(NULL, true);
+    }
+
+    void compile(analyzer_header *header, bool big_endian);
+
+    qint32 static_pos;
+    qint32 dev_pos;
+    qint32 cmd_pos;
+    qint32 len_pos;
+    quint8 cmd_shift;
+    quint8 len_size;
+    qint32 len_offset;
+    bool has_len;
+    quint32 header_length;
+    quint32 packet_length;
+    len_reader read_len;
+};
+
 struct analyzer_packet
 {
     analyzer_packet()
@@ -169,6 +196,7 @@ struct analyzer_packet
     {
         header = h;
         big_endian = b_e;
+        compile();
     }
 
     analyzer_packet(analyzer_packet *p)
@@ -181,6 +209,7 @@ struct analyzer_packet
         header = new analyzer_header(p->header);
         big_endian = p->big_endian;
         static_data.assign(p->static_data.begin(), p->static_data.end());
+        compile();
     }
 
     void Reset()
@@ -188,6 +217,13 @@ struct analyzer_packet
         static_data.clear();
         header = NULL;
         big_endian = true;
+        compile();
+    }
+
+    // Must be called after header or big_endian is changed
+    void compile()
+    {
+        layout.compile(header, big_endian);
     }
 
     QByteArray getStaticData()
@@ -200,37 +236,56 @@ struct analyzer_packet
     analyzer_header *header;
     bool big_endian;
     std::vector<quint8> static_data;
+    analyzer_layout layout;
+};
+
+// Consecutive packets from Storage, for filtering many packets at once.
+// Filled by Storage::getSpan(), data[i] is never NULL, even for empty packets.
+// packet can be NULL when no structure is set.
+struct analyzer_span
+{
+    analyzer_span() : packet(NULL), first(0), first_seq(0) { }
+
+    quint32 count() const { return sizes.size(); }
+
+    analyzer_packet *packet;
+    quint32 first;
+    quint64 first_seq;
+    std::vector<const char*> data;
+    std::vector<quint32> sizes;
+    QByteArray buffer; // copy of the packets, data[i] point into it
 };
 
-// Real data
+// Real data. Holds implicitly shared QByteArray with its own copy
+// of the packet, so copying analyzer_data is cheap and it stays
+// valid after the packet is removed from Storage.
 class analyzer_data
 {
 public:
-    analyzer_data(QByteArray *data = NULL, analyzer_packet *packet = NULL);
+    analyzer_data(const QByteArray& data = QByteArray(), analyzer_packet *packet = NULL);
     void clear();
     void copy(analyzer_data *other);
 
     void setPacket(analyzer_packet *packet) { m_packet = packet; }
     analyzer_packet *getPacket() const { return m_packet; }
 
-    quint32 addData(char *d_itr, char *d_end, quint32& itr);
-    const QByteArray& getData() { return *m_data; }
-    QByteArray *getDataPtr() { return m_data; }
-    bool hasData() const { return m_data != NULL; }
-    void setData(QByteArray *data)
+    quint32 addData(const char *d_itr, const char *d_end, quint32& itr);
+    const QByteArray& getData() const { return m_data; }
+    bool hasData() const { return !m_data.isNull(); }
+    void setData(const QByteArray& data)
     {
         m_data = data;
     }
 
-    bool isValid(quint32 itr);
+    bool isValid(quint32 itr) const;
 
-    bool getDeviceId(quint8& id);
-    bool getCmd(quint8& cmd);
-    bool getLenFromHeader(quint32& len);
-    quint32 getLenght(bool *readFromHeader = NULL);
+    bool getDeviceId(quint8& id) const;
+    bool getCmd(quint8& cmd) const;
+    bool getLenFromHeader(quint32& len) const;
+    quint32 getLenght(bool *readFromHeader = NULL) const;
 
-    quint8   getUInt8  (quint32 pos) const { return m_data->at(pos); }
-    qint8    getInt8   (quint32 pos) const { return m_data->at(pos); }
+    quint8   getUInt8  (quint32 pos) const { return m_data.at(pos); }
+    qint8    getInt8   (quint32 pos) const { return m_data.at(pos); }
     quint16  getUInt16 (quint32 pos) const { return read<quint16>(pos); }
     qint16   getInt16  (quint32 pos) const { return read<qint16> (pos); }
     quint32  getUInt32 (quint32 pos) const { return read<quint32>(pos); }
@@ -246,13 +301,13 @@ public:
 
 private:
     analyzer_packet *m_packet;
-    QByteArray *m_data;
+    QByteArray m_data;
 };
 
 template <typename T>
 T analyzer_data::read(quint32 pos) const
 {
-    T val = *((T const*)&m_data->data()[pos]);
+    T val = *((T const*)(m_data.constData() + pos));
     if(m_packet->big_endian)
         Utils::swapEndian(val);
     return val;
@@ -10,7 +10,7 @@
 #include "packet.h"
 
 PacketParser::PacketParser(Storage *storage, QObject *parent) :
-    QObject(parent), m_curData(&m_curByteArray), m_emitSigData(NULL)
+    QObject(parent), m_lock(QMutex::Recursive)
 {
     m_storage = storage;
     m_paused = false;
@@ -23,17 +23,18 @@ PacketParser::~PacketParser()
     m_import.close();
 }
 
-bool PacketParser::newData(const QByteArray &data, bool emitSig)
+bool PacketParser::newData(const QByteArray &data, bool emitSig, qint64 time)
 {
+    QMutexLocker l(&m_lock);
+
     if(m_paused || !m_packet)
         return false;
 
     if(!m_curData.getLenght())
         return false;
 
-    char *d_start = (char*)data.data();
-    char *d_itr = d_start;
-    char *d_end = d_start + data.size();
+    const char *d_itr = data.constData();
+    const char *d_end = d_itr + data.size();
 
     quint32 curRead = 1;
 
@@ -41,10 +42,9 @@ bool PacketParser::newData(const QByteArray &data, bool emitSig)
     {
         if(m_packetItr == 0 || curRead == 0)
         {
-            int index = data.indexOf(m_packet->getStaticData(), d_itr - d_start);
-            if(index == -1)
+            d_itr = m_sync.find(d_itr, d_end);
+            if(!d_itr)
                 break;
-            d_itr = d_start + index;
             m_curData.clear();
             m_packetItr = 0;
         }
@@ -53,16 +53,13 @@ bool PacketParser::newData(const QByteArray &data, bool emitSig)
 
         if(m_curData.isValid(m_packetItr))
         {
+            quint64 seq = 0;
             if(m_storage)
-            {
-                QByteArray *b = m_storage->addData(m_curData.getData());
-                m_emitSigData.setData(b);
-            }
-            else
-                m_emitSigData.setData(m_curData.getDataPtr());
+                seq = m_storage->addData(m_curData.getData(), time);
+            m_emitSigData.setData(m_curData.getData());
 
             if(emitSig)
-                emit packetReceived(&m_emitSigData, m_storage ? m_storage->getSize()-1 : 0);
+                emit packetReceived(&m_emitSigData, seq);
 
             m_curData.clear();
             m_packetItr = 0;
@@ -73,6 +70,7 @@ bool PacketParser::newData(const QByteArray &data, bool emitSig)
 
 void PacketParser::setPacket(analyzer_packet *packet)
 {
+    QMutexLocker l(&m_lock);
     m_packet = packet;
     m_curData.setPacket(packet);
     m_emitSigData.setPacket(packet);
@@ -81,8 +79,13 @@ void PacketParser::setPacket(analyzer_packet *packet)
 
 void PacketParser::resetCurPacket()
 {
+    QMutexLocker l(&m_lock);
     if(m_packet)
     {
+        // Structure might have changed, SourceDialog calls this after every edit
+        m_packet->compile();
+        m_sync.setPattern((const char*)m_packet->static_data.data(), m_packet->header->static_len);
+
         m_curData.clear();
         m_packetItr = 0;
         tryImport();
@@ -91,6 +94,7 @@ void PacketParser::resetCurPacket()
 
 void PacketParser::setImport(const QString& filename)
 {
+    QMutexLocker l(&m_lock);
     m_import.close();
     m_import.setFileName(filename);
     m_import.open(QIODevice::ReadOnly);
@@ -98,6 +102,7 @@ void PacketParser::setImport(const QString& filename)
 
 void PacketParser::tryImport()
 {
+    QMutexLocker l(&m_lock);
     if(!m_packet || !m_import.isOpen())
         return;
 
@@ -11,8 +11,10 @@
 #include <QObject>
 #include <QByteArray>
 #include <QFile>
+#include <QMutex>
 
 #include "packet.h"
+#include "../misc/bytesearch.h"
 
 class Storage;
 
@@ -20,7 +22,8 @@ class PacketParser : public QObject
 {
     Q_OBJECT
 Q_SIGNALS:
-    void packetReceived(analyzer_data *data, quint32 index);
+    // seq is sequence number of the packet in Storage, see Storage::addData()
+    void packetReceived(analyzer_data *data, quint64 seq);
 
 public:
     explicit PacketParser(Storage *storage, QObject *parent = 0);
@@ -28,6 +31,7 @@ public:
 
     void setPaused(bool pause)
     {
+        QMutexLocker l(&m_lock);
         m_paused = pause;
     }
 
@@ -35,16 +39,19 @@ public:
     void setImport(const QString& filename);
     
 public slots:
-    bool newData(const QByteArray& data, bool emitSig = true);
+    // time is stored with packets completed by data, see Storage::addData()
+    bool newData(const QByteArray& data, bool emitSig = true, qint64 time = 0);
     void resetCurPacket();
     void tryImport();
 
 private:
+    // newData() is called from IngestThread, the rest from GUI thread
+    QMutex m_lock;
     bool m_paused;
     analyzer_data m_curData;
     analyzer_data m_emitSigData;
-    QByteArray m_curByteArray;
     analyzer_packet *m_packet;
+    ByteSearch m_sync;
     Storage *m_storage;
     QFile m_import;
     quint32 m_packetItr;
@@ -0,0 +1,167 @@
+/**********************************************
+**    This file is part of Lorris
+**    http://tasssadar.github.com/Lorris/
+**
+**    See README and COPYING
+***********************************************/
+
+#include <string.h>
+#include <QScriptEngine>
+#include <QScriptContext>
+#include <QScriptClassPropertyIterator>
+
+#include "packetscriptclass.h"
+
+#define LENGTH_ID 0xFFFFFFFF
+
+// Iterates over byte indexes, so that for..in loops work as with arrays
+class PacketPropertyIterator : public QScriptClassPropertyIterator
+{
+public:
+    PacketPropertyIterator(const QScriptValue& object, quint32 size) :
+        QScriptClassPropertyIterator(object), m_size(size), m_idx(0), m_last(-1)
+    {
+    }
+
+    bool hasNext() const { return m_idx < m_size; }
+    void next() { m_last = m_idx++; }
+
+    bool hasPrevious() const { return m_idx > 0; }
+    void previous() { m_last = --m_idx; }
+
+    void toFront() { m_idx = 0; m_last = -1; }
+    void toBack() { m_idx = m_size; m_last = -1; }
+
+    QScriptString name() const { return object().engine()->toStringHandle(QString::number(m_last)); }
+    uint id() const { return m_last; }
+
+private:
+    qint64 m_size;
+    qint64 m_idx;
+    qint64 m_last;
+};
+
+PacketScriptClass::PacketScriptClass(QScriptEngine *engine) : QScriptClass(engine)
+{
+    m_length = engine->toStringHandle("length");
+
+    // Array methods work on anything with length and indexes
+    m_proto = engine->newObject();
+    m_proto.setPrototype(engine->globalObject().property("Array").property("prototype"));
+
+    m_proto.setProperty("getUInt8",  engine->newFunction(read<quint8>));
+    m_proto.setProperty("getInt8",   engine->newFunction(read<qint8>));
+    m_proto.setProperty("getUInt16", engine->newFunction(read<quint16>));
+    m_proto.setProperty("getInt16",  engine->newFunction(read<qint16>));
+    m_proto.setProperty("getUInt32", engine->newFunction(read<quint32>));
+    m_proto.setProperty("getInt32",  engine->newFunction(read<qint32>));
+    m_proto.setProperty("getUInt64", engine->newFunction(read<quint64>));
+    m_proto.setProperty("getInt64",  engine->newFunction(read<qint64>));
+    m_proto.setProperty("getFloat",  engine->newFunction(read<float>));
+    m_proto.setProperty("getDouble", engine->newFunction(read<double>));
+}
+
+QScriptValue PacketScriptClass::newPacket(const analyzer_data& data)
+{
+    // data can point into a buffer which is reused when the script
+    // is done with it (e.g. span in filters), scripts can keep the object
+    QByteArray bytes(data.getData().constData(), data.getData().size());
+    analyzer_data copy(bytes, data.getPacket());
+    return engine()->newObject(this, engine()->newVariant(QVariant::fromValue(copy)));
+}
+
+QScriptValue PacketScriptClass::newPacket(const QByteArray& data, analyzer_packet *packet)
+{
+    return newPacket(analyzer_data(data, packet));
+}
+
+bool PacketScriptClass::toData(const QScriptValue& value, analyzer_data& data)
+{
+    if(!dynamic_cast<PacketScriptClass*>(value.scriptClass()))
+        return false;
+
+    data = qvariant_cast<analyzer_data>(value.data().toVariant());
+    return true;
+}
+
+QScriptClass::QueryFlags PacketScriptClass::queryProperty(const QScriptValue& object, const QScriptString& name,
+                                                          QueryFlags flags, uint *id)
+{
+    if(name == m_length)
+    {
+        // writes to length are ignored
+        *id = LENGTH_ID;
+        return flags & (HandlesReadAccess | HandlesWriteAccess);
+    }
+
+    bool isIdx = false;
+    const quint32 idx = name.toArrayIndex(&isIdx);
+    if(!isIdx)
+        return 0;
+
+    analyzer_data data;
+    if(!toData(object, data) || idx >= (quint32)data.getData().size())
+        return 0;
+
+    *id = idx;
+    return flags & (HandlesReadAccess | HandlesWriteAccess);
+}
+
+QScriptValue PacketScriptClass::property(const QScriptValue& object, const QScriptString& /*name*/, uint id)
+{
+    analyzer_data data;
+    if(!toData(object, data))
+        return QScriptValue();
+
+    if(id == LENGTH_ID)
+        return QScriptValue(engine(), data.getData().size());
+    return QScriptValue(engine(), (quint8)data.getData().at(id));
+}
+
+void PacketScriptClass::setProperty(QScriptValue& object, const QScriptString& /*name*/, uint id,
+                                    const QScriptValue& value)
+{
+    analyzer_data data;
+    if(id == LENGTH_ID || !toData(object, data))
+        return;
+
+    // Each object has its own copy, see newPacket()
+    QByteArray bytes = data.getData();
+    bytes[id] = char(value.toUInt32());
+    data.setData(bytes);
+    object.setData(engine()->newVariant(QVariant::fromValue(data)));
+}
+
+QScriptValue::PropertyFlags PacketScriptClass::propertyFlags(const QScriptValue& /*object*/,
+                                                             const QScriptString& /*name*/, uint id)
+{
+    if(id == LENGTH_ID)
+        return QScriptValue::ReadOnly | QScriptValue::Undeletable | QScriptValue::SkipInEnumeration;
+    return QScriptValue::Undeletable;
+}
+
+QScriptClassPropertyIterator *PacketScriptClass::newIterator(const QScriptValue& object)
+{
+    analyzer_data data;
+    toData(object, data);
+    return new PacketPropertyIterator(object, data.getData().size());
+}
+
+template <typename T>
+QScriptValue PacketScriptClass::read(QScriptContext *context, QScriptEngine *engine)
+{
+    analyzer_data data;
+    if(!toData(context->thisObject(), data))
+        return context->throwError(QScriptContext::TypeError, QObject::tr("Not a packet"));
+
+    const quint32 pos = context->argument(0).toUInt32();
+    if(quint64(pos) + sizeof(T) > quint64(data.getData().size()))
+        return QScriptValue();
+
+    T val;
+    if(data.getPacket())
+        val = data.read<T>(pos);
+    else
+        memcpy(&val, data.getData().constData() + pos, sizeof(T));
+    return QScriptValue(engine, qsreal(val));
+}
@@ -0,0 +1,56 @@
+/**********************************************
+**    This file is part of Lorris
+**    http://tasssadar.github.com/Lorris/
+**
+**    See README and COPYING
+***********************************************/
+
+#ifndef PACKETSCRIPTCLASS_H
+#define PACKETSCRIPTCLASS_H
+
+#include <QScriptClass>
+#include <QScriptString>
+#include <QScriptValue>
+
+#include "packet.h"
+
+Q_DECLARE_METATYPE(analyzer_data)
+
+// Packets passed to QtScript. The script gets an object which behaves
+// like an array of uint8 (data[i], data.length, Array.prototype methods),
+// but bytes are read from the packet's QByteArray only when accessed.
+// Every object has its own copy of the packet, so scripts can keep it
+// and change its bytes (data[i] = x), length can't be changed.
+// It also has typed getters, e.g. data.getUInt16(pos), which read
+// numbers with packet's endianness and return undefined when
+// the number is out of the packet.
+class PacketScriptClass : public QScriptClass
+{
+public:
+    PacketScriptClass(QScriptEngine *engine);
+
+    QScriptValue newPacket(const analyzer_data& data);
+    QScriptValue newPacket(const QByteArray& data, analyzer_packet *packet);
+
+    // Returns false if value is not a packet object
+    static bool toData(const QScriptValue& value, analyzer_data& data);
+
+    QueryFlags queryProperty(const QScriptValue& object, const QScriptString& name,
+                             QueryFlags flags, uint *id);
+    QScriptValue property(const QScriptValue& object, const QScriptString& name, uint id);
+    void setProperty(QScriptValue& object, const QScriptString& name, uint id, const QScriptValue& value);
+    QScriptValue::PropertyFlags propertyFlags(const QScriptValue& object, const QScriptString& name, uint id);
+    QScriptClassPropertyIterator *newIterator(const QScriptValue& object);
+
+    QScriptValue prototype() const { return m_proto; }
+    QString name() const { return "Packet"; }
+
+private:
+    template <typename T>
+    static QScriptValue read(QScriptContext *context, QScriptEngine *engine);
+
+    QScriptString m_length;
+    QScriptValue m_proto;
+};
+
+#endif // PACKETSCRIPTCLASS_H
@@ -68,7 +68,7 @@ SourceDialog::SourceDialog(analyzer_packet *pkt, PortConnection *con, const QStr
     connect(ui->endianBox,      SIGNAL(currentIndexChanged(int)),                SLOT(endianChanged(int)));
     connect(ui->radioAvakar,    SIGNAL(toggled(bool)),                           SLOT(switchStackPage(bool)));
     connect(ui->len_static,     SIGNAL(toggled(bool)),                           SLOT(packetLenSetStatic(bool)));
-    connect(m_parser,           SIGNAL(packetReceived(analyzer_data*,quint32)),  SLOT(packetReceived(analyzer_data*,quint32)));
+    connect(m_parser,           SIGNAL(packetReceived(analyzer_data*,quint64)),  SLOT(packetReceived(analyzer_data*,quint64)));
 
     setted = false;
 
@@ -126,7 +126,7 @@ void SourceDialog::butonnBoxClicked(QAbstractButton *b)
     close();
 }
 
-void SourceDialog::packetReceived(analyzer_data *data, quint32)
+void SourceDialog::packetReceived(analyzer_data *data, quint64)
 {
     if(!ui->freezeBtn->isChecked())
         scroll_layout->SetData(data);
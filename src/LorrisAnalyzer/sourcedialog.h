@@ -49,7 +49,7 @@ public slots:
     void staticDataChanged(QListWidgetItem*);
     void endianChanged(int idx);
     void packetLenChanged(int val);
-    void packetReceived(analyzer_data *data, quint32);
+    void packetReceived(analyzer_data *data, quint64);
     void switchStackPage(bool avakar);
     void packetLenSetStatic(bool setStatic);
 
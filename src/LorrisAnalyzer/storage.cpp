@@ -5,9 +5,9 @@
 **    See README and COPYING
 ***********************************************/
 
+#include <string.h>
 #include <QFileDialog>
 #include <QMessageBox>
-#include <QCryptographicHash>
 #include <QApplication>
 
 #include "storage.h"
@@ -15,20 +15,29 @@
 #include "../misc/datafileparser.h"
 #include "lorrisanalyzer.h"
 #include "filtertabwidget.h"
+#include "capturejournal.h"
 
 static const char *ANALYZER_DATA_FORMAT = "v7";
 static const char ANALYZER_DATA_MAGIC[] = { (char)0xFF, (char)0x80, 0x68 };
 
-#define MD5(x) QCryptographicHash::hash(x, QCryptographicHash::Md5)
+// Max size of packet data serialized at once when saving
+#define SAVE_PART_SIZE (4*1024*1024)
 
-Storage::Storage(LorrisAnalyzer *analyzer)
+Storage::Storage(LorrisAnalyzer *analyzer) : m_lock(QMutex::Recursive)
 {
     m_packet = NULL;
+    m_file_data = NULL;
+    m_file_seq = 0;
+    m_file_first = 0;
+    m_journal = NULL;
     m_analyzer = analyzer;
+    updateHotWindow();
 }
 
 Storage::~Storage()
 {
+    // Storage is destroyed only when the tab is closed properly
+    stopJournal(true);
     Clear();
 }
 
@@ -42,23 +51,224 @@ void Storage::setPacket(analyzer_packet *packet)
 
 void Storage::setPacketLimit(int limit)
 {
-    if(m_data.getPacketLimit() == limit)
-        return;
+    {
+        QMutexLocker l(&m_lock);
+        if(m_data.getPacketLimit() == limit)
+            return;
 
-    m_data.setPacketLimit(limit);
+        trimFile(limit);
+        m_data.setPacketLimit(limit);
+    }
     emit onPacketLimitChanged(limit);
 }
 
+void Storage::updateHotWindow()
+{
+    QMutexLocker l(&m_lock);
+    m_data.setHotWindow(sConfig.get(CFG_QUINT32_ANALYZER_HOT_WINDOW)*1024*1024);
+}
+
 void Storage::Clear()
 {
+    QMutexLocker l(&m_lock);
     m_data.clear();
+    if(m_journal)
+        m_journal->clear();
+    // m_data already starts after the file packets
+    delete m_file_data;
+    m_file_data = NULL;
+    updateHotWindow();
 }
 
-QByteArray *Storage::addData(const QByteArray& data)
+quint64 Storage::addData(const QByteArray& data, qint64 time)
 {
-    if(!m_packet)
-        return NULL;
-    return m_data.push_back(data);
+    QString error;
+    quint64 seq = 0;
+    {
+        QMutexLocker l(&m_lock);
+        seq = firstSeq() + packetCount();
+        if(!m_packet)
+            return seq;
+
+        if(m_journal)
+            m_journal->addPacket(data);
+        m_data.push_back(data, time);
+        trimFile(m_data.getPacketLimit());
+
+        // Reading of spilled packets may fail too, it is reported
+        // here and only once, so that it is not shown for every packet
+        error = m_data.takeError();
+        if(error == m_last_error)
+            error.clear();
+        else if(!error.isEmpty())
+            m_last_error = error;
+    }
+
+    if(!error.isEmpty())
+        emit dataError(error);
+    return seq;
+}
+
+QByteArray Storage::get(quint32 index, quint64 *seq) const
+{
+    QMutexLocker l(&m_lock);
+    if(seq)
+        *seq = firstSeq() + index;
+    return index < packetCount() ? packetAt(index) : QByteArray();
+}
+
+QByteArray Storage::packetAt(quint32 idx) const
+{
+    const quint32 files = fileCount();
+    return idx < files ? m_file_data->get(m_file_first + idx) : m_data[idx - files];
+}
+
+qint64 Storage::packetTimeAt(quint32 idx) const
+{
+    const quint32 files = fileCount();
+    return idx < files ? m_file_data->getTime(m_file_first + idx) : m_data.time(idx - files);
+}
+
+// Removes the oldest file packets over limit. m_data removes
+// its own packets, but only once the file ones are gone.
+void Storage::trimFile(quint32 limit)
+{
+    if(!m_file_data)
+        return;
+
+    const quint32 count = packetCount();
+    if(count > limit)
+        m_file_first += (std::min)(count - limit, fileCount());
+
+    if(fileCount() == 0)
+    {
+        delete m_file_data;
+        m_file_data = NULL;
+    }
+}
+
+void Storage::detachFile()
+{
+    if(!m_file_data)
+        return;
+
+    std::vector<QByteArray> data;
+    std::vector<qint64> times;
+    data.reserve(m_data.size());
+    times.reserve(m_data.size());
+    for(quint32 i = 0; i < m_data.size(); ++i)
+    {
+        data.push_back(m_data[i]);
+        times.push_back(m_data.time(i));
+    }
+
+    // Packets keep their sequence numbers
+    const quint64 seq = firstSeq();
+    m_data.clear();
+    m_data.resetSeq(seq);
+
+    for(quint32 i = m_file_first; i < m_file_data->size(); ++i)
+        m_data.push_back(m_file_data->get(i), m_file_data->getTime(i));
+    for(size_t i = 0; i < data.size(); ++i)
+        m_data.push_back(data[i], times[i]);
+
+    delete m_file_data;
+    m_file_data = NULL;
+}
+
+bool Storage::getBySeq(quint64 seq, QByteArray& data, quint32 *index) const
+{
+    QMutexLocker l(&m_lock);
+    const quint64 first = firstSeq();
+    if(seq < first || seq - first >= packetCount())
+        return false;
+
+    data = packetAt(seq - first);
+    if(index)
+        *index = seq - first;
+    return true;
+}
+
+void Storage::getSpan(quint32 first, quint32 last, analyzer_span& span) const
+{
+    QMutexLocker l(&m_lock);
+
+    span.packet = m_packet;
+    span.first = first;
+    span.first_seq = firstSeq() + first;
+
+    const quint32 size = packetCount();
+    if(first >= size || last < first)
+    {
+        span.data.clear();
+        span.sizes.clear();
+        span.buffer.clear();
+        return;
+    }
+
+    const quint32 count = (std::min)(last, size-1) - first + 1;
+    span.data.resize(count);
+    span.sizes.resize(count);
+
+    // The span may start in file packets and continue in m_data
+    std::vector<QByteArray> blocks;
+    const quint32 files = fileCount();
+    quint32 fromFile = 0;
+    if(first < files)
+    {
+        fromFile = (std::min)(count, files - first);
+        m_file_data->getRange(m_file_first + first, fromFile, &span.data[0], &span.sizes[0], blocks);
+    }
+    if(fromFile < count)
+        m_data.getRange(first + fromFile - files, count - fromFile, &span.data[fromFile], &span.sizes[fromFile]);
+
+    // The pointers are valid only until the next call to m_data, which can
+    // come from another thread once the lock is released, so the span gets
+    // its own copy.
+    quint32 total = 0;
+    for(quint32 i = 0; i < count; ++i)
+        total += span.sizes[i];
+
+    span.buffer.resize(total);
+    char *dst = span.buffer.data();
+    for(quint32 i = 0; i < count; ++i)
+    {
+        memcpy(dst, span.data[i], span.sizes[i]);
+        span.data[i] = dst;
+        dst += span.sizes[i];
+    }
+}
+
+void Storage::getSpanFrom(quint64 seq, quint32 maxCount, analyzer_span& span) const
+{
+    QMutexLocker l(&m_lock);
+
+    const quint64 first = firstSeq();
+    const quint32 idx = seq > first ? (quint32)(seq - first) : 0;
+    const quint32 size = packetCount();
+    if(idx >= size || maxCount == 0)
+    {
+        span.packet = m_packet;
+        span.first = idx;
+        span.first_seq = first + idx;
+        span.data.clear();
+        span.sizes.clear();
+        span.buffer.clear();
+        return;
+    }
+
+    getSpan(idx, idx + (std::min)(maxCount, size - idx) - 1, span);
+}
+
+bool Storage::seqToIndex(quint64 seq, quint32& idx) const
+{
+    QMutexLocker l(&m_lock);
+    const quint64 first = firstSeq();
+    if(seq < first || seq - first >= packetCount())
+        return false;
+
+    idx = seq - first;
+    return true;
 }
 
 void Storage::SaveToFile(WidgetArea *area, FilterTabWidget *filters)
@@ -74,7 +284,7 @@ void Storage::SaveToFile(WidgetArea *area, FilterTabWidget *filters)
         return;
     }
 
-    QByteArray md5 = MD5(file.readAll());
+    QByteArray md5 = DataFileBuilder::fileChecksum(file);
     file.close();
 
     if(md5 != m_file_md5)
@@ -113,9 +323,84 @@ void Storage::SaveToFile(QString filename, WidgetArea *area, FilterTabWidget *fi
 
     sConfig.set(CFG_STRING_ANALYZER_FOLDER, filename);
 
-    QByteArray data;
+    // Compressed files have packets in indexed blocks after the document
+    const bool compress = filename.contains(".cldta");
+
+    // Packets of the old file would be overwritten while they are read.
+    // Canonical paths resolve symlinks, they are empty for files which
+    // don't exist, and those can't be the one being read.
+    {
+        QMutexLocker l(&m_lock);
+        if(m_file_data)
+        {
+            const QString path = QFileInfo(filename).canonicalFilePath();
+            if(!path.isEmpty() && path == QFileInfo(m_file_data->getFilename()).canonicalFilePath())
+                detachFile();
+        }
+    }
+
+    // Everything except packets is serialized first, so that the state
+    // of GUI is not changed by events processed while the file is written
+    QByteArray head, tail;
+    serializeDocument(packet, area, filters, head, tail);
+
+    quint64 firstSeq = 0;
+    quint32 packetCount = 0;
     {
-        DataFileParser buffer(&data, QIODevice::WriteOnly);
+        QMutexLocker l(&m_lock);
+        firstSeq = this->firstSeq();
+        packetCount = this->packetCount();
+    }
+
+    const quint32 inlineCount = compress ? 0 : packetCount;
+    head.append((char*)&inlineCount, sizeof(quint32));
+
+    try {
+        DataFileWriter writer(filename, compress, DATAFILE_ANALYZER);
+        writer.write(head);
+
+        // Packets are passed to the writer in parts, the lock is not
+        // held while the writer waits for compression.
+        QByteArray part;
+        if(compress)
+        {
+            writer.write(tail);
+            writer.beginPackets(true);
+
+            for(quint32 i = 0; i < packetCount;)
+            {
+                const quint32 from = i;
+                i = serializePackets(firstSeq, i, packetCount, DATAFILE_PACKET_BLOCK_SIZE, part, true);
+                writer.writePacketBlock(part, i - from);
+            }
+        }
+        else
+        {
+            for(quint32 i = 0; i < packetCount;)
+            {
+                i = serializePackets(firstSeq, i, packetCount, SAVE_PART_SIZE, part, false);
+                writer.write(part);
+            }
+            writer.write(tail);
+        }
+
+        m_file_md5 = writer.finish();
+    } catch(const QString& ex) {
+        Utils::showErrorBox(ex);
+    }
+
+    if(!m_packet)
+    {
+        delete packet->header;
+        delete packet;
+    }
+}
+
+void Storage::serializeDocument(analyzer_packet *packet, WidgetArea *area, FilterTabWidget *filters,
+                                QByteArray& head, QByteArray& tail)
+{
+    {
+        DataFileParser buffer(&head, QIODevice::WriteOnly);
 
         //Header
         buffer.writeBlockIdentifier("analyzerHeaderV2");
@@ -143,16 +428,10 @@ void Storage::SaveToFile(QString filename, WidgetArea *area, FilterTabWidget *fi
 
         //Data
         buffer.writeBlockIdentifier(BLOCK_DATA);
+    }
 
-        quint32 packetCount = m_data.size();
-        buffer.write((char*)&packetCount, sizeof(quint32));
-
-        for(quint32 i = 0; i < m_data.size(); ++i)
-        {
-            const QByteArray& d = m_data[i];
-            buffer << (quint32)d.size();
-            buffer.write(d);
-        }
+    {
+        DataFileParser buffer(&tail, QIODevice::WriteOnly);
 
         //Widgets
         buffer.writeBlockIdentifier(BLOCK_WIDGETS);
@@ -167,24 +446,106 @@ void Storage::SaveToFile(QString filename, WidgetArea *area, FilterTabWidget *fi
 
         // Packet limits
         buffer.writeBlockIdentifier(BLOCK_PACKET_LIMIT);
-        buffer << m_data.getPacketLimit();
+        buffer << getPacketLimit();
 
         buffer.close();
     }
+}
 
-    try {
-        m_file_md5 = DataFileBuilder::writeWithHeader(filename, data, filename.contains(".cldta"), DATAFILE_ANALYZER);
-    } catch(const QString& ex) {
-        Utils::showErrorBox(ex);
+void Storage::startJournal()
+{
+    QMutexLocker l(&m_lock);
+    if(m_journal)
+        return;
+
+    m_journal = new CaptureJournal();
+
+    for(quint32 i = 0; i < packetCount(); ++i)
+        m_journal->addPacket(packetAt(i));
+}
+
+void Storage::stopJournal(bool remove)
+{
+    CaptureJournal *journal = NULL;
+    {
+        QMutexLocker l(&m_lock);
+        std::swap(journal, m_journal);
     }
 
-    if(!m_packet)
+    if(journal)
     {
-        delete packet->header;
-        delete packet;
+        journal->stop(remove);
+        delete journal;
+    }
+}
+
+void Storage::writeJournalSnapshot(WidgetArea *area, FilterTabWidget *filters)
+{
+    if(!m_packet || !hasJournal())
+        return;
+
+    QByteArray head, tail;
+    serializeDocument(m_packet, area, filters, head, tail);
+
+    QMutexLocker l(&m_lock);
+    if(!m_journal)
+        return;
+
+    m_journal->addSnapshot(head, tail);
+
+    // Packets removed because of packet limit are still in the journal,
+    // start a new one once they are the majority of it
+    const quint32 count = packetCount();
+    if(m_journal->getPacketCount() > 2*(quint64)count)
+    {
+        std::vector<QByteArray> packets;
+        packets.reserve(count);
+        for(quint32 i = 0; i < count; ++i)
+            packets.push_back(packetAt(i));
+        m_journal->rotate(packets);
     }
 }
 
+// Serializes packets from index from until maxSize bytes are
+// in out, returns index of the next packet to serialize. If times
+// is true, out is packet block with times, see DATAFLAG_PACKET_TIMES.
+quint32 Storage::serializePackets(quint64 firstSeq, quint32 from, quint32 to, quint32 maxSize,
+                                  QByteArray& out, bool times) const
+{
+    out.clear();
+    out.reserve(maxSize);
+
+    std::vector<qint64> packetTimes;
+
+    QMutexLocker l(&m_lock);
+    for(; from < to && (quint32)out.size() < maxSize; ++from)
+    {
+        // Packets removed because of packet limit while saving
+        // are stored as empty, so that packetCount is valid
+        quint32 idx = 0;
+        const quint64 seq = firstSeq + from;
+        QByteArray d;
+        qint64 time = 0;
+        if(seq >= this->firstSeq() && (idx = seq - this->firstSeq()) < packetCount())
+        {
+            d = packetAt(idx);
+            if(times)
+                time = packetTimeAt(idx);
+        }
+
+        const quint32 len = d.size();
+        out.append((char*)&len, sizeof(len));
+        out.append(d);
+
+        if(times)
+            packetTimes.push_back(time);
+    }
+
+    if(times && !packetTimes.empty())
+        DataFileWriter::appendPacketTimes(out, &packetTimes[0], packetTimes.size());
+    return from;
+}
+
 analyzer_packet *Storage::loadFromFile(QString *name, quint8 load, WidgetArea *area, FilterTabWidget *filters, quint32 &data_idx)
 {
     QString filename;
@@ -198,6 +559,7 @@ analyzer_packet *Storage::loadFromFile(QString *name, quint8 load, WidgetArea *a
 
     QByteArray data;
     bool legacy = false;
+    DataFileHeader fileHeader;
 
     QScopedPointer<QMessageBox> loading_box;
     {
@@ -223,7 +585,7 @@ analyzer_packet *Storage::loadFromFile(QString *name, quint8 load, WidgetArea *a
         QApplication::processEvents();
 
         try {
-            data = DataFileBuilder::readAndCheck(file, DATAFILE_ANALYZER, &legacy);
+            data = DataFileBuilder::readAndCheck(file, DATAFILE_ANALYZER, &legacy, &fileHeader);
         }
         catch(const QString& ex)
         {
@@ -232,8 +594,7 @@ analyzer_packet *Storage::loadFromFile(QString *name, quint8 load, WidgetArea *a
             return NULL;
         }
 
-        file.seek(0);
-        m_file_md5 = MD5(file.readAll());
+        m_file_md5 = DataFileBuilder::fileChecksum(file);
 
         file.close();
         QFileInfo info(filename);
@@ -258,6 +619,9 @@ analyzer_packet *Storage::loadFromFile(QString *name, quint8 load, WidgetArea *a
         }
     }
 
+    // Loaded packets are in the file, journal is started
+    // again when new data are received
+    stopJournal(true);
     Clear();
 
     if(load & STORAGE_STRUCTURE)
@@ -352,6 +716,29 @@ analyzer_packet *Storage::loadFromFile(QString *name, quint8 load, WidgetArea *a
         }
     }
 
+    // Packets of indexed files are loaded when needed
+    if((load & STORAGE_DATA) && !legacy && (fileHeader.flags & DATAFLAG_PACKET_INDEX))
+    {
+        try {
+            DataFilePackets *packets = new DataFilePackets(m_filename);
+
+            QMutexLocker l(&m_lock);
+            if(m_data.empty() && !m_file_data)
+            {
+                m_file_data = packets;
+                m_file_seq = m_data.firstSeq();
+                m_file_first = 0;
+                m_data.skipSeq(packets->size());
+            }
+            else
+                delete packets;
+        }
+        catch(const QString& ex)
+        {
+            Utils::showErrorBox(tr("Error while loading data file: %1").arg(ex));
+        }
+    }
+
     //Widgets
     if(buffer.seekToNextBlock(BLOCK_WIDGETS, 0))
         area->loadWidgets(&buffer, !(load & STORAGE_WIDGETS));
@@ -365,10 +752,19 @@ analyzer_packet *Storage::loadFromFile(QString *name, quint8 load, WidgetArea *a
 
     // packet limit
     if(buffer.seekToNextBlock(BLOCK_PACKET_LIMIT, 0))
-        m_data.setPacketLimit(buffer.readVal<quint32>());
+    {
+        QMutexLocker l(&m_lock);
+        const quint32 limit = buffer.readVal<quint32>();
+        trimFile(limit);
+        m_data.setPacketLimit(limit);
+    }
 
     buffer.close();
 
+    packet->compile();
+    if(m_packet && m_packet != packet.data())
+        m_packet->compile();
+
     // To process delayed load events
     QApplication::processEvents();
 
@@ -399,8 +795,9 @@ void Storage::ExportToBin(const QString &filename)
     if(!f.open(QIODevice::Truncate | QIODevice::WriteOnly))
         throw tr("Unable to open file %1 for writing!").arg(filename);
 
-    for(quint32 i = 0; i < m_data.size(); ++i)
-        f.write(m_data[i]);
+    QMutexLocker l(&m_lock);
+    for(quint32 i = 0; i < packetCount(); ++i)
+        f.write(packetAt(i));
 
     f.close();
 }
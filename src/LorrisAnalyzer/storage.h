@@ -13,9 +13,11 @@
 #include <QByteArray>
 #include <QObject>
 #include <QByteArray>
+#include <QMutex>
 
 #include "packet.h"
 #include "storagedata.h"
+#include "../misc/datafileparser.h"
 
 enum StorageDataType
 {
@@ -28,7 +30,7 @@ class WidgetArea;
 class FilterTabWidget;
 class QFile;
 class LorrisAnalyzer;
-class DataFileParser;
+class CaptureJournal;
 
 class Storage : public QObject
 {
@@ -36,6 +38,8 @@ class Storage : public QObject
 
 Q_SIGNALS:
     void onPacketLimitChanged(int currentLimit);
+    // Packets can't be spilled to the temporary file, see StorageData
+    void dataError(const QString& error);
 
 public:
     explicit Storage(LorrisAnalyzer *analyzer);
@@ -46,19 +50,49 @@ public:
 
     void Clear();
 
-    QByteArray *addData(const QByteArray& data);
-    quint32 getSize() const { return m_data.size(); }
-    quint32 getMaxIdx() const { return m_data.size() ? m_data.size()-1 : 0; }
-    bool isEmpty() const { return m_data.empty(); }
-    bool isFull() const { return m_data.full(); }
-    QByteArray *get(quint32 index) { return &m_data[index]; }
+    // Packets are added from IngestThread, so everything
+    // which touches m_data has to lock m_lock. time is receive
+    // time of the data, see Utils::monotonicTime(), 0 if not known.
+    // Returns sequence number of the packet. Indexes change when old
+    // packets are removed, so anything which refers to a packet after
+    // the lock is released should keep its sequence number instead.
+    quint64 addData(const QByteArray& data, qint64 time = 0);
+    quint32 getSize() const { QMutexLocker l(&m_lock); return packetCount(); }
+    quint32 getMaxIdx() const { QMutexLocker l(&m_lock); return packetCount() ? packetCount()-1 : 0; }
+    bool isEmpty() const { QMutexLocker l(&m_lock); return packetCount() == 0; }
+    bool isFull() const { QMutexLocker l(&m_lock); return packetCount() >= (quint32)m_data.getPacketLimit(); }
+    // seq is set to sequence number of the packet
+    QByteArray get(quint32 index, quint64 *seq = NULL) const;
+    qint64 getTime(quint32 index) const { QMutexLocker l(&m_lock); return packetTimeAt(index); }
+
+    quint64 getFirstSeq() const { QMutexLocker l(&m_lock); return firstSeq(); }
+    quint64 getNextSeq() const { QMutexLocker l(&m_lock); return firstSeq() + packetCount(); }
+    bool seqToIndex(quint64 seq, quint32& idx) const;
+    // index is set to current index of the packet
+    bool getBySeq(quint64 seq, QByteArray& data, quint32 *index = NULL) const;
+
+    // Packets [first, last], last is clamped to the end of storage
+    void getSpan(quint32 first, quint32 last, analyzer_span& span) const;
+    // At most maxCount packets starting with sequence number seq
+    // (or the oldest packet, if seq was already removed)
+    void getSpanFrom(quint64 seq, quint32 maxCount, analyzer_span& span) const;
+
     analyzer_packet *loadFromFile(QString *name, quint8 load, WidgetArea *area, FilterTabWidget *filters, quint32 &data_idx);
 
     const QString& getFilename() { return m_filename; }
     void clearFilename() { m_filename.clear(); }
 
-    int getPacketLimit() const { return m_data.getPacketLimit(); }
+    int getPacketLimit() const { QMutexLocker l(&m_lock); return m_data.getPacketLimit(); }
     void setPacketLimit(int limit);
+    // Applies CFG_QUINT32_ANALYZER_HOT_WINDOW
+    void updateHotWindow();
+
+    // Crash recovery journal, see CaptureJournal. startJournal()
+    // writes all current packets to it and throws QString on error.
+    bool hasJournal() const { QMutexLocker l(&m_lock); return m_journal != NULL; }
+    void startJournal();
+    void stopJournal(bool remove);
+    void writeJournalSnapshot(WidgetArea *area, FilterTabWidget *filters);
 
 public slots:
     void SaveToFile(QString filename, WidgetArea *area, FilterTabWidget *filters);
@@ -69,12 +103,40 @@ private:
     bool checkMagic(DataFileParser *file);
     void readLegacyStructure(DataFileParser *file, analyzer_packet *packet);
 
+    // Everything except packets, head ends with BLOCK_DATA identifier
+    void serializeDocument(analyzer_packet *packet, WidgetArea *area, FilterTabWidget *filters,
+                           QByteArray& head, QByteArray& tail);
+
+    // Packets of file with packet index are not loaded to m_data, they are
+    // read from m_file_data when needed. New packets are appended to m_data
+    // after them, so index i is m_file_data packet m_file_first+i while
+    // i < fileCount(), and m_data packet i-fileCount() after that. Packet
+    // limit removes file packets first, m_data starts with sequence number
+    // of the packet after the last file packet. detachFile() moves all
+    // packets to m_data. These have to be called with m_lock held.
+    quint32 fileCount() const { return m_file_data ? m_file_data->size() - m_file_first : 0; }
+    quint32 packetCount() const { return fileCount() + m_data.size(); }
+    quint64 firstSeq() const { return m_file_data ? m_file_seq + m_file_first : m_data.firstSeq(); }
+    QByteArray packetAt(quint32 idx) const;
+    qint64 packetTimeAt(quint32 idx) const;
+    void trimFile(quint32 limit);
+    void detachFile();
+
+    quint32 serializePackets(quint64 firstSeq, quint32 from, quint32 to, quint32 maxSize,
+                             QByteArray& out, bool times) const;
+
+    mutable QMutex m_lock;
     StorageData m_data;
+    DataFilePackets *m_file_data;
+    quint64 m_file_seq;   // sequence number of m_file_data packet 0
+    quint32 m_file_first; // file packets before it were removed
+    CaptureJournal *m_journal;
     analyzer_packet *m_packet;
     LorrisAnalyzer *m_analyzer;
 
     QString m_filename;
     QByteArray m_file_md5;
+    QString m_last_error;
 };
 
 #endif // STORAGE_H
@@ -5,12 +5,32 @@
 **    See README and COPYING
 ***********************************************/
 
+#include <climits>
+#include <cstring>
+#include <algorithm>
+#include <QTemporaryFile>
+#include <QDir>
+
 #include "storagedata.h"
 
+#define CHUNK_SIZE (1024*1024)
+#define SEGMENT_SIZE (64*1024*1024)
+// At most this many segments are mapped at once, so that big
+// spill file does not take all address space of 32bit process
+#define MAX_MAPPED_SEGMENTS (sizeof(void*) == 4 ? 4 : 64)
+// entry::time of packets without time
+#define NO_TIME UINT_MAX
+
 StorageData::StorageData()
 {
     m_packet_limit = INT_MAX;
-    m_offset = 0;
+    m_first_chunk = 0;
+    m_first_seq = 0;
+    m_hot_window = 0;
+    m_hot_bytes = 0;
+    m_spilled_chunks = 0;
+    m_spill_file = NULL;
+    m_spill_segment = 0;
 }
 
 StorageData::~StorageData()
@@ -20,8 +40,18 @@ StorageData::~StorageData()
 
 void StorageData::clear()
 {
-    m_data.clear();
-    m_offset = 0;
+    m_first_seq += m_index.size();
+    m_index.clear();
+
+    for(size_t i = 0; i < m_chunks.size(); ++i)
+        freeChunk(m_chunks[i]);
+    m_chunks.clear();
+    m_first_chunk = 0;
+    m_hot_bytes = 0;
+    m_spilled_chunks = 0;
+
+    releaseFreeChunks();
+    closeSpillFile();
 }
 
 void StorageData::setPacketLimit(int limit)
@@ -29,57 +59,344 @@ void StorageData::setPacketLimit(int limit)
     if(limit == m_packet_limit)
         return;
 
-    if(!m_data.empty())
+    while(m_index.size() > (quint32)limit)
+        popFront();
+
+    // Chunks of evicted packets are kept around for reuse
+    // while the ring buffer is running, but the limit is
+    // changing now, so give the memory back.
+    releaseFreeChunks();
+
+    m_packet_limit = limit;
+}
+
+void StorageData::setHotWindow(quint32 bytes)
+{
+    m_hot_window = bytes;
+    spillChunks();
+}
+
+QString StorageData::takeError()
+{
+    QString res;
+    std::swap(res, m_error);
+    return res;
+}
+
+QByteArray StorageData::operator[](quint32 idx) const
+{
+    const entry& e = m_index[idx];
+    const char *data = chunkData(m_chunks[e.chunk - m_first_chunk], true);
+    if(!data)
+        return QByteArray();
+    return QByteArray(data + e.offset, e.size);
+}
+
+qint64 StorageData::time(quint32 idx) const
+{
+    const entry& e = m_index[idx];
+    if(e.time == NO_TIME)
+        return 0;
+    return m_chunks[e.chunk - m_first_chunk]->time_base + e.time;
+}
+
+void StorageData::getRange(quint32 first, quint32 count, const char **data, quint32 *sizes) const
+{
+    static const char empty = 0;
+
+    // Segments mapped by this call must stay mapped until the caller is done
+    unmapSegments(MAX_MAPPED_SEGMENTS-1);
+
+    std::deque<entry>::const_iterator itr = m_index.begin() + first;
+    for(quint32 i = 0; i < count; ++i, ++itr)
+    {
+        const char *c = chunkData(m_chunks[itr->chunk - m_first_chunk], false);
+        data[i] = (itr->size && c) ? c + itr->offset : &empty;
+        sizes[i] = c ? itr->size : 0;
+    }
+}
+
+QByteArray StorageData::push_back(const QByteArray& data, qint64 time)
+{
+    if(m_index.size() >= (quint32)m_packet_limit)
+        popFront();
+
+    const quint32 len = data.size();
+
+    chunk *c = m_chunks.empty() ? NULL : m_chunks.back();
+    if(!c || c->spilled || c->capacity - c->used < len ||
+       (time != 0 && c->time_base >= 0 && (time < c->time_base || time - c->time_base >= NO_TIME)))
+    {
+        c = allocChunk(len);
+        m_chunks.push_back(c);
+        m_hot_bytes += c->capacity;
+        spillChunks();
+    }
+
+    entry e;
+    e.chunk = m_first_chunk + m_chunks.size() - 1;
+    e.offset = c->used;
+    e.size = len;
+    e.time = NO_TIME;
+
+    if(time != 0)
+    {
+        if(c->time_base < 0)
+            c->time_base = time;
+        e.time = time - c->time_base;
+    }
+
+    memcpy(c->data + c->used, data.constData(), len);
+    c->used += len;
+    ++c->packets;
+
+    m_index.push_back(e);
+    return data;
+}
+
+void StorageData::popFront()
+{
+    if(m_index.empty())
+        return;
+
+    chunk *c = m_chunks[m_index.front().chunk - m_first_chunk];
+    m_index.pop_front();
+    ++m_first_seq;
+
+    if(--c->packets != 0 || c != m_chunks.front())
+        return;
+
+    // Chunks are filled in order, so once the first one is
+    // empty, it can go to the free list to be reused by allocChunk()
+    while(!m_chunks.empty() && m_chunks.front()->packets == 0 &&
+          (m_chunks.size() > 1 || m_index.empty()))
+    {
+        chunk *front = m_chunks.front();
+        if(front->spilled)
+        {
+            if(--m_segments[front->segment].chunks == 0)
+                freeSegment(front->segment);
+            delete front;
+            --m_spilled_chunks;
+        }
+        else
+        {
+            front->used = 0;
+            m_hot_bytes -= front->capacity;
+            m_free_chunks.push_back(front);
+        }
+        m_chunks.pop_front();
+        ++m_first_chunk;
+    }
+}
+
+void StorageData::spillChunks()
+{
+    if(m_hot_window == 0)
+        return;
+
+    // The last chunk is being written into, so it always stays in memory
+    while(m_hot_bytes > m_hot_window && m_spilled_chunks+1 < m_chunks.size())
     {
-        size_t itr;
-        std::vector<QByteArray> vec;
-        vec.reserve((std::min)(m_data.size(), (size_t)limit));
+        chunk *c = m_chunks[m_spilled_chunks];
+        const quint32 capacity = c->capacity;
+        char *mem = c->data;
 
-        if(m_offset < limit)
+        if(!spillChunk(c))
         {
-            itr = m_data.size() - (std::min)(m_data.size()-m_offset, size_t(limit - m_offset));
-            vec.insert(vec.end(), m_data.begin()+itr, m_data.end());
+            m_error = QObject::tr("Can't write analyzer data to temporary file %1, "
+                                  "all packets are kept in memory.")
+                    .arg(m_spill_file ? m_spill_file->fileName() : QDir::tempPath());
+            m_hot_window = 0;
+            return;
         }
 
-        itr = (std::max)(0, m_offset-limit);
-        vec.insert(vec.end(), m_data.begin()+itr, m_data.begin()+m_offset);
+        ++m_spilled_chunks;
+        m_hot_bytes -= capacity;
 
-        m_data.swap(vec);
+        // Keep the memory for the next chunk
+        chunk *old = new chunk;
+        old->data = mem;
+        old->capacity = capacity;
+        old->used = 0;
+        old->packets = 0;
+        old->time_base = -1;
+        old->spilled = false;
+        m_free_chunks.push_back(old);
     }
+}
 
-    m_packet_limit = limit;
-    m_offset = 0;
+bool StorageData::spillChunk(chunk *c)
+{
+    if(!m_spill_file)
+    {
+        m_spill_file = new QTemporaryFile(QDir::tempPath() + "/lorris_analyzer_XXXXXX.spill");
+        if(!m_spill_file->open())
+        {
+            delete m_spill_file;
+            m_spill_file = NULL;
+            return false;
+        }
+    }
+
+    if(m_segments.empty() || m_segments[m_spill_segment].size - m_segments[m_spill_segment].used < c->used)
+    {
+        const quint32 idx = spillSegment(c->used);
+        if(idx == m_segments.size())
+            return false;
+        m_spill_segment = idx;
+    }
+
+    segment& s = m_segments[m_spill_segment];
+    uchar *map = mapSegment(m_spill_segment, true);
+    if(!map)
+        return false;
+
+    memcpy(map + s.used, c->data, c->used);
+
+    c->data = NULL;
+    c->capacity = c->used;
+    c->spilled = true;
+    c->segment = m_spill_segment;
+    c->seg_offset = s.used;
+
+    s.used += c->used;
+    ++s.chunks;
+    return true;
+}
+
+// Returns index of empty segment with at least size bytes,
+// m_segments.size() if it can't be created
+quint32 StorageData::spillSegment(quint32 size)
+{
+    // Chunks are evicted in the order they were spilled in,
+    // so segments at the beginning of the file are freed first
+    for(size_t i = 0; i < m_segments.size(); ++i)
+        if(m_segments[i].chunks == 0 && m_segments[i].size >= size)
+            return i;
+
+    segment s;
+    s.map = NULL;
+    s.offset = m_spill_file->size();
+    s.size = (std::max)(quint32(SEGMENT_SIZE), size);
+    s.used = 0;
+    s.chunks = 0;
+
+    if(!m_spill_file->resize(s.offset + s.size))
+        return m_segments.size();
+
+    m_segments.push_back(s);
+    return m_segments.size()-1;
 }
 
-QByteArray& StorageData::operator[](quint32 idx)
+void StorageData::freeSegment(quint32 idx)
 {
-    idx += m_offset;
-    if(idx >= m_data.size())
-        idx -= m_data.size();
-    return m_data[idx];
+    segment& s = m_segments[idx];
+    s.used = 0;
+    if(!s.map)
+        return;
+
+    m_spill_file->unmap(s.map);
+    s.map = NULL;
+    m_mapped.erase(std::find(m_mapped.begin(), m_mapped.end(), idx));
 }
 
-QByteArray *StorageData::push_back(const QByteArray& data)
+// If unmapOld is true, least recently used segments may be unmapped
+// to keep MAX_MAPPED_SEGMENTS, which invalidates pointers returned earlier
+const char *StorageData::chunkData(const chunk *c, bool unmapOld) const
 {
-    QByteArray *res = NULL;
-    if(m_data.size() < (quint32)m_packet_limit)
+    if(!c->spilled)
+        return c->data;
+
+    const uchar *map = mapSegment(c->segment, unmapOld);
+    return map ? (const char*)map + c->seg_offset : NULL;
+}
+
+uchar *StorageData::mapSegment(quint32 idx, bool unmapOld) const
+{
+    segment& s = m_segments[idx];
+    if(s.map)
     {
-        m_data.push_back(data);
-        res = &m_data.back();
+        m_mapped.erase(std::find(m_mapped.begin(), m_mapped.end(), idx));
+        m_mapped.push_back(idx);
+        return s.map;
     }
-    else
+
+    if(unmapOld)
+        unmapSegments(MAX_MAPPED_SEGMENTS-1);
+
+    s.map = m_spill_file->map(s.offset, s.size);
+    if(!s.map)
     {
-        if((quint32)m_offset >= m_data.size())
-            m_offset = 0;
+        m_error = QObject::tr("Can't map analyzer data from temporary file %1: %2")
+                .arg(m_spill_file->fileName()).arg(m_spill_file->errorString());
+        return NULL;
+    }
+
+    m_mapped.push_back(idx);
+    return s.map;
+}
 
-        m_data[m_offset] = data;
-        res = &m_data[m_offset];
-        ++m_offset;
+void StorageData::unmapSegments(quint32 keep) const
+{
+    while(m_mapped.size() > keep)
+    {
+        segment& s = m_segments[m_mapped.front()];
+        m_spill_file->unmap(s.map);
+        s.map = NULL;
+        m_mapped.pop_front();
     }
+}
 
-    // Data in this class will never be modified,
-    // so release unused memory
-    res->squeeze();
-    return res;
+void StorageData::closeSpillFile()
+{
+    if(!m_spill_file)
+        return;
+
+    unmapSegments(0);
+    m_segments.clear();
+    m_spill_segment = 0;
+
+    delete m_spill_file;
+    m_spill_file = NULL;
 }
 
+StorageData::chunk *StorageData::allocChunk(quint32 minSize)
+{
+    for(size_t i = 0; i < m_free_chunks.size(); ++i)
+    {
+        chunk *c = m_free_chunks[i];
+        if(c->capacity < minSize)
+            continue;
+
+        m_free_chunks.erase(m_free_chunks.begin()+i);
+        c->used = 0;
+        c->packets = 0;
+        c->time_base = -1;
+        c->spilled = false;
+        return c;
+    }
+
+    chunk *c = new chunk;
+    c->capacity = (std::max)(quint32(CHUNK_SIZE), minSize);
+    c->data = new char[c->capacity];
+    c->used = 0;
+    c->packets = 0;
+    c->time_base = -1;
+    c->spilled = false;
+    return c;
+}
+
+void StorageData::freeChunk(chunk *c)
+{
+    if(!c->spilled)
+        delete[] c->data;
+    delete c;
+}
+
+void StorageData::releaseFreeChunks()
+{
+    for(size_t i = 0; i < m_free_chunks.size(); ++i)
+        freeChunk(m_free_chunks[i]);
+    m_free_chunks.clear();
+}
@@ -9,8 +9,29 @@
 #define STORAGEDATA_H
 
 #include <vector>
+#include <deque>
 #include <QByteArray>
+#include <QString>
 
+class QTemporaryFile;
+
+// Packets are appended into big contiguous chunks and
+// indexed by (chunk, offset, size) triplets, so no per-packet
+// allocation is done when storing them. operator[] and push_back()
+// return copies, because chunks of evicted packets are reused
+// and the returned data may outlive them.
+//
+// If hot window is set, only that many bytes of chunks are kept
+// in memory, older chunks are moved to a temporary file. The file
+// is divided into segments, which are memory-mapped only while
+// they are being read, and are reused once all their chunks are
+// evicted, so the file does not grow past the packet limit.
+// If the file can't be written, everything is kept in memory
+// and the reason is returned by takeError().
+//
+// Receive time of each packet is stored as difference from
+// time of the first timed packet in its chunk, a new chunk
+// is started when the difference would not fit.
 class StorageData
 {
 public:
@@ -18,20 +39,94 @@ public:
     virtual ~StorageData();
 
     void clear();
-    inline bool empty() const { return m_data.empty(); }
-    inline bool full() const { return m_data.size() >= (quint32)m_packet_limit; }
-    inline quint32 size() const { return m_data.size(); }
+    inline bool empty() const { return m_index.empty(); }
+    inline bool full() const { return m_index.size() >= (quint32)m_packet_limit; }
+    inline quint32 size() const { return m_index.size(); }
 
     int getPacketLimit() const { return m_packet_limit; }
     void setPacketLimit(int limit);
 
-    QByteArray& operator [](quint32 idx);
-    QByteArray *push_back(const QByteArray& data);
+    // Sequence number of packet at index 0. Sequence numbers are never
+    // reused, not even after clear(), so they can identify packets
+    // while the oldest ones are being removed.
+    quint64 firstSeq() const { return m_first_seq; }
+    // For packets which were stored elsewhere, storage must be empty
+    void skipSeq(quint64 count) { m_first_seq += count; }
+    // Storage must be empty too, seq must not be used by any other packet
+    void resetSeq(quint64 seq) { m_first_seq = seq; }
+
+    quint32 getHotWindow() const { return m_hot_window; }
+    void setHotWindow(quint32 bytes);
+
+    // Returns and clears description of the last spill file error
+    QString takeError();
+
+    QByteArray operator [](quint32 idx) const;
+    // Receive time, see Utils::monotonicTime(), 0 if it is not known
+    qint64 time(quint32 idx) const;
+    // Fills pointers to data and sizes of count packets starting at first.
+    // Pointers are valid only until the next call to StorageData.
+    void getRange(quint32 first, quint32 count, const char **data, quint32 *sizes) const;
+    QByteArray push_back(const QByteArray& data, qint64 time = 0);
 
 private:
-    std::vector<QByteArray> m_data;
+    struct chunk
+    {
+        char *data;
+        quint32 capacity;
+        quint32 used;
+        quint32 packets;
+        qint64 time_base; // -1 until the first timed packet
+        bool spilled;
+        quint32 segment;  // data of spilled chunks are at segment+seg_offset
+        quint32 seg_offset;
+    };
+
+    struct segment
+    {
+        uchar *map;       // NULL if it is not mapped
+        qint64 offset;
+        quint32 size;
+        quint32 used;
+        quint32 chunks;
+    };
+
+    struct entry
+    {
+        quint32 chunk;  // absolute chunk number, see m_first_chunk
+        quint32 offset;
+        quint32 size;
+        quint32 time;   // since chunk's time_base
+    };
+
+    chunk *allocChunk(quint32 minSize);
+    void freeChunk(chunk *c);
+    void releaseFreeChunks();
+    void popFront();
+    void spillChunks();
+    bool spillChunk(chunk *c);
+    quint32 spillSegment(quint32 size);
+    void freeSegment(quint32 idx);
+    const char *chunkData(const chunk *c, bool unmapOld) const;
+    uchar *mapSegment(quint32 idx, bool unmapOld) const;
+    void unmapSegments(quint32 keep) const;
+    void closeSpillFile();
+
+    std::deque<entry> m_index;
+    std::deque<chunk*> m_chunks;
+    std::vector<chunk*> m_free_chunks;
+    quint32 m_first_chunk;
+    quint64 m_first_seq;
     int m_packet_limit;
-    int m_offset;
+
+    quint32 m_hot_window;
+    quint64 m_hot_bytes;
+    quint32 m_spilled_chunks; // spilled chunks are always at the front of m_chunks
+    QTemporaryFile *m_spill_file;
+    quint32 m_spill_segment;            // segment which is being filled
+    mutable std::vector<segment> m_segments;
+    mutable std::deque<quint32> m_mapped; // most recently used is last
+    mutable QString m_error;
 };
 
 #endif // STORAGEDATA_H
@@ -5,6 +5,7 @@
 **    See README and COPYING
 ***********************************************/
 
+#include <limits.h>
 #include <QTextEdit>
 #include <QHBoxLayout>
 #include <QVBoxLayout>
@@ -18,6 +19,7 @@
 #include <QInputDialog>
 
 #include "lorristerminal.h"
+#include "terminallog.h"
 #include "../ui/terminal.h"
 #include "../WorkTab/WorkTabMgr.h"
 #include "../shared/hexfile.h"
@@ -29,6 +31,7 @@
 LorrisTerminal::LorrisTerminal()
     : ui(new Ui::LorrisTerminal)
 {
+    m_log = NULL;
     initUI();
 }
 
@@ -65,6 +68,20 @@ void LorrisTerminal::initUI()
     binSave->setShortcut(QKeySequence("Ctrl+S"));
     binSave->setShortcutContext(Qt::WidgetWithChildrenShortcut);
 
+    QMenu *logMenu = dataMenu->addMenu(tr("Log received data"));
+    m_log_act = logMenu->addAction(tr("Log to file..."));
+    m_log_act->setCheckable(true);
+    m_log_act->setStatusTip(tr("Write all received data to file, independently of the terminal's scrollback"));
+    logMenu->addSeparator();
+    QAction *logTime = logMenu->addAction(tr("Prefix received chunks with time"));
+    logTime->setCheckable(true);
+    logTime->setChecked(sConfig.get(CFG_BOOL_TERMINAL_LOG_TIMESTAMPS));
+    QAction *logCmpr = logMenu->addAction(tr("Compress the log (zstd)"));
+    logCmpr->setCheckable(true);
+    logCmpr->setChecked(sConfig.get(CFG_BOOL_TERMINAL_LOG_COMPRESS));
+    QAction *logRotate = logMenu->addAction(tr("Start new file after..."));
+    logRotate->setStatusTip(tr("Changes of these settings are used when the log is started again"));
+
     dataMenu->addSeparator();
 
     QMenu *inputMenu = new QMenu(tr("Input handling"), this);
@@ -103,6 +120,10 @@ void LorrisTerminal::initUI()
     connect(termLoad,          SIGNAL(triggered()),                 SLOT(loadText()));
     connect(termSave,          SIGNAL(triggered()),                 SLOT(saveText()));
     connect(binSave,           SIGNAL(triggered()),                 SLOT(saveBin()));
+    connect(m_log_act,         SIGNAL(triggered(bool)),             SLOT(logToFile(bool)));
+    connect(logTime,           SIGNAL(triggered(bool)),             SLOT(logTimestamps(bool)));
+    connect(logCmpr,           SIGNAL(triggered(bool)),             SLOT(logCompress(bool)));
+    connect(logRotate,         SIGNAL(triggered()),                 SLOT(logRotation()));
     connect(chgSettings,       SIGNAL(triggered()),   ui->terminal, SLOT(showSettings()));
     connect(ui->terminal,      SIGNAL(fmtSelected(int)),            SLOT(checkFmtAct(int)));
     connect(ui->terminal,      SIGNAL(paused(bool)),                SLOT(setPauseBtnText(bool)));
@@ -115,6 +136,7 @@ void LorrisTerminal::initUI()
 
 LorrisTerminal::~LorrisTerminal()
 {
+    delete m_log;
     delete ui;
 }
 
@@ -156,6 +178,8 @@ void LorrisTerminal::connectedStatus(bool connected)
 
 void LorrisTerminal::readData(const QByteArray& data)
 {
+    if(m_log)
+        m_log->addData(data, m_con ? m_con->readTime() : Utils::monotonicTime());
     ui->terminal->appendText(data);
 }
 
@@ -248,6 +272,69 @@ void LorrisTerminal::saveBin()
     sConfig.set(CFG_STRING_TERMINAL_TEXTFILE, filename);
 }
 
+void LorrisTerminal::logToFile(bool enable)
+{
+    delete m_log;
+    m_log = NULL;
+
+    if(!enable)
+        return;
+
+    static const QString filters = tr("Log file (*.log *.txt);;Compressed log (*.zst);;Any file (*.*)");
+    QString filename = QFileDialog::getSaveFileName(this, tr("Log received data"),
+                                                    sConfig.get(CFG_STRING_TERMINAL_LOGFILE), filters);
+    if(filename.isEmpty())
+    {
+        m_log_act->setChecked(false);
+        return;
+    }
+
+    try {
+        m_log = new TerminalLog(filename, this);
+    } catch(const QString& ex) {
+        Utils::showErrorBox(ex, this);
+        m_log_act->setChecked(false);
+        return;
+    }
+
+    connect(m_log, SIGNAL(failed(QString)), SLOT(logFailed(QString)), Qt::QueuedConnection);
+    sConfig.set(CFG_STRING_TERMINAL_LOGFILE, filename);
+}
+
+void LorrisTerminal::logFailed(const QString &error)
+{
+    logToFile(false);
+    m_log_act->setChecked(false);
+    Utils::showErrorBox(error, this);
+}
+
+void LorrisTerminal::logTimestamps(bool enable)
+{
+    sConfig.set(CFG_BOOL_TERMINAL_LOG_TIMESTAMPS, enable);
+}
+
+void LorrisTerminal::logCompress(bool enable)
+{
+    sConfig.set(CFG_BOOL_TERMINAL_LOG_COMPRESS, enable);
+}
+
+void LorrisTerminal::logRotation()
+{
+    bool ok = false;
+    const int size = QInputDialog::getInt(this, tr("Log rotation"), tr("Start new file after (MB, 0 is never):"),
+                                          sConfig.get(CFG_QUINT32_TERMINAL_LOG_SIZE), 0, INT_MAX, 1, &ok);
+    if(!ok)
+        return;
+
+    const int time = QInputDialog::getInt(this, tr("Log rotation"), tr("Start new file after (minutes, 0 is never):"),
+                                          sConfig.get(CFG_QUINT32_TERMINAL_LOG_TIME), 0, INT_MAX, 1, &ok);
+    if(!ok)
+        return;
+
+    sConfig.set(CFG_QUINT32_TERMINAL_LOG_SIZE, size);
+    sConfig.set(CFG_QUINT32_TERMINAL_LOG_TIME, time);
+}
+
 void LorrisTerminal::inputAct(int act)
 {
     for(quint8 i = 0; i < INPUT_MAX; ++i)
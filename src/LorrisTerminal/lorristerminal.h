@@ -21,6 +21,7 @@
 
 class QVBoxLayout;
 class QTextEdit;
+class TerminalLog;
 
 namespace Ui {
     class LorrisTerminal;
@@ -50,6 +51,11 @@ private slots:
     void loadText();
     void saveText();
     void saveBin();
+    void logToFile(bool enable);
+    void logFailed(const QString& error);
+    void logTimestamps(bool enable);
+    void logCompress(bool enable);
+    void logRotation();
     void inputAct(int act);
     void sendButton();
 
@@ -65,6 +71,9 @@ private:
     QAction *m_import_eeprom;
     QAction *m_fmt_act[FMT_MAX];
     QAction *m_input[INPUT_MAX];
+    QAction *m_log_act;
+
+    TerminalLog *m_log;
 
     ConnectButton * m_connectButton;
     Ui::LorrisTerminal *ui;
@@ -0,0 +1,210 @@
+/**********************************************
+**    This file is part of Lorris
+**    http://tasssadar.github.com/Lorris/
+**
+**    See README and COPYING
+***********************************************/
+
+#include <zstd.h>
+#include <QFileInfo>
+#include <QDateTime>
+
+#include "terminallog.h"
+#include "../misc/config.h"
+
+// How often are queued chunks written, in ms
+#define LOG_WRITE_INTERVAL 500
+// Thread is woken before the interval when this much data is queued
+#define LOG_WAKE_SIZE (1024*1024)
+// Block is written when it has this size, compressed one also
+// when it is this old (ms)
+#define LOG_FRAME_SIZE (1024*1024)
+#define LOG_FRAME_TIME 5000
+
+TerminalLog::TerminalLog(const QString& filename, QObject *parent) : QThread(parent)
+{
+    m_rotate_size = qint64(sConfig.get(CFG_QUINT32_TERMINAL_LOG_SIZE))*1024*1024;
+    m_rotate_time = qint64(sConfig.get(CFG_QUINT32_TERMINAL_LOG_TIME))*60*1000;
+    m_timestamps = sConfig.get(CFG_BOOL_TERMINAL_LOG_TIMESTAMPS);
+    m_compress = sConfig.get(CFG_BOOL_TERMINAL_LOG_COMPRESS);
+    m_level = sConfig.get(CFG_QUINT32_COMPRESS_LEVEL);
+
+    m_filename = filename;
+    if(m_compress && QFileInfo(filename).suffix() != "zst")
+        m_filename += ".zst";
+
+    m_file_counter = 0;
+    m_queued = 0;
+    m_failed = false;
+
+    // first file is opened here, so that the error is shown to the user
+    openFile();
+
+    m_run = true;
+    start(QThread::LowPriority);
+}
+
+TerminalLog::~TerminalLog()
+{
+    stop();
+}
+
+void TerminalLog::addData(const QByteArray& data, qint64 time)
+{
+    QMutexLocker l(&m_lock);
+    Chunk c = { time, data };
+    m_chunks.push_back(c);
+    m_queued += data.size();
+    if(m_queued >= LOG_WAKE_SIZE)
+        m_cond.wakeOne();
+}
+
+void TerminalLog::stop()
+{
+    {
+        QMutexLocker l(&m_lock);
+        m_run = false;
+        m_cond.wakeOne();
+    }
+    wait();
+}
+
+void TerminalLog::run()
+{
+    std::vector<Chunk> chunks;
+    bool run = true;
+    while(run)
+    {
+        {
+            QMutexLocker l(&m_lock);
+            if(m_run && m_queued < LOG_WAKE_SIZE)
+                m_cond.wait(&m_lock, LOG_WRITE_INTERVAL);
+
+            run = m_run;
+            chunks.swap(m_chunks);
+            m_queued = 0;
+        }
+
+        if(m_failed)
+        {
+            chunks.clear();
+            continue;
+        }
+
+        for(size_t i = 0; i < chunks.size(); ++i)
+        {
+            if(m_timestamps)
+            {
+                const qint64 time = chunks[i].time;
+                m_block.append(QDateTime::fromMSecsSinceEpoch(time/1000)
+                               .toString("[yyyy-MM-dd hh:mm:ss.zzz").toLatin1());
+                m_block.append(QString("%1] ").arg(time%1000, 3, 10, QChar('0')).toLatin1());
+            }
+            m_block.append(chunks[i].data);
+
+            if(m_block.size() >= LOG_FRAME_SIZE)
+                flush();
+
+            // compressed size of the block is not known yet
+            const qint64 size = m_file.pos() + (m_compress ? 0 : m_block.size());
+            if(m_rotate_size != 0 && size >= m_rotate_size)
+            {
+                closeFile();
+                openFile();
+            }
+        }
+        chunks.clear();
+
+        if(!m_compress || !run || m_flush_time.elapsed() >= LOG_FRAME_TIME)
+            flush();
+
+        if(m_rotate_time != 0 && m_file_time.elapsed() >= m_rotate_time)
+        {
+            closeFile();
+            openFile();
+        }
+    }
+    closeFile();
+}
+
+QString TerminalLog::nextFilename()
+{
+    if(m_rotate_size == 0 && m_rotate_time == 0)
+        return m_filename;
+
+    // log.txt.zst is log_0000_<time>.txt.zst
+    QFileInfo info(m_filename);
+    const QString name = info.fileName();
+    const int dot = name.indexOf('.', 1);
+
+    return QString("%1/%2_%3_%4%5")
+            .arg(info.path())
+            .arg(dot == -1 ? name : name.left(dot))
+            .arg(m_file_counter++, 4, 10, QChar('0'))
+            .arg(QDateTime::currentDateTime().toString("yyyyMMdd_hhmmss"))
+            .arg(dot == -1 ? QString() : name.mid(dot));
+}
+
+void TerminalLog::openFile()
+{
+    if(m_failed)
+        return;
+
+    m_file.setFileName(nextFilename());
+    if(!m_file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        error(tr("Can't open/create file \"%1\"!").arg(m_file.fileName()));
+        return;
+    }
+
+    m_file_time.start();
+    m_flush_time.start();
+}
+
+void TerminalLog::closeFile()
+{
+    if(!m_file.isOpen())
+        return;
+
+    flush();
+    m_file.close();
+}
+
+void TerminalLog::flush()
+{
+    m_flush_time.restart();
+    if(m_block.isEmpty() || m_failed)
+        return;
+
+    // Every frame is complete, file can be read while it is written
+    QByteArray data;
+    if(!m_compress)
+        data = m_block;
+    else
+    {
+        data.resize(ZSTD_compressBound(m_block.size()));
+        const size_t len = ZSTD_compress(data.data(), data.size(), m_block.constData(), m_block.size(),
+                                         m_level == 0 ? ZSTD_CLEVEL_DEFAULT : m_level);
+        if(ZSTD_isError(len))
+        {
+            error(tr("Failed to compress the log"));
+            return;
+        }
+        data.resize(len);
+    }
+    m_block.clear();
+
+    if(m_file.write(data) != data.size() || !m_file.flush())
+        error(tr("Failed to write to file \"%1\"!").arg(m_file.fileName()));
+}
+
+void TerminalLog::error(const QString& text)
+{
+    m_failed = true;
+    m_block.clear();
+
+    // the first file is opened by the constructor
+    if(!isRunning())
+        throw text;
+    emit failed(text);
+}
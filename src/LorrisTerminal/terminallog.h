@@ -0,0 +1,82 @@
+/**********************************************
+**    This file is part of Lorris
+**    http://tasssadar.github.com/Lorris/
+**
+**    See README and COPYING
+***********************************************/
+
+#ifndef TERMINALLOG_H
+#define TERMINALLOG_H
+
+#include <vector>
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QFile>
+
+// Streams received data of the terminal to a file, independently
+// of its scrollback. Chunks are only queued by addData(), the thread
+// writes them, optionally prefixed by receive time, and starts a new
+// file after CFG_QUINT32_TERMINAL_LOG_SIZE MB or
+// CFG_QUINT32_TERMINAL_LOG_TIME minutes. Compressed logs are
+// sequences of zstd frames, which can be read by "zstd -d".
+class TerminalLog : public QThread
+{
+    Q_OBJECT
+
+Q_SIGNALS:
+    // Writing failed, no more data are logged
+    void failed(const QString& error);
+
+public:
+    // throws QString
+    TerminalLog(const QString& filename, QObject *parent = 0);
+    ~TerminalLog();
+
+    // time is receive time, see PortConnection::readTime()
+    void addData(const QByteArray& data, qint64 time);
+
+    // Writes everything queued and closes the file
+    void stop();
+
+protected:
+    void run();
+
+private:
+    struct Chunk
+    {
+        qint64 time;
+        QByteArray data;
+    };
+
+    QString nextFilename();
+    void openFile();
+    void closeFile();
+    void flush();
+    void error(const QString& text);
+
+    QMutex m_lock;
+    QWaitCondition m_cond;
+    std::vector<Chunk> m_chunks;
+    quint32 m_queued;
+    bool m_run;
+
+    // used only by the thread after start
+    QString m_filename;
+    quint32 m_file_counter;
+    QFile m_file;
+    QElapsedTimer m_file_time;
+    QElapsedTimer m_flush_time;
+    QByteArray m_block;
+    bool m_failed;
+
+    qint64 m_rotate_size;
+    qint64 m_rotate_time;
+    bool m_timestamps;
+    bool m_compress;
+    int m_level;
+};
+
+#endif // TERMINALLOG_H
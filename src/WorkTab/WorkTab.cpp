@@ -29,6 +29,11 @@ void WorkTab::onTabShow(const QString &)
 
 }
 
+void WorkTab::onSettingsChanged()
+{
+
+}
+
 void WorkTab::addTopMenu(QMenu *menu)
 {
     m_actions.push_back(menu->menuAction());
@@ -34,6 +34,8 @@ public:
     quint32 getId() { return m_id; }
 
     virtual void onTabShow(const QString& filename);
+    // Settings were changed in SettingsDialog
+    virtual void onSettingsChanged();
     virtual void openFile(const QString& filename);
     virtual std::vector<QAction*>& getActions() { return m_actions; }
 
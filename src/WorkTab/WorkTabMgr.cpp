@@ -7,11 +7,14 @@
 
 #include <algorithm>
 #include <QStatusBar>
+#include <QMessageBox>
+#include <QPushButton>
 
 #include "WorkTabMgr.h"
 #include "WorkTabInfo.h"
 #include "../ui/HomeTab.h"
 #include "childtab.h"
+#include "../LorrisAnalyzer/capturejournal.h"
 
 WorkTabMgr::WorkTabMgr() : QObject()
 {
@@ -30,7 +33,9 @@ WorkTabMgr::~WorkTabMgr()
 void WorkTabMgr::initialize(const QStringList &openFiles)
 {
     m_session_mgr = new SessionMgr(this);
-    newWindow(openFiles);
+    MainWindow *window = newWindow(openFiles);
+
+    recoverJournals(window);
 
     if(openFiles.isEmpty() && sConfig.get(CFG_BOOL_LOAD_LAST_SESSION))
     {
@@ -39,6 +44,46 @@ void WorkTabMgr::initialize(const QStringList &openFiles)
     }
 }
 
+// Analyzer journals left behind by crashed Lorris are converted
+// to data files next to them and opened
+void WorkTabMgr::recoverJournals(MainWindow *window)
+{
+    const QStringList journals = CaptureJournal::findAbandoned();
+    if(journals.isEmpty())
+        return;
+
+    QMessageBox box(QMessageBox::Question, tr("Recover data"),
+                    tr("Lorris was not closed properly, data received by %n analyzer tab(s) can be recovered.",
+                       "", journals.size()), QMessageBox::NoButton, window);
+    box.setInformativeText(tr("Recovered data will be opened in new tabs."));
+    QPushButton *recover = box.addButton(tr("Recover"), QMessageBox::AcceptRole);
+    QPushButton *discard = box.addButton(tr("Discard"), QMessageBox::DestructiveRole);
+    box.addButton(tr("Ask later"), QMessageBox::RejectRole);
+    box.setDefaultButton(recover);
+    box.exec();
+
+    if(box.clickedButton() != recover && box.clickedButton() != discard)
+        return;
+
+    for(int i = 0; i < journals.size(); ++i)
+    {
+        if(box.clickedButton() == recover)
+        {
+            QString output = journals[i];
+            output.replace(QRegExp("\\.ljrn$"), ".cldta");
+
+            try {
+                CaptureJournal::compact(journals[i], output);
+            } catch(const QString& ex) {
+                Utils::showErrorBox(tr("Failed to recover data from %1: %2").arg(journals[i]).arg(ex), window);
+                continue;
+            }
+            openTabWithFile(output, window);
+        }
+        QFile::remove(journals[i]);
+    }
+}
+
 void WorkTabMgr::RegisterTabInfo(WorkTabInfo *info)
 {
     m_workTabInfos.push_back(info);
@@ -376,3 +421,9 @@ QVariant WorkTabMgr::getBatchVar(const QString& name, QVariant def)
         return itr.value();
     return def;
 }
+
+void WorkTabMgr::settingsChanged()
+{
+    for(WorkTabMap::iterator itr = m_workTabs.begin(); itr != m_workTabs.end(); ++itr)
+        (*itr)->onSettingsChanged();
+}
@@ -111,12 +111,16 @@ public:
 public slots:
     MainWindow *newWindow(QStringList openFiles = QStringList());
     void instanceMessage(const QString& message);
+    // Calls WorkTab::onSettingsChanged() of all tabs
+    void settingsChanged();
 
 private slots:
     void tabWidgetDestroyed(QObject *widget);
     void workTabDestroyed(QObject *tab);
 
 private:
+    void recoverJournals(MainWindow *window);
+
     InfoList m_workTabInfos;
     WorkTabMap m_workTabs;
     QStringList m_handledTypes;
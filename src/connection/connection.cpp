@@ -8,6 +8,7 @@
 #include "connection.h"
 #include "../WorkTab/WorkTab.h"
 #include "../shared/programmer.h"
+#include "../misc/utils.h"
 #include <QStringBuilder>
 
 Connection::Connection(ConnectionType type)
@@ -192,6 +193,19 @@ void Connection::setCompanionId(const QString &name, qint64 id)
 PortConnection::PortConnection(ConnectionType type) : Connection(type)
 {
     m_programmer_type = programmer_avr232boot;
+    m_read_time = -1;
+}
+
+qint64 PortConnection::readTime() const
+{
+    return m_read_time >= 0 ? m_read_time : Utils::monotonicTime();
+}
+
+void PortConnection::emitDataRead(const QByteArray& data, qint64 time)
+{
+    m_read_time = time;
+    emit dataRead(data);
+    m_read_time = -1;
 }
 
 QHash<QString, QVariant> PortConnection::config() const
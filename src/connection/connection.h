@@ -172,11 +172,22 @@ public:
     virtual QHash<QString, QVariant> config() const;
     virtual bool applyConfig(QHash<QString, QVariant> const & config);
 
+    // Receive time of the data which are being delivered by dataRead(),
+    // see Utils::monotonicTime(). Connections which only forward data
+    // of other ones do not stamp them, current time is returned then.
+    qint64 readTime() const;
+
 public slots:
     virtual void SendData(const QByteArray & /*data*/) {}
 
 protected:
+    // Emits dataRead(), time should be taken right after the data were read
+    void emitDataRead(const QByteArray& data, qint64 time);
+
     int m_programmer_type;
+
+private:
+    qint64 m_read_time;
 };
 
 template <typename T>
@@ -17,6 +17,7 @@
 
 #include "serialport.h"
 #include "../misc/config.h"
+#include "../misc/utils.h"
 #include "../WorkTab/WorkTabMgr.h"
 #include "../WorkTab/WorkTab.h"
 #include "../WorkTab/WorkTabInfo.h"
@@ -125,11 +126,13 @@ void SerialPort::readyRead()
     if(!isOpen())
         return;
 
+    const qint64 time = Utils::monotonicTime();
+
     lockMutex();
     QByteArray data = m_port->readAll();
     unlockMutex();
 
-    emit dataRead(data);
+    emitDataRead(data, time);
 }
 
 void SerialPort::openResult()
@@ -14,6 +14,7 @@
 
 #include "../common.h"
 #include "tcpsocket.h"
+#include "../misc/utils.h"
 #include "../WorkTab/WorkTabInfo.h"
 #include "../WorkTab/WorkTab.h"
 #include "../WorkTab/WorkTabMgr.h"
@@ -101,8 +102,9 @@ void TcpSocket::SendData(const QByteArray &data)
 
 void TcpSocket::readyRead()
 {
+    const qint64 time = Utils::monotonicTime();
     QByteArray data = m_socket->readAll();
-    emit dataRead(data);
+    emitDataRead(data, time);
 }
 
 void TcpSocket::stateChanged()
@@ -20,7 +20,7 @@
 
 UsbAcmConnection2::UsbAcmConnection2(yb::async_runner & runner)
     : PortConnection(CONNECTION_USB_ACM2), m_runner(runner), m_enumerated(false), m_vid(0), m_pid(0),
-    m_baudrate(115200), m_stop_bits(sb_one), m_parity(pp_none), m_data_bits(8)
+    m_baudrate(115200), m_stop_bits(sb_one), m_parity(pp_none), m_data_bits(8), m_readTime(-1)
 {
     connect(&m_incomingDataChannel, SIGNAL(dataReceived()), this, SLOT(incomingDataReady()));
     connect(&m_sendCompleted, SIGNAL(dataReceived()), this, SLOT(sendCompleted()));
@@ -236,7 +236,15 @@ void UsbAcmConnection2::doOpen()
 #else
         m_receive_worker = m_runner.post(yb::loop<size_t>(yb::async::value((size_t)0), [this, inep, inepsize](size_t r, yb::cancel_level cl) -> yb::task<size_t> {
             if (r > 0)
+            {
+                // Reads are merged in the channel, the chunk gets time of the first one
+                {
+                    QMutexLocker l(&m_readTimeMutex);
+                    if (m_readTime < 0)
+                        m_readTime = Utils::monotonicTime();
+                }
                 m_incomingDataChannel.send(m_read_buffers[0], m_read_buffers[0] + r);
+            }
             return cl >= yb::cl_quit? yb::nulltask: m_intf.device().bulk_read(inep, m_read_buffers[0], inepsize);
         }));
 #endif
@@ -314,7 +322,19 @@ void UsbAcmConnection2::incomingDataReady()
 {
     std::vector<uint8_t> data;
     m_incomingDataChannel.receive(data);
-    emit this->dataRead(QByteArray((char const *)data.data(), data.size()));
+
+    // Taken after the data, otherwise a read which comes in between
+    // would leave its time for the next chunk, while its data are here
+    qint64 time;
+    {
+        QMutexLocker l(&m_readTimeMutex);
+        time = m_readTime;
+        m_readTime = -1;
+    }
+    if (time < 0)
+        time = Utils::monotonicTime();
+
+    this->emitDataRead(QByteArray((char const *)data.data(), data.size()), time);
 }
 
 void UsbAcmConnection2::SendData(const QByteArray & data)
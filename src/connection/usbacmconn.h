@@ -130,6 +130,9 @@ private:
     void cleanupWorkers();
 
     ThreadChannel<uint8_t> m_incomingDataChannel;
+    // Time of the oldest read which is still in m_incomingDataChannel, -1 if none
+    QMutex m_readTimeMutex;
+    qint64 m_readTime;
     ThreadChannel<void> m_sendCompleted;
 };
 
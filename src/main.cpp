@@ -21,6 +21,7 @@
 #include "WorkTab/WorkTabMgr.h"
 #include "ui/settingsdialog.h"
 #include "misc/datafileparser.h"
+#include "LorrisAnalyzer/headlesscapture.h"
 
 // metatypes
 #include "ui/colorbutton.h"
@@ -45,6 +46,14 @@ static bool checkArgs(int argc, char** argv, QStringList& openFiles)
                 "Lorris, GUI tool for robotics - https://github.com/Tasssadar/Lorris\n\n"
                 "Command line argumens:\n"
                 "           --dump-cldta=FILE    Dump contents of *.cldta file and exit\n"
+                "           --capture=FILE       Capture analyzer packets to *.cldta file without GUI,\n"
+                "                                until interrupted. Requires --conn and --struct\n"
+                "           --conn=TYPE,KEY=VAL  Connection for --capture, TYPE is serial_port, tcp_client\n"
+                "                                or usb_yb_acm, keys are the same as in connection config,\n"
+                "                                e.g. serial_port,device_name=/dev/ttyUSB0,baud_rate=115200\n"
+                "           --struct=FILE        Analyzer data file with packet structure for --capture\n"
+                "           --rotate-size=MB     Start new file when the current one has MB megabytes\n"
+                "           --rotate-time=MIN    Start new file every MIN minutes\n"
                 "           --move-data          Move config.ini and sessions to user's documents folder"
                 "       -h, --help               Display this help and exit\n"
                 "       -v, --version            Display version info and exit\n",
@@ -126,6 +135,11 @@ int main(int argc, char *argv[])
     QCoreApplication::setOrganizationDomain("github.com/Tasssadar");
     QCoreApplication::setApplicationName("Lorris");
 
+    // Headless capture does not create any widgets
+    for(int i = 1; i < argc; ++i)
+        if(strstr(argv[i], "--capture=") == argv[i])
+            return HeadlessCapture::run(argc, argv);
+
     // Sort tab infos after they were added by static variables
     // Also adds handled filetypes, so must be before checkArgs
     sWorkTabMgr.SortTabInfos();
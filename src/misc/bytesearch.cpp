@@ -0,0 +1,186 @@
+/**********************************************
+**    This file is part of Lorris
+**    http://tasssadar.github.com/Lorris/
+**
+**    See README and COPYING
+***********************************************/
+
+#include <string.h>
+#include <algorithm>
+
+#include "bytesearch.h"
+#include "utils.h"
+
+#if defined(PROCESSOR_X86) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+  #define BYTESEARCH_SSE2
+  #include <emmintrin.h>
+#endif
+
+#if defined(BYTESEARCH_SSE2) && defined(__AVX2__)
+  #define BYTESEARCH_AVX2
+  #include <immintrin.h>
+#endif
+
+#ifdef _MSC_VER
+  #include <intrin.h>
+#endif
+
+static inline int lowestBit(quint32 mask)
+{
+#ifdef _MSC_VER
+    unsigned long res;
+    _BitScanForward(&res, mask);
+    return (int)res;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+ByteSearch::ByteSearch()
+{
+}
+
+void ByteSearch::setPattern(const char *pattern, int len)
+{
+    m_pattern.assign(pattern, pattern + len);
+}
+
+const char *ByteSearch::findByte(const char *itr, const char *end, char c)
+{
+#ifdef BYTESEARCH_AVX2
+    const __m256i needle32 = _mm256_set1_epi8(c);
+    for(; end - itr >= 32; itr += 32)
+    {
+        const __m256i block = _mm256_loadu_si256((const __m256i*)itr);
+        const quint32 mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, needle32));
+        if(mask)
+            return itr + lowestBit(mask);
+    }
+#endif
+
+#ifdef BYTESEARCH_SSE2
+    const __m128i needle = _mm_set1_epi8(c);
+    for(; end - itr >= 16; itr += 16)
+    {
+        const __m128i block = _mm_loadu_si128((const __m128i*)itr);
+        const quint32 mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, needle));
+        if(mask)
+            return itr + lowestBit(mask);
+    }
+#endif
+
+    if(itr == end)
+        return NULL;
+    return (const char*)memchr(itr, c, end - itr);
+}
+
+void ByteSearch::andEqual(const quint8 *col, quint32 len, quint8 value, quint8 *res)
+{
+    quint32 i = 0;
+
+#ifdef BYTESEARCH_AVX2
+    const __m256i needle32 = _mm256_set1_epi8(value);
+    const __m256i one32 = _mm256_set1_epi8(1);
+    for(; len - i >= 32; i += 32)
+    {
+        const __m256i c = _mm256_loadu_si256((const __m256i*)(col + i));
+        const __m256i r = _mm256_loadu_si256((const __m256i*)(res + i));
+        const __m256i eq = _mm256_and_si256(_mm256_cmpeq_epi8(c, needle32), one32);
+        _mm256_storeu_si256((__m256i*)(res + i), _mm256_and_si256(r, eq));
+    }
+#endif
+
+#ifdef BYTESEARCH_SSE2
+    const __m128i needle = _mm_set1_epi8(value);
+    const __m128i one = _mm_set1_epi8(1);
+    for(; len - i >= 16; i += 16)
+    {
+        const __m128i c = _mm_loadu_si128((const __m128i*)(col + i));
+        const __m128i r = _mm_loadu_si128((const __m128i*)(res + i));
+        const __m128i eq = _mm_and_si128(_mm_cmpeq_epi8(c, needle), one);
+        _mm_storeu_si128((__m128i*)(res + i), _mm_and_si128(r, eq));
+    }
+#endif
+
+    for(; i < len; ++i)
+        res[i] &= (col[i] == value);
+}
+
+const char *ByteSearch::findFull(const char *itr, const char *end) const
+{
+    const int len = m_pattern.size();
+    if(len == 0)
+        return itr;
+
+    if(end - itr < len)
+        return NULL;
+
+    const char * const pattern = &m_pattern[0];
+    if(len == 1)
+        return findByte(itr, end, pattern[0]);
+
+    // Last position where the pattern can start
+    const char * const last = end - len;
+
+#if defined(BYTESEARCH_AVX2)
+    const __m256i first32 = _mm256_set1_epi8(pattern[0]);
+    const __m256i back32 = _mm256_set1_epi8(pattern[len-1]);
+    for(; last - itr >= 32; itr += 32)
+    {
+        const __m256i a = _mm256_loadu_si256((const __m256i*)itr);
+        const __m256i b = _mm256_loadu_si256((const __m256i*)(itr + len - 1));
+        quint32 mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, first32),
+                                                             _mm256_cmpeq_epi8(b, back32)));
+        while(mask)
+        {
+            const char *c = itr + lowestBit(mask);
+            if(memcmp(c + 1, pattern + 1, len - 2) == 0)
+                return c;
+            mask &= mask - 1;
+        }
+    }
+#endif
+
+#if defined(BYTESEARCH_SSE2)
+    const __m128i first = _mm_set1_epi8(pattern[0]);
+    const __m128i back = _mm_set1_epi8(pattern[len-1]);
+    for(; last - itr >= 16; itr += 16)
+    {
+        const __m128i a = _mm_loadu_si128((const __m128i*)itr);
+        const __m128i b = _mm_loadu_si128((const __m128i*)(itr + len - 1));
+        quint32 mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first),
+                                                       _mm_cmpeq_epi8(b, back)));
+        while(mask)
+        {
+            const char *c = itr + lowestBit(mask);
+            if(memcmp(c + 1, pattern + 1, len - 2) == 0)
+                return c;
+            mask &= mask - 1;
+        }
+    }
+#endif
+
+    while(itr <= last)
+    {
+        itr = findByte(itr, last + 1, pattern[0]);
+        if(!itr)
+            return NULL;
+        if(memcmp(itr + 1, pattern + 1, len - 1) == 0)
+            return itr;
+        ++itr;
+    }
+    return NULL;
+}
+
+const char *ByteSearch::find(const char *itr, const char *end) const
+{
+    if(const char *res = findFull(itr, end))
+        return res;
+
+    // Pattern split between this and the next buffer
+    const int len = m_pattern.size();
+    for(int i = (std::min)(len - 1, int(end - itr)); i > 0; --i)
+        if(memcmp(end - i, &m_pattern[0], i) == 0)
+            return end - i;
+    return NULL;
+}
@@ -0,0 +1,45 @@
+/**********************************************
+**    This file is part of Lorris
+**    http://tasssadar.github.com/Lorris/
+**
+**    See README and COPYING
+***********************************************/
+
+#ifndef BYTESEARCH_H
+#define BYTESEARCH_H
+
+#include <vector>
+#include <QtGlobal>
+
+// Searches for byte pattern (e.g. packet's static header) in buffers.
+// The pattern is copied in setPattern, so find() does not allocate.
+// Uses SSE2 (or AVX2 when compiled with it) to compare first and last
+// byte of the pattern against whole blocks of the buffer, only candidates
+// are then compared with memcmp.
+class ByteSearch
+{
+public:
+    ByteSearch();
+
+    void setPattern(const char *pattern, int len);
+    int patternLength() const { return (int)m_pattern.size(); }
+
+    // Returns first position where whole pattern is, or where
+    // the end of buffer is the beginning of the pattern
+    // (the rest of the pattern might come in next buffer).
+    // Returns NULL if there is neither.
+    const char *find(const char *itr, const char *end) const;
+
+    // Only whole pattern, NULL if not found
+    const char *findFull(const char *itr, const char *end) const;
+
+    static const char *findByte(const char *itr, const char *end, char c);
+
+    // res[i] &= (col[i] == value) for i < len, res must contain only 0 or 1
+    static void andEqual(const quint8 *col, quint32 len, quint8 value, quint8 *res);
+
+private:
+    std::vector<char> m_pattern;
+};
+
+#endif // BYTESEARCH_H
@@ -37,6 +37,16 @@ static const QString keys_quint32[] =
     "shupito/spi_tunnel_speed",  // CFG_QUINT32_SPI_TUNNEL_SPEED
     "shupito/spi_tunnel_modes",  // CFG_QUINT32_SPI_TUNNEL_MODES
     "general/freeze_timeout",    // CFG_QUINT32_SCRIPT_FREEZE_TIMEOUT
+    "analyzer/hot_window",       // CFG_QUINT32_ANALYZER_HOT_WINDOW
+    "analyzer/display_rate",     // CFG_QUINT32_ANALYZER_DISPLAY_RATE
+    "analyzer/script_queue",     // CFG_QUINT32_SCRIPT_QUEUE_SIZE
+    "analyzer/script_policy",    // CFG_QUINT32_SCRIPT_QUEUE_POLICY
+    "analyzer/script_budget",    // CFG_QUINT32_SCRIPT_CPU_BUDGET
+    "general/compress_codec",    // CFG_QUINT32_COMPRESS_CODEC
+    "general/compress_level",    // CFG_QUINT32_COMPRESS_LEVEL
+    "analyzer/journal_sync",     // CFG_QUINT32_JOURNAL_SYNC
+    "terminal/log_rotate_size",  // CFG_QUINT32_TERMINAL_LOG_SIZE
+    "terminal/log_rotate_time",  // CFG_QUINT32_TERMINAL_LOG_TIME
 };
 
 static const quint32 def_quint32[] =
@@ -63,6 +73,16 @@ static const quint32 def_quint32[] =
     500000,                      // CFG_QUINT32_SPI_TUNNEL_SPEED
     0x200,                       // CFG_QUINT32_SPI_TUNNEL_MODES
     15000,                       // CFG_QUINT32_SCRIPT_FREEZE_TIMEOUT
+    256,                         // CFG_QUINT32_ANALYZER_HOT_WINDOW
+    60,                          // CFG_QUINT32_ANALYZER_DISPLAY_RATE
+    10000,                       // CFG_QUINT32_SCRIPT_QUEUE_SIZE
+    0,                           // CFG_QUINT32_SCRIPT_QUEUE_POLICY
+    50,                          // CFG_QUINT32_SCRIPT_CPU_BUDGET
+    1,                           // CFG_QUINT32_COMPRESS_CODEC, DATACODEC_ZSTD
+    0,                           // CFG_QUINT32_COMPRESS_LEVEL, codec's default
+    1000,                        // CFG_QUINT32_JOURNAL_SYNC
+    0,                           // CFG_QUINT32_TERMINAL_LOG_SIZE, MB, 0 is never
+    0,                           // CFG_QUINT32_TERMINAL_LOG_TIME, minutes, 0 is never
 };
 
 static const QString keys_string[] =
@@ -85,6 +105,7 @@ static const QString keys_string[] =
     "analyzer/script_wnd_params", // CFG_STRING_SCRIPT_WND_PARAMS
     "proxy/tunnel_name",          // CFG_STRING_PROXY_TUNNEL_NAME
     "shupito/avr109_bootseq",     // CFG_STRING_AVR109_BOOTSEQ
+    "terminal/logfile",           // CFG_STRING_TERMINAL_LOGFILE
 };
 
 static const QString def_string[] =
@@ -107,6 +128,7 @@ static const QString def_string[] =
     "",                           // CFG_STRING_SCRIPT_WND_PARAMS
     "Proxy tunnel",               // CFG_STRING_PROXY_TUNNEL_NAME
     "0x74 0x7E 0x7A 0x33",        // CFG_STRING_AVR109_BOOTSEQ
+    "",                           // CFG_STRING_TERMINAL_LOGFILE
 };
 
 static const QString keys_bool[] =
@@ -139,6 +161,9 @@ static const QString keys_bool[] =
     "general/enable_sounds",      // CFG_BOOL_ENABLE_SOUNDS
     "analyzer/enable_search",     // CFG_BOOL_ANALYZER_SEARCH_WIDGET
     "shupito/spi_tunnel_lsb",     // CFG_BOOL_SPI_TUNNEL_LSB_FIRST
+    "analyzer/journal",           // CFG_BOOL_ANALYZER_JOURNAL
+    "terminal/log_timestamps",    // CFG_BOOL_TERMINAL_LOG_TIMESTAMPS
+    "terminal/log_compress",      // CFG_BOOL_TERMINAL_LOG_COMPRESS
 };
 
 static const bool def_bool[] =
@@ -177,6 +202,9 @@ static const bool def_bool[] =
     true,                         // CFG_BOOL_ENABLE_SOUNDS
     true,                         // CFG_BOOL_ANALYZER_SEARCH_WIDGET
     false,                        // CFG_BOOL_SPI_TUNNEL_LSB_FIRST
+    true,                         // CFG_BOOL_ANALYZER_JOURNAL
+    false,                        // CFG_BOOL_TERMINAL_LOG_TIMESTAMPS
+    false,                        // CFG_BOOL_TERMINAL_LOG_COMPRESS
 };
 
 static const QString keys_variant[] =
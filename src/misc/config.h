@@ -38,6 +38,16 @@ enum cfg_quint32
     CFG_QUINT32_SPI_TUNNEL_SPEED,
     CFG_QUINT32_SPI_TUNNEL_MODES,
     CFG_QUINT32_SCRIPT_FREEZE_TIMEOUT,
+    CFG_QUINT32_ANALYZER_HOT_WINDOW,
+    CFG_QUINT32_ANALYZER_DISPLAY_RATE,
+    CFG_QUINT32_SCRIPT_QUEUE_SIZE,
+    CFG_QUINT32_SCRIPT_QUEUE_POLICY,
+    CFG_QUINT32_SCRIPT_CPU_BUDGET,
+    CFG_QUINT32_COMPRESS_CODEC,
+    CFG_QUINT32_COMPRESS_LEVEL,
+    CFG_QUINT32_JOURNAL_SYNC,
+    CFG_QUINT32_TERMINAL_LOG_SIZE,
+    CFG_QUINT32_TERMINAL_LOG_TIME,
 
     CFG_QUINT32_NUM
 };
@@ -62,6 +72,7 @@ enum cfg_string
     CFG_STRING_SCRIPT_WND_PARAMS,
     CFG_STRING_PROXY_TUNNEL_NAME,
     CFG_STRING_AVR109_BOOTSEQ,
+    CFG_STRING_TERMINAL_LOGFILE,
 
     CFG_STRING_NUM
 };
@@ -96,6 +107,9 @@ enum cfg_bool
     CFG_BOOL_ENABLE_SOUNDS,
     CFG_BOOL_ANALYZER_SEARCH_WIDGET,
     CFG_BOOL_SPI_TUNNEL_LSB_FIRST,
+    CFG_BOOL_ANALYZER_JOURNAL,
+    CFG_BOOL_TERMINAL_LOG_TIMESTAMPS,
+    CFG_BOOL_TERMINAL_LOG_COMPRESS,
 
     CFG_BOOL_NUM
 };
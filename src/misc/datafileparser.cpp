@@ -5,15 +5,22 @@
 **    See README and COPYING
 ***********************************************/
 
+#include <algorithm>
+#include <limits.h>
+#include <QtEndian>
 #include <QScopedPointer>
 #include <QCryptographicHash>
 #include <QMessageBox>
 #include <QEventLoop>
 #include <QtConcurrentRun>
+#include <QtConcurrentMap>
+#include <QThreadPool>
 #include <QTimer>
 #include <QApplication>
 #include <QDesktopWidget>
 #include <QString>
+#include <zstd.h>
+#include <zlib.h>
 
 #include "datafileparser.h"
 #include "config.h"
@@ -22,6 +29,107 @@
 #include "../revision.h"
 
 #define MD5(x) QCryptographicHash::hash(x, QCryptographicHash::Md5)
+#define MD5_READ_CHUNK (1024*1024)
+// Number of decompressed blocks DataFilePackets keeps
+#define PACKET_CACHE_BLOCKS 32
+// Newest DataFileHeader::version this build can read
+#define DATAFILE_MAX_VERSION 3
+
+// One block of compressed file, decompressed directly
+// to its place in the result by uncompressBlock()
+struct UncompressJob
+{
+    const uchar *src;
+    quint32 size;
+    char *dst;
+    quint32 dst_size;  // from block's header
+    quint8 codec;
+    bool ok;
+};
+
+static void uncompressBlock(UncompressJob& job)
+{
+    if(job.dst_size == 0)
+    {
+        job.ok = true;
+        return;
+    }
+
+    job.ok = DataFileBuilder::uncompress(job.src, job.size, job.codec, job.dst, job.dst_size);
+}
+
+// Compressed data are blocks of (compressed data, quint32 size),
+// followed by quint32 block count. Allocates result and prepares
+// a job for each block, throws QString if the data are corrupted.
+static void locateBlocks(const QByteArray& data, quint8 codec, QByteArray& result, std::vector<UncompressJob>& jobs)
+{
+    const uchar *begin = (const uchar*)data.constData();
+    const uchar *end = begin + data.size();
+
+    quint32 count = 0;
+    if(end - begin < (qint64)sizeof(count))
+        throw QObject::tr("Corrupted data file");
+    end -= sizeof(count);
+    memcpy(&count, end, sizeof(count));
+
+    if(count > quint32(end - begin)/sizeof(quint32))
+        throw QObject::tr("Corrupted data file");
+    jobs.resize(count);
+
+    // Blocks are found from the end
+    quint64 total = 0;
+    for(quint32 i = count; i > 0; --i)
+    {
+        quint32 size = 0;
+        if(end - begin < (qint64)sizeof(size))
+            throw QObject::tr("Corrupted data file");
+        end -= sizeof(size);
+        memcpy(&size, end, sizeof(size));
+
+        if((qint64)size > end - begin)
+            throw QObject::tr("Corrupted data file");
+        end -= size;
+
+        UncompressJob& job = jobs[i-1];
+        job.src = end;
+        job.size = size;
+        job.codec = codec;
+        job.dst_size = size >= 4 ? qFromBigEndian<quint32>(end) : 0;
+        job.ok = false;
+        total += job.dst_size;
+    }
+
+    if(total > INT_MAX)
+        throw QObject::tr("Data file is too big to be loaded");
+
+    result.resize(total);
+    char *dst = result.data();
+    for(quint32 i = 0; i < count; ++i)
+    {
+        jobs[i].dst = dst;
+        dst += jobs[i].dst_size;
+    }
+}
+
+// Waits for the future while GUI events are processed
+template <typename T>
+static void waitForFuture(const QFuture<T>& future)
+{
+    QFutureWatcher<T> watcher;
+    QEventLoop ev;
+    QObject::connect(&watcher, SIGNAL(finished()), &ev, SLOT(quit()));
+    watcher.setFuture(future);
+    if(!watcher.isFinished())
+        ev.exec();
+}
+
+static QByteArray hashData(const QByteArray& data, const QByteArray& index)
+{
+    QCryptographicHash hash(QCryptographicHash::Md5);
+    hash.addData(data);
+    hash.addData(index);
+    return hash.result();
+}
 
 static const char *blockNames[] = {
     "staticDataBlock",     // BLOCK_STATIC_DATA
@@ -52,6 +160,8 @@ DataFileHeader::DataFileHeader(quint8 data_type)
     header_size = 64;
     compressed_block = UINT_MAX;
     lorris_rev = REVISION;
+    codec = DATACODEC_ZLIB;
+    codec_level = -1;
 
     memset(&unused[0], 0xFF, sizeof(unused));
 }
@@ -339,9 +449,6 @@ DataFileParser& DataFileParser::operator >>(QColor& color)
     return *this;
 }
 
-QFuture<QByteArray> DataFileBuilder::m_future;
-QFutureWatcher<QByteArray> *DataFileBuilder::m_watcher = NULL;
-
 QByteArray DataFileBuilder::readAndCheck(QFile &file, DataFileTypes expectedType, bool *legacy, DataFileHeader *fillHeader)
 {
     if(!file.isOpen() && !file.open(QIODevice::ReadOnly))
@@ -365,9 +472,15 @@ QByteArray DataFileBuilder::readAndCheck(QFile &file, DataFileTypes expectedType
         header.reset(new DataFileHeader);
         readHeader(file, header.data());
 
+        if(header->version > DATAFILE_MAX_VERSION)
+            throw QObject::tr("This file has unknown format version (%1), it was probably created by newer version of Lorris").arg(header->version);
+
         if(expectedType != DATAFILE_NONE && header->data_type != expectedType)
             throw QObject::tr("This file is not of expected content type");
 
+        if((header->flags & DATAFLAG_COMPRESSED) && !isCodecSupported(header->codec))
+            throw QObject::tr("This file is compressed by unknown codec (%1), it was probably created by newer version of Lorris").arg(header->codec);
+
         compressed = (header->flags & DATAFLAG_COMPRESSED);
 
         if(fillHeader)
@@ -377,11 +490,39 @@ QByteArray DataFileBuilder::readAndCheck(QFile &file, DataFileTypes expectedType
     if(legacy)
         *legacy = header.isNull();
 
-    QByteArray data = file.read(file.size());
+    // Packet blocks are not read, they are loaded by DataFilePackets
+    QByteArray data, index;
+    if(header && (header->flags & DATAFLAG_PACKET_INDEX))
+    {
+        DataFileIndexTrailer trailer;
+        if(!readTrailer(file, *header, trailer))
+            throw QObject::tr("Corrupted data file");
 
-    if(header && QByteArray::fromRawData(header->md5, sizeof(header->md5)) != MD5(data))
+        data = file.read(trailer.document_end - header->header_size);
+        file.seek(trailer.index_offset);
+        index = file.read(file.size() - trailer.index_offset);
+    }
+    else
+        data = file.read(file.size());
+
+    // MD5 is computed while compressed blocks are decoded. Block boundaries
+    // are found first, then blocks are decompressed in parallel, each
+    // one right to its place in the result.
+    QFuture<QByteArray> md5 = QtConcurrent::run(hashData, data, index);
+
+    const bool blocks = compressed && header && (header->flags & DATAFLAG_COMPRESSED);
+    QByteArray result;
+    std::vector<UncompressJob> jobs;
+    QFuture<void> decode;
+    if(blocks)
     {
-        if(qApp)
+        locateBlocks(data, header->codec, result, jobs);
+        decode = QtConcurrent::map(jobs, uncompressBlock);
+    }
+
+    if(header && QByteArray::fromRawData(header->md5, sizeof(header->md5)) != md5.result())
+    {
+        if(qobject_cast<QApplication*>(qApp))
         {
             QMessageBox box(QMessageBox::Question, QObject::tr("Error"),
                         QObject::tr("Corrupted data file - MD5 checksum does not match"),
@@ -389,41 +530,27 @@ QByteArray DataFileBuilder::readAndCheck(QFile &file, DataFileTypes expectedType
             box.setInformativeText(QObject::tr("Load anyway?"));
 
             if(box.exec() == QMessageBox::No)
+            {
+                decode.cancel();
+                decode.waitForFinished();
                 throw QObject::tr("Corrupted data file - MD5 checksum does not match");
+            }
         }
         else
             printf("MD5 checksums do not match!\n");
     }
 
 
-    if(compressed && header && (header->flags & DATAFLAG_COMPRESSED))
+    if(blocks)
     {
-        char *end = data.data() + data.size();
-        quint32 blocks = *( (quint32*) (end-sizeof(quint32)) );
-        data.chop(sizeof(blocks));
-        end = data.data() + data.size();
-
-        std::vector<QByteArray> uncompressed(blocks);
-        quint32 resSize = 0;
-        for(quint32 i = 0; i < blocks; ++i)
-        {
-            end -= sizeof(quint32);
-            quint32 size = *((quint32*)end);
-
-            uncompressed[i] = qUncompress((const uchar*)(end-size), size);
-            resSize += uncompressed[i].size();
+        decode.waitForFinished();
+        data.clear();
 
-            data.chop(size + sizeof(quint32));
-            end = data.data() + data.size();
-        }
+        for(size_t i = 0; i < jobs.size(); ++i)
+            if(!jobs[i].ok)
+                throw QObject::tr("Corrupted data file - block %1 can't be decompressed").arg(i);
 
-        data.clear();
-        data.reserve(resSize);
-        while(!uncompressed.empty())
-        {
-            data.append(uncompressed.back());
-            uncompressed.pop_back();
-        }
+        data.swap(result);
     }
     else if(compressed) // Obsolete
         data = qUncompress(data);
@@ -433,88 +560,116 @@ QByteArray DataFileBuilder::readAndCheck(QFile &file, DataFileTypes expectedType
 
 QByteArray DataFileBuilder::writeWithHeader(const QString& filename, QByteArray &data, bool compress, DataFileTypes type)
 {
-    QFile testFile(filename);
-    if(!testFile.open(QIODevice::WriteOnly | QIODevice::Truncate))
-        throw QObject::tr("Cannot open file \"%1\"!").arg(filename);
-    testFile.close();
+    DataFileWriter writer(filename, compress, type);
+    writer.write(data);
+    data.clear();
+    return writer.finish();
+}
 
-    // wait for last save to finish
-    if(m_watcher)
-        throw QObject::tr("Another file is currently saving!");
+QByteArray DataFileBuilder::fileChecksum(QFile& file)
+{
+    DataFileHeader header;
+    bool hasHeader = false;
+    if(file.size() >= (qint64)sizeof(DataFileHeader))
+    {
+        file.seek(0);
+        file.read((char*)header.str, sizeof(DataFileHeader));
+        hasHeader = (strncmp(header.str, "LDTA", 4) == 0);
+        if(hasHeader && (header.flags & DATAFLAG_PACKET_INDEX))
+            return QByteArray(header.md5, sizeof(header.md5));
+    }
 
-    m_watcher = new QFutureWatcher<QByteArray>();
-    QEventLoop ev;
-    QObject::connect(m_watcher, SIGNAL(finished()), &ev, SLOT(quit()));
+    QCryptographicHash hash(QCryptographicHash::Md5);
 
-    m_future = QtConcurrent::run(&DataFileBuilder::writeWithHeader_private, filename, data, compress, type);
-    m_watcher->setFuture(m_future);
+    file.seek(hasHeader ? sizeof(DataFileHeader) : 0);
+    QByteArray buff;
+    while(!(buff = file.read(MD5_READ_CHUNK)).isEmpty())
+        hash.addData(buff);
 
-    ProgressReporter reporter;
-    ev.exec();
+    if(!hasHeader)
+        return hash.result();
+    return headerChecksum(header, hash.result());
+}
 
-    QByteArray res = m_watcher->result();
-    delete m_watcher;
-    m_watcher = NULL;
-    return res;
+QByteArray DataFileBuilder::headerChecksum(const DataFileHeader& header, const QByteArray& dataMd5)
+{
+    QCryptographicHash hash(QCryptographicHash::Md5);
+    hash.addData(header.str, sizeof(DataFileHeader));
+    hash.addData(dataMd5);
+    return hash.result();
 }
 
-QByteArray DataFileBuilder::writeWithHeader_private(const QString& filename, QByteArray& data, bool compress, DataFileTypes type)
+QByteArray DataFileBuilder::compress(const QByteArray& data, quint8 codec, qint8 level)
 {
-    QFile file(filename);
-    if(!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
-        return QByteArray();
+    if(codec != DATACODEC_ZSTD)
+        return qCompress(data, level < 0 ? -1 : (std::min)((int)level, 9));
 
-    DataFileHeader header(type);
-    if(compress)
-    {
-        header.flags |= DATAFLAG_COMPRESSED;
-        header.compressed_block = sConfig.get(CFG_QUINT32_COMPRESS_BLOCK);
+    const size_t bound = ZSTD_compressBound(data.size());
+    QByteArray res;
+    res.resize(sizeof(quint32) + bound);
+    qToBigEndian<quint32>(data.size(), (uchar*)res.data());
 
-        std::vector<QByteArray> compressed(data.size()/header.compressed_block + 1);
+    const size_t len = ZSTD_compress(res.data() + sizeof(quint32), bound, data.constData(), data.size(),
+                                     level < 0 ? ZSTD_CLEVEL_DEFAULT : level);
+    if(ZSTD_isError(len))
+        return QByteArray();
 
-        quint32 chunk = (std::min)(header.compressed_block, (quint32)data.size());
-        char *end = data.data() + data.size();
-        quint32 size = 0;
-        for(quint32 i = 0; !data.isEmpty(); ++i)
-        {
-            compressed[i] = qCompress((const uchar*)(end-chunk), chunk);
-            data.chop(chunk);
-            data.squeeze();
+    res.resize(sizeof(quint32) + len);
+    return res;
+}
 
-            size += compressed[i].size() + 4;
+QByteArray DataFileBuilder::uncompress(const uchar *data, quint32 len, quint8 codec)
+{
+    if(codec != DATACODEC_ZSTD)
+        return qUncompress(data, len);
 
-            chunk = (std::min)(header.compressed_block, (quint32)data.size());
-            end = data.data() + data.size();
-        }
+    if(len < sizeof(quint32))
+        return QByteArray();
 
-        data.reserve(size + 4);
-        quint32 blocks = compressed.size();
-        while(!compressed.empty())
-        {
-            const QByteArray& ar = compressed.back();
-            data.append(ar);
+    const quint32 size = qFromBigEndian<quint32>(data);
+    QByteArray res;
+    res.resize(size);
+    if(!uncompress(data, len, codec, res.data(), size))
+        return QByteArray();
+    return res;
+}
 
-            size = ar.size();
-            data.append((char*)&size, sizeof(size));
+bool DataFileBuilder::uncompress(const uchar *data, quint32 len, quint8 codec, char *dst, quint32 dst_size)
+{
+    if(len < sizeof(quint32) || qFromBigEndian<quint32>(data) != dst_size)
+        return false;
 
-            compressed.pop_back();
-        }
-        data.append((char*)&blocks, sizeof(blocks));
+    // qCompress() data are zlib stream after the size
+    if(codec != DATACODEC_ZSTD)
+    {
+        uLongf res = dst_size;
+        return ::uncompress((Bytef*)dst, &res, data + sizeof(quint32), len - sizeof(quint32)) == Z_OK &&
+               res == dst_size;
     }
 
-    QByteArray md5 = MD5(data);
-    std::copy(md5.data(), md5.data()+sizeof(header.md5), header.md5);
+    const size_t res = ZSTD_decompress(dst, dst_size, data + sizeof(quint32), len - sizeof(quint32));
+    return !ZSTD_isError(res) && res == dst_size;
+}
 
-    {
-        QBuffer buff;
-        buff.open(QIODevice::WriteOnly);
-        writeHeader(buff, &header);
-        data.prepend(buff.data());
-    }
+bool DataFileBuilder::readTrailer(QFile& file, const DataFileHeader& header, DataFileIndexTrailer& trailer)
+{
+    // Trailer is followed by zero block count for older readers
+    const qint64 size = file.size() - sizeof(quint32);
+    if(size < header.header_size + (qint64)sizeof(DataFileIndexTrailer))
+        return false;
 
-    file.write(data);
-    data = MD5(data);
-    return data;
+    quint32 blocks = UINT_MAX;
+    const qint64 pos = file.pos();
+    file.seek(size - sizeof(DataFileIndexTrailer));
+    const bool read = file.read((char*)&trailer, sizeof(DataFileIndexTrailer)) == sizeof(DataFileIndexTrailer) &&
+                      file.read((char*)&blocks, sizeof(blocks)) == sizeof(blocks);
+    file.seek(pos);
+
+    return read && blocks == 0 && strncmp(trailer.str, "LIDX", 4) == 0 &&
+           trailer.document_end >= header.header_size &&
+           trailer.document_end <= trailer.index_offset &&
+           trailer.index_offset + quint64(trailer.block_count)*sizeof(DataFileBlockEntry) +
+                sizeof(DataFileIndexTrailer) == (quint64)size;
 }
 
 void DataFileBuilder::readHeader(QFile &file, DataFileHeader *header)
@@ -549,6 +704,18 @@ void DataFileBuilder::dumpFileInfo(const QString& filename)
         if(legacy) printf("This file does not have header\n");
         else       dumpHeader(header);
 
+        DataFileIndexTrailer trailer;
+        if(!legacy && (header.flags & DATAFLAG_PACKET_INDEX) && f.open(QIODevice::ReadOnly) &&
+           readTrailer(f, header, trailer))
+        {
+            printf("\nPacket index:\n");
+            printf("    document_end: 0x%llX\n", (unsigned long long)trailer.document_end);
+            printf("    index_offset: 0x%llX\n", (unsigned long long)trailer.index_offset);
+            printf("     block_count: %u\n", trailer.block_count);
+            printf("    packet_count: %u\n", trailer.packet_count);
+            f.close();
+        }
+
         printf("\nData blocks:\n");
         int cur = 0;
         char *st, *itr;
@@ -583,6 +750,10 @@ void DataFileBuilder::dumpHeader(const DataFileHeader& header)
             flags += "DATAFLAG_COMPRESSED_OBSOLETE ";
         if(header.flags & DATAFLAG_COMPRESSED)
             flags += "DATAFLAG_COMPRESSED ";
+        if(header.flags & DATAFLAG_PACKET_INDEX)
+            flags += "DATAFLAG_PACKET_INDEX ";
+        if(header.flags & DATAFLAG_PACKET_TIMES)
+            flags += "DATAFLAG_PACKET_TIMES ";
     } else flags = "none ";
 
     QString type;
@@ -604,6 +775,457 @@ void DataFileBuilder::dumpHeader(const DataFileHeader& header)
     printf("     header_size: %u\n", header.header_size);
     printf("compressed_block: %u (%.1f MB)\n", header.compressed_block, float(header.compressed_block)/1024/1024);
     printf("      lorris_rev: %u\n", header.lorris_rev);
+
+    if(header.flags & DATAFLAG_COMPRESSED)
+    {
+        QString codec;
+        switch(header.codec)
+        {
+            case DATACODEC_ZLIB: codec = "DATACODEC_ZLIB"; break;
+            case DATACODEC_ZSTD: codec = "DATACODEC_ZSTD"; break;
+            default:             codec = "UNKNOWN"; break;
+        }
+        printf("           codec: 0x%02X (%s)\n", header.codec, codec.toStdString().c_str());
+        printf("     codec_level: %d%s\n", header.codec_level, header.codec_level == -1 ? " (default)" : "");
+    }
+}
+
+bool DataFileWriter::m_saving = false;
+
+DataFileWriter::DataFileWriter(const QString& filename, bool compress, DataFileTypes type) :
+    m_file(filename), m_header(type), m_hash(QCryptographicHash::Md5)
+{
+    // wait for last save to finish
+    if(m_saving)
+        throw QObject::tr("Another file is currently saving!");
+
+    if(!m_file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        throw QObject::tr("Cannot open file \"%1\"!").arg(filename);
+
+    m_saving = true;
+    m_writing = false;
+    m_blocks = 0;
+    memset(&m_trailer, 0, sizeof(m_trailer));
+    memcpy(m_trailer.str, "LIDX", 4);
+    // enough blocks to keep all threads busy while the oldest one is written
+    m_max_jobs = QThreadPool::globalInstance()->maxThreadCount() + 1;
+    // Headless capture has no GUI to report to
+    m_reporter = qobject_cast<QApplication*>(qApp) ? new ProgressReporter() : NULL;
+
+    if(compress)
+    {
+        m_header.flags |= DATAFLAG_COMPRESSED;
+        m_header.compressed_block = (std::max)(1u, sConfig.get(CFG_QUINT32_COMPRESS_BLOCK));
+
+        const quint32 level = sConfig.get(CFG_QUINT32_COMPRESS_LEVEL);
+        m_header.codec = sConfig.get(CFG_QUINT32_COMPRESS_CODEC) == DATACODEC_ZSTD ? DATACODEC_ZSTD : DATACODEC_ZLIB;
+        m_header.codec_level = level == 0 ? -1 : (qint8)(std::min)(level, 19u);
+    }
+
+    // md5 is filled in finish()
+    DataFileBuilder::writeHeader(m_file, &m_header);
+}
+
+DataFileWriter::~DataFileWriter()
+{
+    // Jobs have their own copy of the data, they can just finish
+    m_jobs.clear();
+    if(m_writing)
+        m_write.waitForFinished();
+    delete m_reporter;
+    m_saving = false;
+}
+
+void DataFileWriter::write(const QByteArray& data)
+{
+    Q_ASSERT(m_trailer.document_end == 0);
+
+    if(!isCompressed())
+        return writeAsync(data);
+
+    const quint32 block = m_header.compressed_block;
+    if(m_pending.isEmpty() && (quint32)data.size() == block)
+        return startJob(data, -1);
+
+    m_pending.append(data);
+    if((quint32)m_pending.size() < block)
+        return;
+
+    quint32 pos = 0;
+    for(; m_pending.size() - pos >= block; pos += block)
+        startJob(m_pending.mid(pos, block), -1);
+    m_pending = m_pending.mid(pos);
+}
+
+void DataFileWriter::beginPackets(bool times)
+{
+    Q_ASSERT(isCompressed() && m_trailer.document_end == 0);
+
+    if(!m_pending.isEmpty())
+    {
+        startJob(m_pending, -1);
+        m_pending.clear();
+    }
+    writeBlocks(0);
+    writeRaw((char*)&m_blocks, sizeof(m_blocks));
+
+    m_header.version = 3;
+    m_header.flags |= DATAFLAG_PACKET_INDEX;
+    if(times)
+        m_header.flags |= DATAFLAG_PACKET_TIMES;
+    m_trailer.document_end = m_file.pos();
+}
+
+void DataFileWriter::appendPacketTimes(QByteArray& block, const qint64 *times, quint32 count)
+{
+    if(count == 0)
+        return;
+
+    block.append((const char*)&times[0], sizeof(qint64));
+    for(quint32 i = 1; i < count; ++i)
+    {
+        const qint64 diff = times[i] - times[i-1];
+        quint64 val = (quint64(diff) << 1) ^ quint64(diff >> 63);
+        for(; val >= 0x80; val >>= 7)
+            block.append(char(val | 0x80));
+        block.append(char(val));
+    }
+}
+
+void DataFileWriter::writePacketBlock(const QByteArray& data, quint32 count)
+{
+    Q_ASSERT(m_trailer.document_end != 0);
+
+    DataFileBlockEntry entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.first = m_trailer.packet_count;
+    entry.count = count;
+    entry.size = data.size();
+
+    m_index.push_back(entry);
+    m_trailer.packet_count += count;
+
+    startJob(data, m_index.size()-1);
+}
+
+QByteArray DataFileWriter::finish()
+{
+    if(m_trailer.document_end != 0)
+    {
+        writeBlocks(0);
+
+        m_trailer.index_offset = m_file.pos();
+        m_trailer.block_count = m_index.size();
+        if(!m_index.empty())
+            writeRaw((char*)&m_index[0], m_index.size()*sizeof(DataFileBlockEntry));
+        writeRaw((char*)&m_trailer, sizeof(m_trailer));
+
+        const quint32 blocks = 0;
+        writeRaw((char*)&blocks, sizeof(blocks));
+    }
+    else if(isCompressed())
+    {
+        if(!m_pending.isEmpty())
+        {
+            startJob(m_pending, -1);
+            m_pending.clear();
+        }
+        writeBlocks(0);
+        writeRaw((char*)&m_blocks, sizeof(m_blocks));
+    }
+    else
+        waitForWrite();
+
+    QByteArray md5 = m_hash.result();
+    std::copy(md5.data(), md5.data()+sizeof(m_header.md5), m_header.md5);
+    DataFileBuilder::writeHeader(m_file, &m_header);
+    m_file.close();
+
+    // Same as DataFileBuilder::fileChecksum(), m_hash covers everything after the header
+    if(m_header.flags & DATAFLAG_PACKET_INDEX)
+        return md5;
+    return DataFileBuilder::headerChecksum(m_header, md5);
+}
+
+void DataFileWriter::writeRaw(const char *data, qint64 len, bool hash)
+{
+    if(m_file.write(data, len) != len)
+        throw QObject::tr("Cannot write to file \"%1\"!").arg(m_file.fileName());
+    if(hash)
+        m_hash.addData(data, len);
+}
+
+void DataFileWriter::writeAsync(const QByteArray& data)
+{
+    waitForWrite();
+    m_write = QtConcurrent::run(this, &DataFileWriter::writePart, data);
+    m_writing = true;
+}
+
+// Runs in QtConcurrent, exceptions can't be thrown from there
+bool DataFileWriter::writePart(const QByteArray& data)
+{
+    if(m_file.write(data) != data.size())
+        return false;
+    m_hash.addData(data);
+    return true;
+}
+
+void DataFileWriter::waitForWrite()
+{
+    if(!m_writing)
+        return;
+
+    m_writing = false;
+    waitForFuture(m_write);
+    if(!m_write.result())
+        throw QObject::tr("Cannot write to file \"%1\"!").arg(m_file.fileName());
+}
+
+void DataFileWriter::startJob(const QByteArray& data, qint32 entry)
+{
+    Job job;
+    job.future = QtConcurrent::run(&DataFileBuilder::compress, data, m_header.codec, m_header.codec_level);
+    job.entry = entry;
+    m_jobs.push_back(job);
+
+    writeBlocks(m_max_jobs);
+}
+
+// Writes finished blocks, waits until at most keep blocks are being compressed
+void DataFileWriter::writeBlocks(size_t keep)
+{
+    while(!m_jobs.empty() && (m_jobs.size() > keep || m_jobs.front().future.isFinished()))
+    {
+        if(!m_jobs.front().future.isFinished())
+            waitForFuture(m_jobs.front().future);
+
+        const QByteArray block = m_jobs.front().future.result();
+        const qint32 entry = m_jobs.front().entry;
+        m_jobs.pop_front();
+
+        if(block.isEmpty())
+            throw QObject::tr("Failed to compress data!");
+
+        const quint32 size = block.size();
+        if(entry == -1)
+        {
+            writeRaw(block.data(), size);
+            writeRaw((char*)&size, sizeof(size));
+            ++m_blocks;
+        }
+        else
+        {
+            // Packet blocks are checked by the index, not by header's md5
+            DataFileBlockEntry& e = m_index[entry];
+            e.offset = m_file.pos();
+            e.compressed_size = size;
+
+            QByteArray md5 = MD5(block);
+            std::copy(md5.data(), md5.data()+sizeof(e.md5), e.md5);
+
+            writeRaw(block.data(), size, false);
+        }
+    }
+}
+
+DataFilePackets::DataFilePackets(const QString& filename) : m_filename(filename), m_file(filename)
+{
+    m_count = 0;
+    m_codec = DATACODEC_ZLIB;
+    m_times = false;
+
+    if(!m_file.open(QIODevice::ReadOnly))
+        throw QObject::tr("Cannot open file \"%1\"!").arg(filename);
+
+    DataFileHeader header;
+    DataFileIndexTrailer trailer;
+    if(m_file.read((char*)header.str, sizeof(DataFileHeader)) != sizeof(DataFileHeader) ||
+       header.version > DATAFILE_MAX_VERSION || !(header.flags & DATAFLAG_PACKET_INDEX) ||
+       !DataFileBuilder::readTrailer(m_file, header, trailer))
+    {
+        throw QObject::tr("Corrupted data file");
+    }
+
+    if(!DataFileBuilder::isCodecSupported(header.codec))
+        throw QObject::tr("This file is compressed by unknown codec (%1), it was probably created by newer version of Lorris").arg(header.codec);
+    m_codec = header.codec;
+    m_times = (header.flags & DATAFLAG_PACKET_TIMES);
+
+    m_file.seek(trailer.index_offset);
+    m_blocks.resize(trailer.block_count);
+    for(quint32 i = 0; i < trailer.block_count; ++i)
+    {
+        DataFileBlockEntry& e = m_blocks[i].entry;
+        if(m_file.read((char*)&e, sizeof(e)) != sizeof(e) || e.first != m_count ||
+           e.offset + e.compressed_size > trailer.index_offset)
+        {
+            throw QObject::tr("Corrupted data file");
+        }
+        m_count += e.count;
+    }
+}
+
+QByteArray DataFilePackets::get(quint32 idx)
+{
+    Block& b = load(idx);
+    idx -= b.entry.first;
+    if(b.offsets.empty())
+        return QByteArray();
+    return b.data.mid(b.offsets[idx] + sizeof(quint32), b.offsets[idx+1] - b.offsets[idx] - sizeof(quint32));
+}
+
+qint64 DataFilePackets::getTime(quint32 idx)
+{
+    Block& b = load(idx);
+    if(b.times.empty())
+        return 0;
+    return b.times[idx - b.entry.first];
+}
+
+void DataFilePackets::getRange(quint32 first, quint32 count, const char **data, quint32 *sizes,
+                               std::vector<QByteArray>& keep)
+{
+    for(quint32 i = 0; i < count;)
+    {
+        Block& b = load(first + i);
+        keep.push_back(b.data);
+
+        const quint32 end = (std::min)(b.entry.first + b.entry.count, first + count);
+        for(quint32 idx = first + i - b.entry.first; i < end - first; ++i, ++idx)
+        {
+            if(b.offsets.empty())
+            {
+                data[i] = NULL;
+                sizes[i] = 0;
+                continue;
+            }
+            data[i] = b.data.constData() + b.offsets[idx] + sizeof(quint32);
+            sizes[i] = b.offsets[idx+1] - b.offsets[idx] - sizeof(quint32);
+        }
+    }
+}
+
+DataFilePackets::Block& DataFilePackets::load(quint32 packetIdx)
+{
+    Q_ASSERT(packetIdx < m_count);
+
+    // block with the last first <= packetIdx
+    quint32 lo = 0, hi = m_blocks.size();
+    while(hi - lo > 1)
+    {
+        const quint32 mid = (lo + hi)/2;
+        if(m_blocks[mid].entry.first <= packetIdx)
+            lo = mid;
+        else
+            hi = mid;
+    }
+
+    std::vector<quint32>::iterator itr = std::find(m_lru.begin(), m_lru.end(), lo);
+    if(itr != m_lru.end())
+    {
+        m_lru.erase(itr);
+        m_lru.push_back(lo);
+        return m_blocks[lo];
+    }
+
+    if(m_lru.size() >= PACKET_CACHE_BLOCKS)
+    {
+        Block& old = m_blocks[m_lru.front()];
+        old.data.clear();
+        old.offsets.clear();
+        old.times.clear();
+        m_lru.erase(m_lru.begin());
+    }
+
+    decode(m_blocks[lo]);
+    m_lru.push_back(lo);
+    return m_blocks[lo];
+}
+
+void DataFilePackets::decode(Block& block)
+{
+    const DataFileBlockEntry& e = block.entry;
+
+    QByteArray compressed;
+    if(m_file.seek(e.offset))
+        compressed = m_file.read(e.compressed_size);
+
+    if((quint32)compressed.size() != e.compressed_size ||
+       MD5(compressed) != QByteArray::fromRawData(e.md5, sizeof(e.md5)))
+    {
+        qWarning("Data file %s: block at 0x%llX is corrupted, its packets will be empty",
+                 m_filename.toLocal8Bit().constData(), (unsigned long long)e.offset);
+        return;
+    }
+
+    block.data = DataFileBuilder::uncompress((const uchar*)compressed.constData(), compressed.size(), m_codec);
+
+    // Offsets of packets, a block which does not contain count
+    // whole packets is handled as corrupted
+    const quint32 size = block.data.size();
+    block.offsets.resize(e.count + 1);
+    quint32 pos = 0;
+    quint32 i = 0;
+    for(; i < e.count && size - pos >= sizeof(quint32); ++i)
+    {
+        quint32 len = 0;
+        memcpy(&len, block.data.constData() + pos, sizeof(quint32));
+        if(size - pos - sizeof(quint32) < len)
+            break;
+
+        block.offsets[i] = pos;
+        pos += sizeof(quint32) + len;
+    }
+    block.offsets[e.count] = pos;
+
+    if(i == e.count && m_times)
+        pos = decodeTimes(block, pos);
+
+    if(i != e.count || pos != size || size != e.size)
+    {
+        qWarning("Data file %s: block at 0x%llX is corrupted, its packets will be empty",
+                 m_filename.toLocal8Bit().constData(), (unsigned long long)e.offset);
+        block.data.clear();
+        block.offsets.clear();
+        block.times.clear();
+    }
+}
+
+// Returns position after the times, UINT_MAX if they are damaged,
+// see DataFileWriter::appendPacketTimes()
+quint32 DataFilePackets::decodeTimes(Block& block, quint32 pos)
+{
+    const quint32 count = block.entry.count;
+    if(count == 0)
+        return pos;
+
+    const uchar *itr = (const uchar*)block.data.constData() + pos;
+    const uchar *end = (const uchar*)block.data.constData() + block.data.size();
+    if(end - itr < (int)sizeof(qint64))
+        return UINT_MAX;
+
+    block.times.resize(count);
+    memcpy(&block.times[0], itr, sizeof(qint64));
+    itr += sizeof(qint64);
+
+    for(quint32 i = 1; i < count; ++i)
+    {
+        quint64 val = 0;
+        for(int shift = 0; ; shift += 7, ++itr)
+        {
+            if(itr == end || shift > 63)
+                return UINT_MAX;
+            val |= quint64(*itr & 0x7F) << shift;
+            if(!(*itr & 0x80))
+                break;
+        }
+        ++itr;
+
+        const qint64 diff = qint64(val >> 1) ^ -qint64(val & 1);
+        block.times[i] = block.times[i-1] + diff;
+    }
+    return itr - (const uchar*)block.data.constData();
 }
 
 ProgressReporter::ProgressReporter() : QObject()
@@ -15,6 +15,8 @@
 #include <QFutureWatcher>
 #include <QTimer>
 #include <QFileInfo>
+#include <QCryptographicHash>
+#include <deque>
 
 #include "utils.h"
 
@@ -46,7 +48,18 @@ enum DataBlocks
 enum DataFileFlags
 {
     DATAFLAG_COMPRESSED_OBSOLETE     = 0x01, // Obsolete
-    DATAFLAG_COMPRESSED              = 0x02
+    DATAFLAG_COMPRESSED              = 0x02,
+    DATAFLAG_PACKET_INDEX            = 0x04, // packets are in separate blocks, see DataFileIndexTrailer
+    DATAFLAG_PACKET_TIMES            = 0x08  // packet blocks end with receive times of their packets
+};
+
+// Compression of DATAFLAG_COMPRESSED files. Each compressed block
+// starts with its uncompressed size as big-endian quint32 (which is
+// what qCompress does), followed by data of the codec.
+enum DataFileCodecs
+{
+    DATACODEC_ZSTD        = 0x01,
+    DATACODEC_ZLIB        = 0xFF  // files without codec field have 0xFF there
 };
 
 enum DataFileTypes
@@ -71,9 +84,48 @@ PACK_STRUCT(struct DataFileHeader
     quint16 header_size;     // header size, for compatibility. Should be 64 for version >= 2
     quint32 compressed_block;
     quint32 lorris_rev;
+    quint8 codec;            // enum DataFileCodecs
+    qint8 codec_level;       // -1 is codec's default
 
     // SEE: align to 64 bytes
-    char unused[27];
+    char unused[25];
+});
+
+// Files with DATAFLAG_PACKET_INDEX (header version 3) look like this:
+//   DataFileHeader
+//   compressed document (same as the whole data of older files)
+//   compressed packet blocks, not covered by header's md5
+//   DataFileBlockEntry for each packet block
+//   DataFileIndexTrailer
+//   quint32 0
+// The last quint32 is where older readers expect count of compressed
+// blocks, so they read no blocks and reject the file as unknown data.
+// Document has zero packets in BLOCK_DATA, packets are in the blocks,
+// each is a sequence of (quint32 length, data) like BLOCK_DATA is.
+// Blocks are small, so that a single packet can be loaded quickly.
+// With DATAFLAG_PACKET_TIMES, packets of a block are followed by their
+// receive times (see Utils::monotonicTime(), 0 if not known): qint64
+// time of the first packet, then difference from the previous packet
+// for each other one, zigzag-encoded in 7-bit groups (LEB128).
+#define DATAFILE_PACKET_BLOCK_SIZE (1024*1024)
+
+PACK_STRUCT(struct DataFileBlockEntry
+{
+    quint32 first;           // index of the first packet in the block
+    quint32 count;
+    quint64 offset;          // position of compressed data in the file
+    quint32 compressed_size;
+    quint32 size;
+    char md5[16];            // md5 of compressed data
+});
+
+PACK_STRUCT(struct DataFileIndexTrailer
+{
+    quint64 document_end;
+    quint64 index_offset;
+    quint32 block_count;
+    quint32 packet_count;
+    char str[4];             // must be "LIDX"
 });
 
 class DataFileParser : public QBuffer
@@ -135,23 +187,150 @@ private:
 
 class DataFileBuilder
 {
+    friend class DataFileWriter;
 public:
     static QByteArray readAndCheck(QFile& file, DataFileTypes expectedType, bool *legacy = NULL, DataFileHeader *fillHeader = NULL);
 
-    // Returns MD5 of written data. data is cleared!
+    // Returns fileChecksum() of the written file. data is cleared!
     static QByteArray writeWithHeader(const QString& filename, QByteArray& data, bool compress, DataFileTypes type);
 
+    // Identifies content of the file, to detect changes. It is MD5 of the header
+    // followed by MD5 of the rest of the file, so that DataFileWriter can compute
+    // it without reading the file back. Files with DATAFLAG_PACKET_INDEX use
+    // header's md5, their packet blocks have their own checksums in the index.
+    // Files without header use MD5 of the whole file.
+    static QByteArray fileChecksum(QFile& file);
+
+    // Block format is described at DataFileCodecs. Empty array
+    // is returned when the data can't be (de)compressed.
+    static QByteArray compress(const QByteArray& data, quint8 codec, qint8 level);
+    static QByteArray uncompress(const uchar *data, quint32 len, quint8 codec);
+    // dst has to be exactly as big as the size stored in the block
+    static bool uncompress(const uchar *data, quint32 len, quint8 codec, char *dst, quint32 dst_size);
+    static bool isCodecSupported(quint8 codec) { return codec == DATACODEC_ZLIB || codec == DATACODEC_ZSTD; }
+
     static void dumpFileInfo(const QString& filename);
 
 private:
     static void readHeader(QFile& file, DataFileHeader *header);
     static void writeHeader(QIODevice &file, DataFileHeader *header);
     static void dumpHeader(const DataFileHeader& header);
+    static QByteArray headerChecksum(const DataFileHeader& header, const QByteArray& dataMd5);
+    static bool readTrailer(QFile& file, const DataFileHeader& header, DataFileIndexTrailer& trailer);
+};
+
+class ProgressReporter;
+
+// Writes data file in parts, so that the whole file does not have
+// to be in memory. Compressed blocks are compressed in parallel
+// by QtConcurrent and written in order as they finish, while
+// GUI events are processed. Parts of uncompressed files are
+// written by QtConcurrent too, one at a time. The file is the same as the one
+// written by DataFileBuilder::writeWithHeader, unless packet
+// blocks are written.
+class DataFileWriter
+{
+public:
+    DataFileWriter(const QString& filename, bool compress, DataFileTypes type);
+    ~DataFileWriter();
+
+    void write(const QByteArray& data);
 
-    static QByteArray writeWithHeader_private(const QString& filename, QByteArray& data, bool compress, DataFileTypes type);
+    // Ends the document and switches to DATAFLAG_PACKET_INDEX format,
+    // file must be compressed. Document can't be written afterwards.
+    // If times is true, every packet block must end with packet times.
+    void beginPackets(bool times = false);
+    // data are count serialized packets, about DATAFILE_PACKET_BLOCK_SIZE big
+    void writePacketBlock(const QByteArray& data, quint32 count);
 
-    static QFuture<QByteArray> m_future;
-    static QFutureWatcher<QByteArray> *m_watcher;
+    // Appends times of count packets to packet block
+    static void appendPacketTimes(QByteArray& block, const qint64 *times, quint32 count);
+
+    // Writes the rest of data and the header, returns fileChecksum()
+    QByteArray finish();
+
+    // write() sizes which avoid copying, UINT_MAX if not compressed
+    quint32 getBlockSize() const { return m_header.compressed_block; }
+
+    bool isCompressed() const { return (m_header.flags & DATAFLAG_COMPRESSED); }
+
+    QString getFilename() const { return m_file.fileName(); }
+    // Bytes written so far, blocks which are still compressed are not included
+    qint64 getWrittenSize() { waitForWrite(); return m_file.pos(); }
+
+private:
+    struct Job
+    {
+        QFuture<QByteArray> future;
+        qint32 entry;    // index to m_index or -1 for document blocks
+    };
+
+    void writeRaw(const char *data, qint64 len, bool hash = true);
+    void writeAsync(const QByteArray& data);
+    bool writePart(const QByteArray& data);
+    void waitForWrite();
+    void writeBlocks(size_t keep);
+    void startJob(const QByteArray& data, qint32 entry);
+
+    QFile m_file;
+    DataFileHeader m_header;
+    QCryptographicHash m_hash;
+    QByteArray m_pending;
+    std::deque<Job> m_jobs;
+    QFuture<bool> m_write;   // uncompressed part being written
+    bool m_writing;
+    size_t m_max_jobs;
+    quint32 m_blocks;
+    ProgressReporter *m_reporter;
+
+    DataFileIndexTrailer m_trailer;
+    std::vector<DataFileBlockEntry> m_index;
+
+    static bool m_saving;
+};
+
+// Packets of file with DATAFLAG_PACKET_INDEX. Only the index is read
+// when the file is opened, packet blocks are read, checked and
+// decompressed when some of their packets are needed, and the last
+// PACKET_CACHE_BLOCKS of them are kept. Not thread-safe.
+class DataFilePackets
+{
+public:
+    // throws QString
+    DataFilePackets(const QString& filename);
+
+    const QString& getFilename() const { return m_filename; }
+    quint32 size() const { return m_count; }
+
+    QByteArray get(quint32 idx);
+    // Receive time of the packet, 0 if it is not known
+    qint64 getTime(quint32 idx);
+
+    // Fills pointers to data and sizes of count packets starting at first.
+    // Pointers are valid as long as blocks appended to keep are referenced.
+    void getRange(quint32 first, quint32 count, const char **data, quint32 *sizes,
+                  std::vector<QByteArray>& keep);
+
+private:
+    struct Block
+    {
+        DataFileBlockEntry entry;
+        QByteArray data;
+        std::vector<quint32> offsets;  // count+1 items, first is 0
+        std::vector<qint64> times;     // empty if the file has no times
+    };
+
+    Block& load(quint32 packetIdx);
+    void decode(Block& block);
+    quint32 decodeTimes(Block& block, quint32 pos);
+
+    QString m_filename;
+    QFile m_file;
+    quint32 m_count;
+    quint8 m_codec;
+    bool m_times;
+    std::vector<Block> m_blocks;
+    std::vector<quint32> m_lru;   // loaded blocks, most recently used is last
 };
 
 class ProgressReporter : public QObject
@@ -159,6 +338,7 @@ class ProgressReporter : public QObject
     Q_OBJECT
 
     friend class DataFileBuilder;
+    friend class DataFileWriter;
 
 protected:
     ProgressReporter();
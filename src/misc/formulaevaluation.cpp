@@ -21,6 +21,8 @@ void FormulaEvaluation::setFormula(const QString &formula)
 
     emit setError(false);
 
+    m_program.clear();
+
     if(m_formula == "%n")
     {
         delete m_script_eng;
@@ -28,6 +30,14 @@ void FormulaEvaluation::setFormula(const QString &formula)
     }
     else if(!m_formula.contains("%n"))
         emit setError(true, tr("Formula must contain \"%n\" expression!"));
+    else if(m_program.compile(m_formula))
+    {
+        delete m_script_eng;
+        m_script_eng = NULL;
+
+        m_formula.replace("%1", "%%1");
+        m_formula.replace("%n", "%1");
+    }
     else
     {
         m_formula.replace("%1", "%%1");
@@ -57,6 +67,13 @@ void FormulaEvaluation::showFormulaDialog()
 
 QVariant FormulaEvaluation::evaluate(const QString& val)
 {
+    if(m_program.isValid())
+    {
+        bool ok = false;
+        const double n = val.toDouble(&ok);
+        return ok ? QVariant(m_program.run(n)) : QVariant();
+    }
+
     if(!m_script_eng)
         return QVariant();
 
@@ -76,3 +93,31 @@ QVariant FormulaEvaluation::evaluate(const QString& val)
     }
     return QVariant();
 }
+
+bool FormulaEvaluation::evaluate(double val, double& res)
+{
+    if(m_program.isValid())
+    {
+        res = m_program.run(val);
+        return true;
+    }
+
+    QVariant var = evaluate(QString::number(val, 'g', 17));
+    if(!var.isValid())
+        return false;
+
+    res = var.toDouble();
+    return true;
+}
+
+void FormulaEvaluation::evaluate(double *values, size_t count)
+{
+    if(m_program.isValid())
+        return m_program.run(values, count);
+
+    for(size_t i = 0; i < count; ++i)
+    {
+        if(!evaluate(values[i], values[i]))
+            values[i] = 0.0;
+    }
+}
@@ -10,6 +10,8 @@
 
 #include <QObject>
 
+#include "formulaprogram.h"
+
 class QScriptEngine;
 
 class FormulaEvaluation : public QObject
@@ -23,7 +25,15 @@ public:
     FormulaEvaluation(QObject *parent = NULL);
 
     QVariant evaluate(const QString& val);
-    bool isActive() const { return m_script_eng != NULL; }
+
+    // Returns false if the result is not a number
+    bool evaluate(double val, double& res);
+
+    // Replaces values with their results, those which
+    // are not a number are set to zero
+    void evaluate(double *values, size_t count);
+
+    bool isActive() const { return m_program.isValid() || m_script_eng != NULL; }
 
 public slots:
     void setFormula(const QString& formula);
@@ -31,6 +41,9 @@ public slots:
     void showFormulaDialog();
 
 private:
+    // Formulas which could not be compiled are evaluated
+    // by the script engine for each value
+    FormulaProgram m_program;
     QScriptEngine *m_script_eng;
     QString m_formula;
 };
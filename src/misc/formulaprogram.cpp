@@ -0,0 +1,744 @@
+/**********************************************
+**    This file is part of Lorris
+**    http://tasssadar.github.com/Lorris/
+**
+**    See README and COPYING
+***********************************************/
+
+#include <math.h>
+#include <string.h>
+#include <limits>
+#include <algorithm>
+
+#include "formulaprogram.h"
+
+// Values evaluated together by run(double*, size_t)
+#define FORMULA_BLOCK 128
+#define FORMULA_MAX_DEPTH 32
+
+static const double nan_val = std::numeric_limits<double>::quiet_NaN();
+static const double inf_val = std::numeric_limits<double>::infinity();
+
+static inline bool isNaN(double v)
+{
+    return v != v;
+}
+
+static inline bool truthy(double v)
+{
+    return v != 0.0 && !isNaN(v);
+}
+
+// JavaScript's ToUint32 and ToInt32, used by bit operators
+static inline quint32 toUint32(double v)
+{
+    if(isNaN(v) || v == inf_val || v == -inf_val)
+        return 0;
+
+    v = fmod(v < 0 ? ceil(v) : floor(v), 4294967296.0);
+    if(v < 0)
+        v += 4294967296.0;
+    return quint32(v);
+}
+
+static inline qint32 toInt32(double v)
+{
+    return qint32(toUint32(v));
+}
+
+static double jsRound(double v)
+{
+    return floor(v + 0.5);
+}
+
+static double jsPow(double a, double b)
+{
+    if(isNaN(b) || (fabs(a) == 1.0 && (b == inf_val || b == -inf_val)))
+        return nan_val;
+    return pow(a, b);
+}
+
+static double jsMin(double a, double b)
+{
+    if(isNaN(a) || isNaN(b))
+        return nan_val;
+    return (std::min)(a, b);
+}
+
+static double jsMax(double a, double b)
+{
+    if(isNaN(a) || isNaN(b))
+        return nan_val;
+    return (std::max)(a, b);
+}
+
+static double jsAbs(double v) { return fabs(v); }
+static double jsAcos(double v) { return acos(v); }
+static double jsAsin(double v) { return asin(v); }
+static double jsAtan(double v) { return atan(v); }
+static double jsAtan2(double a, double b) { return atan2(a, b); }
+static double jsCeil(double v) { return ceil(v); }
+static double jsCos(double v) { return cos(v); }
+static double jsExp(double v) { return exp(v); }
+static double jsFloor(double v) { return floor(v); }
+static double jsLog(double v) { return log(v); }
+static double jsSin(double v) { return sin(v); }
+static double jsSqrt(double v) { return sqrt(v); }
+static double jsTan(double v) { return tan(v); }
+
+struct MathFunction
+{
+    const char *name;
+    double (*fn1)(double);
+    double (*fn2)(double, double);
+};
+
+static const MathFunction mathFunctions[] =
+{
+    { "abs",   jsAbs,   NULL },
+    { "acos",  jsAcos,  NULL },
+    { "asin",  jsAsin,  NULL },
+    { "atan",  jsAtan,  NULL },
+    { "atan2", NULL,    jsAtan2 },
+    { "ceil",  jsCeil,  NULL },
+    { "cos",   jsCos,   NULL },
+    { "exp",   jsExp,   NULL },
+    { "floor", jsFloor, NULL },
+    { "log",   jsLog,   NULL },
+    { "pow",   NULL,    jsPow },
+    { "round", jsRound, NULL },
+    { "sin",   jsSin,   NULL },
+    { "sqrt",  jsSqrt,  NULL },
+    { "tan",   jsTan,   NULL },
+    { NULL,    NULL,    NULL }
+};
+
+struct MathConstant
+{
+    const char *name;
+    double value;
+};
+
+static const MathConstant mathConstants[] =
+{
+    { "PI",      3.141592653589793 },
+    { "E",       2.718281828459045 },
+    { "LN2",     0.6931471805599453 },
+    { "LN10",    2.302585092994046 },
+    { "LOG2E",   1.4426950408889634 },
+    { "LOG10E",  0.4342944819032518 },
+    { "SQRT2",   1.4142135623730951 },
+    { "SQRT1_2", 0.7071067811865476 },
+    { NULL,      0.0 }
+};
+
+#define BINARY_LEVELS 10
+
+static inline bool isIdentChar(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c == '$';
+}
+
+FormulaProgram::FormulaProgram()
+{
+    m_depth = 0;
+    m_itr = m_end = NULL;
+    m_cur_depth = 0;
+}
+
+void FormulaProgram::clear()
+{
+    m_code.clear();
+    m_depth = 0;
+}
+
+bool FormulaProgram::compile(const QString& formula)
+{
+    clear();
+
+    // Anything outside of ASCII is not an expression we would understand
+    const QByteArray src = formula.toLatin1();
+    if(QString::fromLatin1(src) != formula)
+        return false;
+
+    m_itr = src.constData();
+    m_end = m_itr + src.size();
+    m_cur_depth = 0;
+
+    const int kind = parseTernary();
+
+    skipSpaces();
+    while(accept(";"))
+        skipSpaces();
+
+    // Script engine returns only numbers, leave booleans to it
+    if(kind != KIND_NUMBER || m_itr != m_end || m_depth > FORMULA_MAX_DEPTH)
+    {
+        clear();
+        return false;
+    }
+    return true;
+}
+
+int FormulaProgram::stackEffect(Opcode op)
+{
+    switch(op)
+    {
+        case OP_CONST:
+        case OP_VAR:
+            return 1;
+        case OP_NEG:
+        case OP_NOT:
+        case OP_BITNOT:
+        case OP_CALL1:
+            return 0;
+        case OP_SELECT:
+            return -2;
+        default:
+            return -1;
+    }
+}
+
+double FormulaProgram::apply(const Instruction& ins, const double *args)
+{
+    const double a = args[0];
+    switch(ins.op)
+    {
+        case OP_CONST:  return ins.value;
+        case OP_VAR:    return a;
+        case OP_NEG:    return -a;
+        case OP_NOT:    return truthy(a) ? 0.0 : 1.0;
+        case OP_BITNOT: return ~toInt32(a);
+        case OP_CALL1:  return ins.fn1(a);
+        case OP_SELECT: return truthy(a) ? args[1] : args[2];
+        default:
+            break;
+    }
+
+    const double b = args[1];
+    switch(ins.op)
+    {
+        case OP_ADD:    return a + b;
+        case OP_SUB:    return a - b;
+        case OP_MUL:    return a * b;
+        case OP_DIV:    return a / b;
+        case OP_MOD:    return fmod(a, b);
+        case OP_SHL:    return qint32(toUint32(a) << (toUint32(b) & 0x1F));
+        case OP_SHR:    return toInt32(a) >> (toUint32(b) & 0x1F);
+        case OP_USHR:   return toUint32(a) >> (toUint32(b) & 0x1F);
+        case OP_LT:     return a < b;
+        case OP_LE:     return a <= b;
+        case OP_GT:     return a > b;
+        case OP_GE:     return a >= b;
+        case OP_EQ:     return a == b;
+        case OP_NE:     return a != b;
+        case OP_BITAND: return toInt32(a) & toInt32(b);
+        case OP_BITXOR: return toInt32(a) ^ toInt32(b);
+        case OP_BITOR:  return toInt32(a) | toInt32(b);
+        case OP_AND:    return truthy(a) ? b : a;
+        case OP_OR:     return truthy(a) ? a : b;
+        case OP_CALL2:  return ins.fn2(a, b);
+        default:
+            return nan_val;
+    }
+}
+
+double FormulaProgram::run(double n) const
+{
+    double stack[FORMULA_MAX_DEPTH];
+    int sp = 0;
+
+    for(size_t i = 0; i < m_code.size(); ++i)
+    {
+        const Instruction& ins = m_code[i];
+        switch(ins.op)
+        {
+            case OP_CONST:
+                stack[sp++] = ins.value;
+                break;
+            case OP_VAR:
+                stack[sp++] = n;
+                break;
+            default:
+            {
+                const int args = 1 - stackEffect(ins.op);
+                sp -= args;
+                stack[sp] = apply(ins, stack + sp);
+                ++sp;
+                break;
+            }
+        }
+    }
+    return sp == 1 ? stack[0] : nan_val;
+}
+
+#define ROW(idx) (&stack[(idx)*FORMULA_BLOCK])
+
+#define UNARY_LOOP(expr) \
+    { \
+        double *a = ROW(sp - 1); \
+        for(size_t i = 0; i < n; ++i) \
+            a[i] = (expr); \
+    }
+
+#define BINARY_LOOP(expr) \
+    { \
+        double *a = ROW(sp - 2); \
+        const double *b = ROW(sp - 1); \
+        for(size_t i = 0; i < n; ++i) \
+            a[i] = (expr); \
+        --sp; \
+    }
+
+void FormulaProgram::run(double *values, size_t count) const
+{
+    if(m_code.empty())
+        return;
+
+    std::vector<double> stack(m_depth*FORMULA_BLOCK);
+
+    for(size_t off = 0; off < count; off += FORMULA_BLOCK)
+    {
+        double *in = values + off;
+        const size_t n = (std::min)(size_t(FORMULA_BLOCK), count - off);
+        int sp = 0;
+
+        for(size_t c = 0; c < m_code.size(); ++c)
+        {
+            const Instruction& ins = m_code[c];
+            switch(ins.op)
+            {
+                case OP_CONST:  std::fill(ROW(sp), ROW(sp) + n, ins.value); ++sp; break;
+                case OP_VAR:    std::copy(in, in + n, ROW(sp)); ++sp; break;
+                case OP_NEG:    UNARY_LOOP(-a[i]); break;
+                case OP_NOT:    UNARY_LOOP(truthy(a[i]) ? 0.0 : 1.0); break;
+                case OP_BITNOT: UNARY_LOOP(~toInt32(a[i])); break;
+                case OP_CALL1:  UNARY_LOOP(ins.fn1(a[i])); break;
+                case OP_ADD:    BINARY_LOOP(a[i] + b[i]); break;
+                case OP_SUB:    BINARY_LOOP(a[i] - b[i]); break;
+                case OP_MUL:    BINARY_LOOP(a[i] * b[i]); break;
+                case OP_DIV:    BINARY_LOOP(a[i] / b[i]); break;
+                case OP_LT:     BINARY_LOOP(a[i] < b[i]); break;
+                case OP_LE:     BINARY_LOOP(a[i] <= b[i]); break;
+                case OP_GT:     BINARY_LOOP(a[i] > b[i]); break;
+                case OP_GE:     BINARY_LOOP(a[i] >= b[i]); break;
+                case OP_EQ:     BINARY_LOOP(a[i] == b[i]); break;
+                case OP_NE:     BINARY_LOOP(a[i] != b[i]); break;
+                case OP_SELECT:
+                {
+                    double *a = ROW(sp - 3);
+                    const double *b = ROW(sp - 2);
+                    const double *d = ROW(sp - 1);
+                    for(size_t i = 0; i < n; ++i)
+                        a[i] = truthy(a[i]) ? b[i] : d[i];
+                    sp -= 2;
+                    break;
+                }
+                default:
+                {
+                    double args[2];
+                    double *a = ROW(sp - 2);
+                    const double *b = ROW(sp - 1);
+                    for(size_t i = 0; i < n; ++i)
+                    {
+                        args[0] = a[i];
+                        args[1] = b[i];
+                        a[i] = apply(ins, args);
+                    }
+                    --sp;
+                    break;
+                }
+            }
+        }
+        std::copy(ROW(0), ROW(0) + n, in);
+    }
+}
+
+#undef ROW
+#undef UNARY_LOOP
+#undef BINARY_LOOP
+
+void FormulaProgram::emitOp(Opcode op, double value)
+{
+    Instruction ins;
+    ins.op = op;
+    ins.value = value;
+    ins.fn1 = NULL;
+    ins.fn2 = NULL;
+    m_code.push_back(ins);
+
+    m_cur_depth += stackEffect(op);
+    m_depth = (std::max)(m_depth, m_cur_depth);
+
+    if(op != OP_CONST && op != OP_VAR)
+        fold(1 - stackEffect(op));
+}
+
+void FormulaProgram::emitCall(double (*fn1)(double), double (*fn2)(double, double))
+{
+    Instruction ins;
+    ins.op = fn1 ? OP_CALL1 : OP_CALL2;
+    ins.value = 0.0;
+    ins.fn1 = fn1;
+    ins.fn2 = fn2;
+    m_code.push_back(ins);
+
+    m_cur_depth += stackEffect(ins.op);
+    fold(fn1 ? 1 : 2);
+}
+
+// Replaces the last instruction with a constant if all its arguments are constants
+bool FormulaProgram::fold(size_t args)
+{
+    if(m_code.size() < args + 1)
+        return false;
+
+    double values[3];
+    const size_t first = m_code.size() - args - 1;
+    for(size_t i = 0; i < args; ++i)
+    {
+        if(m_code[first + i].op != OP_CONST)
+            return false;
+        values[i] = m_code[first + i].value;
+    }
+
+    const double res = apply(m_code.back(), values);
+    m_code.resize(first + 1);
+    m_code[first].op = OP_CONST;
+    m_code[first].value = res;
+    m_code[first].fn1 = NULL;
+    m_code[first].fn2 = NULL;
+    return true;
+}
+
+void FormulaProgram::skipSpaces()
+{
+    while(m_itr != m_end && (*m_itr == ' ' || *m_itr == '\t' || *m_itr == '\n' || *m_itr == '\r'))
+        ++m_itr;
+}
+
+bool FormulaProgram::accept(const char *token)
+{
+    skipSpaces();
+
+    const size_t len = strlen(token);
+    if(size_t(m_end - m_itr) < len || strncmp(m_itr, token, len) != 0)
+        return false;
+
+    // Keywords and identifiers must not continue
+    if(isIdentChar(token[len-1]) && m_itr + len != m_end && isIdentChar(m_itr[len]))
+        return false;
+
+    m_itr += len;
+    return true;
+}
+
+bool FormulaProgram::acceptOperator(const char *token)
+{
+    skipSpaces();
+
+    const size_t len = strlen(token);
+    if(size_t(m_end - m_itr) < len || strncmp(m_itr, token, len) != 0)
+        return false;
+
+    // Do not split longer operators (|| into two |, assignments, ++...)
+    // and do not take %n for modulo
+    const char next = m_itr + len != m_end ? m_itr[len] : 0;
+    if(next == '=' || (len == 1 && next == token[0]) || (token[0] == '%' && next == 'n'))
+        return false;
+
+    m_itr += len;
+    return true;
+}
+
+int FormulaProgram::parseTernary()
+{
+    const int cond = parseBinary(0);
+    if(cond == KIND_ERROR || !acceptOperator("?"))
+        return cond;
+
+    const int a = parseTernary();
+    if(a == KIND_ERROR || !accept(":"))
+        return KIND_ERROR;
+
+    const int b = parseTernary();
+    if(b == KIND_ERROR)
+        return KIND_ERROR;
+
+    emitOp(OP_SELECT);
+    return a == b ? a : KIND_MIXED;
+}
+
+int FormulaProgram::parseBinary(int level)
+{
+    struct BinaryOperator
+    {
+        const char *token;
+        Opcode op;
+        bool strict;
+    };
+
+    // By precedence, lowest first. Longer tokens have to be before their prefixes
+    static const BinaryOperator operators[BINARY_LEVELS][5] =
+    {
+        { { "||", OP_OR, false } },
+        { { "&&", OP_AND, false } },
+        { { "|", OP_BITOR, false } },
+        { { "^", OP_BITXOR, false } },
+        { { "&", OP_BITAND, false } },
+        { { "===", OP_EQ, true }, { "!==", OP_NE, true }, { "==", OP_EQ, false }, { "!=", OP_NE, false } },
+        { { "<=", OP_LE, false }, { ">=", OP_GE, false }, { "<", OP_LT, false }, { ">", OP_GT, false } },
+        { { ">>>", OP_USHR, false }, { "<<", OP_SHL, false }, { ">>", OP_SHR, false } },
+        { { "+", OP_ADD, false }, { "-", OP_SUB, false } },
+        { { "*", OP_MUL, false }, { "/", OP_DIV, false }, { "%", OP_MOD, false } }
+    };
+
+    if(level == BINARY_LEVELS)
+        return parseUnary();
+
+    int kind = parseBinary(level + 1);
+    while(kind != KIND_ERROR)
+    {
+        const BinaryOperator *op = operators[level];
+        for(; op < operators[level] + 5 && op->token; ++op)
+            if(acceptOperator(op->token))
+                break;
+
+        if(op == operators[level] + 5 || !op->token)
+            break;
+
+        const int rhs = parseBinary(level + 1);
+        if(rhs == KIND_ERROR)
+            return KIND_ERROR;
+
+        // Strict comparison of number and boolean is always false,
+        // leave these to the script engine
+        if(op->strict && (kind != rhs || kind == KIND_MIXED))
+            return KIND_ERROR;
+
+        emitOp(op->op);
+
+        switch(op->op)
+        {
+            case OP_LT:
+            case OP_LE:
+            case OP_GT:
+            case OP_GE:
+            case OP_EQ:
+            case OP_NE:
+                kind = KIND_BOOL;
+                break;
+            case OP_AND:
+            case OP_OR:
+                kind = (kind == rhs) ? kind : KIND_MIXED;
+                break;
+            default:
+                kind = KIND_NUMBER;
+                break;
+        }
+    }
+    return kind;
+}
+
+int FormulaProgram::parseUnary()
+{
+    skipSpaces();
+    if(m_itr == m_end)
+        return KIND_ERROR;
+
+    const char c = *m_itr;
+    const char next = m_itr + 1 != m_end ? m_itr[1] : 0;
+
+    // Unary plus only converts its operand to number
+    if(c == '+' && next != '+')
+    {
+        ++m_itr;
+        return parseUnary() == KIND_ERROR ? KIND_ERROR : KIND_NUMBER;
+    }
+
+    Opcode op;
+    if(c == '-' && next != '-')
+        op = OP_NEG;
+    else if(c == '!' && next != '=')
+        op = OP_NOT;
+    else if(c == '~')
+        op = OP_BITNOT;
+    else
+        return parsePrimary();
+
+    ++m_itr;
+    if(parseUnary() == KIND_ERROR)
+        return KIND_ERROR;
+
+    emitOp(op);
+    return op == OP_NOT ? KIND_BOOL : KIND_NUMBER;
+}
+
+int FormulaProgram::parsePrimary()
+{
+    skipSpaces();
+    if(m_itr == m_end)
+        return KIND_ERROR;
+
+    if(accept("("))
+    {
+        const int kind = parseTernary();
+        if(kind == KIND_ERROR || !accept(")"))
+            return KIND_ERROR;
+        return kind;
+    }
+
+    if(m_itr[0] == '%' && m_itr + 1 != m_end && m_itr[1] == 'n')
+    {
+        m_itr += 2;
+        emitOp(OP_VAR);
+        return KIND_NUMBER;
+    }
+
+    if((*m_itr >= '0' && *m_itr <= '9') || *m_itr == '.')
+        return parseNumber();
+
+    if(accept("true"))
+    {
+        emitOp(OP_CONST, 1.0);
+        return KIND_BOOL;
+    }
+    if(accept("false"))
+    {
+        emitOp(OP_CONST, 0.0);
+        return KIND_BOOL;
+    }
+    if(accept("Infinity"))
+    {
+        emitOp(OP_CONST, inf_val);
+        return KIND_NUMBER;
+    }
+    if(accept("NaN"))
+    {
+        emitOp(OP_CONST, nan_val);
+        return KIND_NUMBER;
+    }
+    if(accept("Math"))
+        return parseMath();
+
+    return KIND_ERROR;
+}
+
+int FormulaProgram::parseNumber()
+{
+    const char *start = m_itr;
+
+    if(m_end - m_itr > 2 && m_itr[0] == '0' && (m_itr[1] == 'x' || m_itr[1] == 'X'))
+    {
+        double val = 0.0;
+        for(m_itr += 2; m_itr != m_end && isIdentChar(*m_itr); ++m_itr)
+        {
+            const char c = *m_itr;
+            int digit;
+            if(c >= '0' && c <= '9')      digit = c - '0';
+            else if(c >= 'a' && c <= 'f') digit = c - 'a' + 10;
+            else if(c >= 'A' && c <= 'F') digit = c - 'A' + 10;
+            else
+                return KIND_ERROR;
+            val = val*16 + digit;
+        }
+        if(m_itr == start + 2)
+            return KIND_ERROR;
+
+        emitOp(OP_CONST, val);
+        return KIND_NUMBER;
+    }
+
+    // Leading zero means octal in JavaScript, script engine will handle that
+    if(m_end - m_itr > 1 && m_itr[0] == '0' && m_itr[1] >= '0' && m_itr[1] <= '9')
+        return KIND_ERROR;
+
+    QByteArray num;
+    while(m_itr != m_end && ((*m_itr >= '0' && *m_itr <= '9') || *m_itr == '.'))
+        num.append(*m_itr++);
+
+    if(m_itr != m_end && (*m_itr == 'e' || *m_itr == 'E'))
+    {
+        num.append(*m_itr++);
+        if(m_itr != m_end && (*m_itr == '+' || *m_itr == '-'))
+            num.append(*m_itr++);
+        while(m_itr != m_end && *m_itr >= '0' && *m_itr <= '9')
+            num.append(*m_itr++);
+    }
+
+    if(m_itr != m_end && isIdentChar(*m_itr))
+        return KIND_ERROR;
+
+    bool ok = false;
+    const double val = num.toDouble(&ok);
+    if(!ok)
+        return KIND_ERROR;
+
+    emitOp(OP_CONST, val);
+    return KIND_NUMBER;
+}
+
+int FormulaProgram::parseMath()
+{
+    if(!accept("."))
+        return KIND_ERROR;
+
+    skipSpaces();
+    const char *start = m_itr;
+    while(m_itr != m_end && isIdentChar(*m_itr))
+        ++m_itr;
+    const QByteArray name(start, m_itr - start);
+
+    for(const MathConstant *c = mathConstants; c->name; ++c)
+    {
+        if(name == c->name)
+        {
+            emitOp(OP_CONST, c->value);
+            return KIND_NUMBER;
+        }
+    }
+
+    if(!accept("("))
+        return KIND_ERROR;
+
+    // min and max take any number of arguments
+    if(name == "min" || name == "max")
+    {
+        const bool min = (name == "min");
+        int args = 0;
+        if(!accept(")"))
+        {
+            do
+            {
+                if(parseTernary() == KIND_ERROR)
+                    return KIND_ERROR;
+                if(++args > 1)
+                    emitCall(NULL, min ? jsMin : jsMax);
+            } while(accept(","));
+
+            if(!accept(")"))
+                return KIND_ERROR;
+        }
+
+        if(args == 0)
+            emitOp(OP_CONST, min ? inf_val : -inf_val);
+        return KIND_NUMBER;
+    }
+
+    const MathFunction *fn = mathFunctions;
+    for(; fn->name; ++fn)
+        if(name == fn->name)
+            break;
+
+    if(!fn->name || parseTernary() == KIND_ERROR)
+        return KIND_ERROR;
+
+    if(fn->fn2 && (!accept(",") || parseTernary() == KIND_ERROR))
+        return KIND_ERROR;
+
+    if(!accept(")"))
+        return KIND_ERROR;
+
+    emitCall(fn->fn1, fn->fn2);
+    return KIND_NUMBER;
+}
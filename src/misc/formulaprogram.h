@@ -0,0 +1,116 @@
+/**********************************************
+**    This file is part of Lorris
+**    http://tasssadar.github.com/Lorris/
+**
+**    See README and COPYING
+***********************************************/
+
+#ifndef FORMULAPROGRAM_H
+#define FORMULAPROGRAM_H
+
+#include <vector>
+#include <QString>
+
+// Compiled form of arithmetic formulas used by FormulaEvaluation.
+// Understands the JavaScript subset people write into formulas:
+// numbers, %n, arithmetic, comparison, logical and bit operators,
+// ?: and Math functions and constants. The formula is parsed once
+// into stack bytecode evaluated on doubles, with the same results
+// as the script engine would give.
+//
+// compile() fails on anything else (strings, variables, other objects...),
+// such formulas have to go through the script engine.
+class FormulaProgram
+{
+public:
+    FormulaProgram();
+
+    // formula uses %n for the input value
+    bool compile(const QString& formula);
+    void clear();
+
+    bool isValid() const { return !m_code.empty(); }
+
+    double run(double n) const;
+
+    // Replaces each value with result of the formula, evaluates
+    // every instruction for a whole block of values at once
+    void run(double *values, size_t count) const;
+
+private:
+    enum Opcode
+    {
+        OP_CONST,
+        OP_VAR,
+        OP_NEG,
+        OP_NOT,
+        OP_BITNOT,
+        OP_ADD,
+        OP_SUB,
+        OP_MUL,
+        OP_DIV,
+        OP_MOD,
+        OP_SHL,
+        OP_SHR,
+        OP_USHR,
+        OP_LT,
+        OP_LE,
+        OP_GT,
+        OP_GE,
+        OP_EQ,
+        OP_NE,
+        OP_BITAND,
+        OP_BITXOR,
+        OP_BITOR,
+        OP_AND,
+        OP_OR,
+        OP_SELECT,
+        OP_CALL1,
+        OP_CALL2
+    };
+
+    struct Instruction
+    {
+        Opcode op;
+        double value;
+        double (*fn1)(double);
+        double (*fn2)(double, double);
+    };
+
+    // Kinds of expression results, only numbers can be the result of a formula
+    enum Kind
+    {
+        KIND_NUMBER,
+        KIND_BOOL,
+        KIND_MIXED,
+        KIND_ERROR
+    };
+
+    static int stackEffect(Opcode op);
+    static double apply(const Instruction& ins, const double *args);
+
+    void emitOp(Opcode op, double value = 0.0);
+    void emitCall(double (*fn1)(double), double (*fn2)(double, double));
+    bool fold(size_t args);
+
+    void skipSpaces();
+    bool accept(const char *token);
+    bool acceptOperator(const char *token);
+
+    int parseTernary();
+    int parseBinary(int level);
+    int parseUnary();
+    int parsePrimary();
+    int parseNumber();
+    int parseMath();
+
+    std::vector<Instruction> m_code;
+    int m_depth;
+
+    // Compiler state
+    const char *m_itr;
+    const char *m_end;
+    int m_cur_depth;
+};
+
+#endif // FORMULAPROGRAM_H
@@ -4,6 +4,7 @@
 #include <QObject>
 #include <QMutex>
 #include <QAtomicPointer>
+#include <QAtomicInt>
 #include <vector>
 
 class ThreadChannelBase
@@ -60,6 +61,62 @@ private:
     std::vector<T> m_data;
 };
 
+// Bounded channel for exactly one producer and one consumer thread.
+// Unlike ThreadChannel, neither send nor receive takes a lock, items
+// are stored in a ring buffer. send() fails when the ring is full,
+// producer has to keep the item and try again later.
+template <typename T>
+class SpscThreadChannel
+    : public ThreadChannelBase
+{
+public:
+    explicit SpscThreadChannel(int capacity = 1024)
+        : m_data(capacity + 1), m_head(0), m_tail(0)
+    {
+    }
+
+    bool send(T const & v)
+    {
+        const int tail = m_tail.fetchAndAddRelaxed(0);
+        const int next = this->next(tail);
+        if(next == m_head.fetchAndAddAcquire(0))
+            return false;
+
+        m_data[tail] = v;
+        m_tail.fetchAndStoreRelease(next);
+        this->notifyDataReady();
+        return true;
+    }
+
+    bool receive(T & v)
+    {
+        const int head = m_head.fetchAndAddRelaxed(0);
+        if(head == m_tail.fetchAndAddAcquire(0))
+            return false;
+
+        v = m_data[head];
+        m_head.fetchAndStoreRelease(this->next(head));
+        return true;
+    }
+
+    void receive(std::vector<T> & v)
+    {
+        T item;
+        while(receive(item))
+            v.push_back(item);
+    }
+
+private:
+    int next(int idx) const
+    {
+        return (idx + 1 == (int)m_data.size()) ? 0 : idx + 1;
+    }
+
+    std::vector<T> m_data;
+    QAtomicInt m_head;
+    QAtomicInt m_tail;
+};
+
 template <>
 class ThreadChannel<void>
     : public ThreadChannelBase
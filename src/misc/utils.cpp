@@ -5,6 +5,7 @@
 **    See README and COPYING
 ***********************************************/
 
+#include <stdio.h>
 #include <QMessageBox>
 #include <QStatusBar>
 #include <QApplication>
@@ -12,6 +13,8 @@
 #include <QFile>
 #include <QDir>
 #include <QDesktopServices>
+#include <QDateTime>
+#include <QElapsedTimer>
 
 #if QT_VERSION < 0x050000
 #include <QDesktopServices>
@@ -125,6 +128,13 @@ QFont Utils::getMonospaceFont(int size)
 
 void Utils::showErrorBox(const QString& text, QWidget* parent)
 {
+    // Headless capture runs with QCoreApplication, which can't show widgets
+    if(!qobject_cast<QApplication*>(QCoreApplication::instance()))
+    {
+        fprintf(stderr, "%s\n", text.toLocal8Bit().constData());
+        return;
+    }
+
     QMessageBox box(parent);
     box.setIcon(QMessageBox::Critical);
     box.setWindowTitle(tr("Error!"));
@@ -343,6 +353,27 @@ void Utils::moveDataFolder()
         fprintf(stderr, "Failed to remove folder %s", data.toStdString().c_str());
 }
 
+namespace {
+struct MonotonicClock
+{
+    MonotonicClock()
+    {
+        base = QDateTime::currentMSecsSinceEpoch()*1000;
+        timer.start();
+    }
+
+    qint64 base;
+    QElapsedTimer timer;
+};
+}
+
+// Initialized before main(), so that it is not created by two threads at once
+static const MonotonicClock monotonicClock;
+
+qint64 Utils::monotonicTime()
+{
+    return monotonicClock.base + monotonicClock.timer.nsecsElapsed()/1000;
+}
 
 void Utils::swapEndian(char *val, quint8 size)
 {
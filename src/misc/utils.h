@@ -91,6 +91,11 @@ public:
     static QString storageLocation(StandardLocation loc);
 
     static void moveDataFolder();
+
+    // Microseconds since epoch, measured by monotonic clock which
+    // was aligned with wall clock when Lorris started. Used to
+    // timestamp received data.
+    static qint64 monotonicTime();
 };
 
 template <typename T>
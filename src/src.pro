@@ -22,6 +22,10 @@ CONFIG += qwt
 
 LIBS += -L"$$PWD/../dep/qwt/lib"
 LIBS += -L"$$PWD/../dep/qextserialport/lib"
+LIBS += -L"$$PWD/../dep/zstd/lib" -lzstd_lorris
+# zlib is used directly to decompress data files, Qt on Windows has its own copy
+unix:LIBS += -lz
+win32:INCLUDEPATH += $$[QT_INSTALL_HEADERS]/QtZlib
 TRANSLATIONS = ../translations/Lorris.cs_CZ.ts
 TEMPLATE = app
 
@@ -31,6 +35,7 @@ INCLUDEPATH += ../dep/qserialdevice/src
 INCLUDEPATH += ../dep/qhexedit2/src
 INCLUDEPATH += ../dep
 INCLUDEPATH += ../dep/qextserialport/src
+INCLUDEPATH += ../dep/zstd/src
 
 SOURCES += ui/mainwindow.cpp \
     main.cpp \
@@ -125,6 +130,7 @@ SOURCES += ui/mainwindow.cpp \
     ui/resettablelineedit.cpp \
     ui/formuladialog.cpp \
     misc/formulaevaluation.cpp \
+    misc/formulaprogram.cpp \
     LorrisAnalyzer/undostack.cpp \
     LorrisAnalyzer/undoactions.cpp \
     LorrisAnalyzer/filtertabwidget.cpp \
@@ -162,7 +168,16 @@ SOURCES += ui/mainwindow.cpp \
     ui/floatingwidget.cpp \
     ui/floatinginputdialog.cpp \
     LorrisProgrammer/modes/shupitospitunnel.cpp \
-    connection/shupitospitunnelconn.cpp
+    connection/shupitospitunnelconn.cpp \
+    misc/bytesearch.cpp \
+    LorrisAnalyzer/ingestthread.cpp \
+    LorrisAnalyzer/DataWidgets/GraphWidget/graphcolumn.cpp \
+    LorrisAnalyzer/packetscriptclass.cpp \
+    LorrisAnalyzer/DataWidgets/ScriptWidget/engines/threadedscriptengine.cpp \
+    LorrisAnalyzer/capturejournal.cpp \
+    LorrisAnalyzer/headlesscapture.cpp \
+    ui/terminalbuffer.cpp \
+    LorrisTerminal/terminallog.cpp
 
 HEADERS += ui/mainwindow.h \
     revision.h \
@@ -262,6 +277,7 @@ HEADERS += ui/mainwindow.h \
     ui/resettablelineedit.h \
     ui/formuladialog.h \
     misc/formulaevaluation.h \
+    misc/formulaprogram.h \
     LorrisAnalyzer/undostack.h \
     LorrisAnalyzer/undoactions.h \
     LorrisAnalyzer/filtertabwidget.h \
@@ -299,7 +315,16 @@ HEADERS += ui/mainwindow.h \
     LorrisAnalyzer/DataWidgets/RotationWidget/rotationwidget.h \
     LorrisAnalyzer/storagedata.h \
     LorrisProgrammer/modes/shupitospitunnel.h \
-    connection/shupitospitunnelconn.h
+    connection/shupitospitunnelconn.h \
+    misc/bytesearch.h \
+    LorrisAnalyzer/ingestthread.h \
+    LorrisAnalyzer/DataWidgets/GraphWidget/graphcolumn.h \
+    LorrisAnalyzer/packetscriptclass.h \
+    LorrisAnalyzer/DataWidgets/ScriptWidget/engines/threadedscriptengine.h \
+    LorrisAnalyzer/capturejournal.h \
+    LorrisAnalyzer/headlesscapture.h \
+    ui/terminalbuffer.h \
+    LorrisTerminal/terminallog.h
 
 FORMS += \
     LorrisAnalyzer/sourcedialog.ui \
@@ -15,6 +15,7 @@
 #include "../misc/utils.h"
 #include "../revision.h"
 #include "../misc/updater.h"
+#include "../misc/datafileparser.h"
 
 #ifdef WITH_PYTHON
 #include "../../../dep/pythonqt/src/PythonQt.h"
@@ -58,12 +59,21 @@ void SettingsDialog::loadSettings()
 
     ui->scaleBox->setChecked(sConfig.get(CFG_BOOL_SMOOTH_SCALING));
     ui->cmprBlock->setValue(sConfig.get(CFG_QUINT32_COMPRESS_BLOCK)/1024/1024);
+    ui->cmprCodec->setCurrentIndex(sConfig.get(CFG_QUINT32_COMPRESS_CODEC) == DATACODEC_ZSTD ? 0 : 1);
+    ui->cmprLevel->setValue(sConfig.get(CFG_QUINT32_COMPRESS_LEVEL));
+    ui->hotWindowBox->setValue(sConfig.get(CFG_QUINT32_ANALYZER_HOT_WINDOW));
+    ui->displayRateBox->setValue(sConfig.get(CFG_QUINT32_ANALYZER_DISPLAY_RATE));
+    ui->journalBox->setChecked(sConfig.get(CFG_BOOL_ANALYZER_JOURNAL));
+    ui->journalSyncBox->setValue(sConfig.get(CFG_QUINT32_JOURNAL_SYNC));
 
     ui->instanceBox->setChecked(sConfig.get(CFG_BOOL_ONE_INSTANCE));
     ui->connDlgBox->setChecked(sConfig.get(CFG_BOOL_CONN_ON_NEW_TAB));
     ui->updateBox->setChecked(sConfig.get(CFG_BOOL_CHECK_FOR_UPDATE));
     ui->soundsBox->setChecked(sConfig.get(CFG_BOOL_ENABLE_SOUNDS));
     ui->freezeTimeoutBox->setValue(sConfig.get(CFG_QUINT32_SCRIPT_FREEZE_TIMEOUT));
+    ui->scriptQueueBox->setValue(sConfig.get(CFG_QUINT32_SCRIPT_QUEUE_SIZE));
+    ui->scriptPolicyBox->setCurrentIndex(sConfig.get(CFG_QUINT32_SCRIPT_QUEUE_POLICY));
+    ui->scriptBudgetBox->setValue(sConfig.get(CFG_QUINT32_SCRIPT_CPU_BUDGET));
 }
 
 void SettingsDialog::on_buttonBox_clicked(QAbstractButton *btn)
@@ -90,6 +100,12 @@ void SettingsDialog::applySettings()
 
     sConfig.set(CFG_BOOL_SMOOTH_SCALING, ui->scaleBox->isChecked());
     sConfig.set(CFG_QUINT32_COMPRESS_BLOCK, ui->cmprBlock->value()*1024*1024);
+    sConfig.set(CFG_QUINT32_COMPRESS_CODEC, ui->cmprCodec->currentIndex() == 0 ? DATACODEC_ZSTD : DATACODEC_ZLIB);
+    sConfig.set(CFG_QUINT32_COMPRESS_LEVEL, ui->cmprLevel->value());
+    sConfig.set(CFG_QUINT32_ANALYZER_HOT_WINDOW, ui->hotWindowBox->value());
+    sConfig.set(CFG_QUINT32_ANALYZER_DISPLAY_RATE, ui->displayRateBox->value());
+    sConfig.set(CFG_BOOL_ANALYZER_JOURNAL, ui->journalBox->isChecked());
+    sConfig.set(CFG_QUINT32_JOURNAL_SYNC, ui->journalSyncBox->value());
 
     sConfig.set(CFG_BOOL_ONE_INSTANCE, ui->instanceBox->isChecked());
     sConfig.set(CFG_BOOL_CONN_ON_NEW_TAB, ui->connDlgBox->isChecked());
@@ -97,10 +113,15 @@ void SettingsDialog::applySettings()
     sConfig.set(CFG_BOOL_ENABLE_SOUNDS, ui->soundsBox->isChecked());
 
     sConfig.set(CFG_QUINT32_SCRIPT_FREEZE_TIMEOUT, ui->freezeTimeoutBox->value());
+    sConfig.set(CFG_QUINT32_SCRIPT_QUEUE_SIZE, ui->scriptQueueBox->value());
+    sConfig.set(CFG_QUINT32_SCRIPT_QUEUE_POLICY, ui->scriptPolicyBox->currentIndex());
+    sConfig.set(CFG_QUINT32_SCRIPT_CPU_BUDGET, ui->scriptBudgetBox->value());
 #ifdef WITH_PYTHON
     if(PythonQt::self())
         PythonQt::self()->setFreezeDetectorTimeoutMs(ui->freezeTimeoutBox->value());
 #endif
+
+    emit settingsApplied();
 }
 
 void SettingsDialog::setPortable(bool portable)
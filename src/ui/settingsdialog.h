@@ -19,6 +19,7 @@ class SettingsDialog : public QDialog
     Q_OBJECT
 Q_SIGNALS:
     void closeLorris();
+    void settingsApplied();
 
 public:
     explicit SettingsDialog(QWidget *parent = 0);
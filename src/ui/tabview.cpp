@@ -534,6 +534,7 @@ void TabView::showSettings()
 {
     SettingsDialog d(this);
     connect(&d, SIGNAL(closeLorris()), qApp, SLOT(closeAllWindows()));
+    connect(&d, SIGNAL(settingsApplied()), &sWorkTabMgr, SLOT(settingsChanged()));
     d.exec();
 }
 
@@ -36,10 +36,13 @@
 #include "terminal.h"
 #include "terminalsettings.h"
 
+// Size of data decoded at once when the terminal is redrawn
+#define REDRAW_PART_SIZE (64*1024)
+// Offset, 16 bytes in hex and as text
+#define HEX_LINE_LEN 78
+
 Terminal::Terminal(QWidget *parent) : QAbstractScrollArea(parent)
 {
-    m_data.reserve(512);
-
     setSizePolicy(QSizePolicy::Expanding, QSizePolicy::Expanding);
 
     QPalette p = palette();
@@ -50,7 +53,9 @@ Terminal::Terminal(QWidget *parent) : QAbstractScrollArea(parent)
     m_paused = false;
     m_fmt = FMT_MAX+1;
     m_input = INPUT_SEND_KEYPRESS;
-    m_hex_pos = 0;
+    m_hex_first_row = 0;
+    m_hex_pause_end = 0;
+    applyLimits();
 
     viewport()->setCursor(Qt::IBeamCursor);
     setFont(Utils::getMonospaceFont());
@@ -104,30 +109,42 @@ Terminal::~Terminal()
 
 void Terminal::appendText(const QByteArray& text)
 {
-    if(m_data.size()+text.size() > m_data.capacity())
-        while(m_data.capacity() < m_data.size()+text.size())
-            m_data.reserve(m_data.capacity()+512);
-
-    m_data.insert(m_data.end(), text.data(), text.data()+text.size());
+    m_data.append(text.data(), text.size());
 
     switch(m_fmt)
     {
-        case FMT_TEXT: addLines(QString::fromUtf8(text)); break;
-        case FMT_HEX:  addHex();       break;
+        case FMT_TEXT: addText(text.data(), text.size()); break;
+        case FMT_HEX:  trimHexRows();  break;
     }
+    trimLines();
 
     if(!m_paused)
         m_changed = true;
 }
 
-void Terminal::addLines(const QString &text)
+// m_decoded is reused, so that decoding does not allocate
+// anything once it is big enough
+void Terminal::addText(const char *data, quint32 len)
+{
+    m_decoded.clear();
+    m_decoder.decode(data, len, m_decoded);
+    if(!m_decoded.empty())
+        addLines(&m_decoded[0], &m_decoded[0] + m_decoded.size());
+}
+
+void Terminal::addLines(const QChar *begin, const QChar *end)
 {
     quint32 pos = m_cursor_pos.y();
-    QChar *line_start = (QChar*)text.data();
-    QChar *line_end = line_start;
+    const QChar *line_start = begin;
+    const QChar *line_end = line_start;
 
-    for(int i = 0; i < text.size(); ++i)
+    while(line_end != end)
     {
+        // Printable characters are skipped at once
+        line_end = findControlChar(line_end, end);
+        if(line_end == end)
+            break;
+
         switch((*line_end).unicode())
         {
             case '\f':
@@ -174,9 +191,13 @@ void Terminal::addLines(const QString &text)
                 }
                 else
                 {
-                    std::vector<QString>::iterator linePos = m_lines.begin() + pos;
-                    if(linePos == m_lines.end())
+                    // nothing to erase, but the character is consumed
+                    if(pos >= m_lines.size())
+                    {
+                        ++line_end;
+                        line_start = line_end;
                         break;
+                    }
 
                     if(m_cursor_pos.x() != 0)
                         --m_cursor_pos.rx();
@@ -184,15 +205,17 @@ void Terminal::addLines(const QString &text)
                     ++line_end;
                     ++line_start;
 
-                    if((*linePos).size() == 1)
-                        m_lines.erase(linePos);
-                    else
-                        (*linePos).chop(1);
+                    const quint32 len = m_lines.length(pos);
+                    if(len == 1)
+                        m_lines.remove(pos);
+                    else if(len != 0)
+                        m_lines.resize(pos, len - 1);
                 }
 
                 break;
             }
             case '\a':
+                addLine(pos, line_start, line_end);
                 if(m_settings.chars[SET_ALARM])
                     Utils::playErrorSound();
                 break;
@@ -201,11 +224,10 @@ void Terminal::addLines(const QString &text)
                 if(m_settings.chars[SET_REPLACE_TAB])
                 {
                     addLine(pos, line_start, line_end);
-                    std::vector<QString>::iterator linePos = m_lines.begin() + pos;
-                    if(linePos != m_lines.end())
+                    if(pos < m_lines.size())
                     {
-                        (*linePos).append(QByteArray(m_settings.tabReplace, ' '));
-                         m_cursor_pos.rx() += m_settings.tabReplace;
+                        m_lines.resize(pos, m_lines.length(pos) + m_settings.tabReplace);
+                        m_cursor_pos.rx() += m_settings.tabReplace;
                     }
                 }
                 else
@@ -216,18 +238,18 @@ void Terminal::addLines(const QString &text)
             {
                 if(!m_settings.chars[SET_IGNORE_NULL])
                 {
-                    i = text.size()+1;
+                    end = line_end;
                     break;
                 }
                 else
                 {
                     addLine(pos, line_start, line_end);
 
-                    std::vector<QString>::iterator linePos = m_lines.begin() + pos;
-                    if(linePos != m_lines.end())
-                        (*linePos).append('.');
+                    static const QChar dot('.');
+                    if(pos < m_lines.size())
+                        m_lines.write(pos, m_lines.length(pos), &dot, 1);
                     else
-                        m_lines.push_back(QString("."));
+                        m_lines.append(&dot, 1);
                     break;
                 }
             }
@@ -243,27 +265,18 @@ void Terminal::addLines(const QString &text)
         addLine(pos, line_start, line_end);
 }
 
-void Terminal::addLine(quint32 pos, QChar *&line_start, QChar *&line_end)
+void Terminal::addLine(quint32 pos, const QChar *&line_start, const QChar *&line_end)
 {
-    std::vector<QString>::iterator linePos = m_lines.begin() + pos;
-    if(linePos != m_lines.end())
+    const quint32 len = line_end - line_start;
+    if(pos < m_lines.size())
     {
-        if((line_end - line_start + m_cursor_pos.x()) > (*linePos).length())
-            (*linePos).resize(line_end - line_start + m_cursor_pos.x());
-
-        QChar *lineData = (*linePos).data()+m_cursor_pos.x();
-        std::copy(line_start, line_end, lineData);
-
-        m_cursor_pos.rx() += (line_end - line_start);
+        m_lines.write(pos, m_cursor_pos.x(), line_start, len);
+        m_cursor_pos.rx() += len;
     }
     else
     {
-        QChar tmp = *line_end;
-        *line_end = 0;
-        m_lines.insert(linePos, QString(line_start));
-        *line_end = tmp;
-
-        m_cursor_pos.setX(m_lines[pos].length());
+        m_lines.append(line_start, len);
+        m_cursor_pos.setX(len);
     }
 
     m_cursor_pos.setY(pos);
@@ -289,11 +302,10 @@ void Terminal::newlineChar(quint8 option, quint32& pos)
             if(m_cursor_pos.x() == 0)
                 break;
 
-            std::vector<QString>::iterator linePos = m_lines.begin() + pos;
-            if(linePos != m_lines.end() && m_cursor_pos.x() > (*linePos).size())
-                (*linePos).append(QByteArray(m_cursor_pos.x() - (*linePos).size(), ' '));
-            else
-                m_lines.push_back(QString(m_cursor_pos.x(), ' '));
+            if(pos >= m_lines.size())
+                m_lines.append(QString(m_cursor_pos.x(), ' ').constData(), m_cursor_pos.x());
+            else if((quint32)m_cursor_pos.x() > m_lines.length(pos))
+                m_lines.resize(pos, m_cursor_pos.x());
             break;
         }
         case NL_RETURN:
@@ -304,54 +316,130 @@ void Terminal::newlineChar(quint8 option, quint32& pos)
     }
 }
 
-void Terminal::addHex()
+// Hex rows are not stored, they are formatted from m_data when needed.
+// Row r has bytes from offset (first row + r)*16, rows before the oldest
+// byte are not shown.
+quint32 Terminal::hexRows()
 {
-    if(m_hex_pos%16 != 0)
-    {
-        m_hex_pos -= m_hex_pos%16;
-        m_lines.pop_back();
-    }
-
-    std::vector<char>::iterator chunk;
+    const quint64 end = m_paused ? m_hex_pause_end : m_data.endOffset();
+    if(end <= m_data.firstOffset())
+        return 0;
+    return (end + 15)/16 - m_data.firstOffset()/16;
+}
 
-    int chunk_size;
-    char *itr;
-    char line[78];
+// Fills line, which must have at least HEX_LINE_LEN chars, returns its length
+int Terminal::hexLine(quint32 row, char *line)
+{
+    static const char* hex = "0123456789ABCDEF";
 
-    line[8] = line[57] = line[58] = line[59] = ' ';
-    line[60] = line[77] = '|';
+    const quint64 end = m_paused ? m_hex_pause_end : m_data.endOffset();
+    const quint64 offset = (m_data.firstOffset()/16 + row)*16;
+    if(offset >= end)
+        return 0;
 
-    for(quint32 i = m_hex_pos; i < m_data.size(); i += 16)
-    {
-        itr = line;
-        chunk = m_data.begin()+m_hex_pos;
-        chunk_size = std::min(int(m_data.end() - chunk), 16);
+    // first row can be incomplete when the oldest data were overwritten
+    const int from = offset < m_data.firstOffset() ? m_data.firstOffset() - offset : 0;
+    const int to = (std::min)(end - offset, quint64(16));
 
-        static const char* hex = "0123456789ABCDEF";
-        for(int x = 7; x >= 0; --x, ++itr)
-            *itr = hex[(m_hex_pos >> x*4) & 0x0F];
-        ++itr;
+    char chunk[16];
+    m_data.copy(offset + from, to - from, chunk + from);
 
-        m_hex_pos += chunk_size;
+    char *itr = line;
+    for(int x = 7; x >= 0; --x, ++itr)
+        *itr = hex[(offset >> x*4) & 0x0F];
+    *(itr++) = ' ';
 
-        for(int x = 0; x < chunk_size; ++x)
+    for(int x = 0; x < 16; ++x)
+    {
+        if(x < from || x >= to)
+        {
+            *(itr++) = ' ';
+            *(itr++) = ' ';
+            line[61+x] = ' ';
+        }
+        else
         {
             *(itr++) = hex[quint8(chunk[x]) >> 4];
             *(itr++) = hex[quint8(chunk[x]) & 0x0F];
-            *(itr++) = ' ';
-
             line[61+x] = (chunk[x] < 32 || chunk[x] > 126) ? '.' : chunk[x];
         }
+        *(itr++) = ' ';
+    }
 
-        memset(itr, ' ', (16 - chunk_size)*3);
+    line[57] = line[58] = line[59] = ' ';
+    line[60] = '|';
+    line[61+to] = '|';
+    return 62+to;
+}
 
-        if(chunk_size != 16)
-            *(line + chunk_size + 61) = '|';
+void Terminal::trimHexRows()
+{
+    const quint64 first = m_data.firstOffset()/16;
+    const int removed = first - m_hex_first_row;
+    m_hex_first_row = first;
+
+    // Rows are formatted from the live data even when paused,
+    // so the view has to move in both cases
+    if(removed != 0)
+        shiftView(removed);
+}
 
-        m_lines.push_back(QString::fromLatin1(line, 62+chunk_size));
-    }
-    m_cursor_pos.setY(m_lines.size());
-    m_cursor_pos.setX(0);
+quint32 Terminal::lineCount()
+{
+    return m_fmt == FMT_HEX ? hexRows() : lines().size();
+}
+
+quint32 Terminal::lineLength(quint32 i)
+{
+    if(m_fmt != FMT_HEX)
+        return lines().length(i);
+
+    char line[HEX_LINE_LEN];
+    return hexLine(i, line);
+}
+
+QString Terminal::lineText(quint32 i)
+{
+    if(m_fmt != FMT_HEX)
+        return lines().line(i);
+
+    char line[HEX_LINE_LEN];
+    return QString::fromLatin1(line, hexLine(i, line));
+}
+
+void Terminal::trimLines()
+{
+    quint32 cut = 0;
+    const int removed = m_lines.trim(cut);
+    if(removed == 0 && cut == 0)
+        return;
+
+    m_cursor_pos.setY((std::max)(0, m_cursor_pos.y() - removed));
+    m_cursor_pos.setX((std::max)(0, m_cursor_pos.x() - (int)cut));
+
+    // Paused view is a copy, it has not changed
+    if(!m_paused && removed != 0)
+        shiftView(removed);
+}
+
+// Lines at the top were removed, selection and view are moved with the text
+void Terminal::shiftView(int removed)
+{
+    QPoint *sel[] = { &m_sel_start, &m_sel_begin, &m_sel_stop };
+    for(size_t i = 0; i < sizeof_array(sel); ++i)
+        sel[i]->setY((std::max)(0, sel[i]->y() - removed));
+
+    // Keep the view on the same lines, unless it follows the end
+    QScrollBar *bar = verticalScrollBar();
+    if(bar->value() != bar->maximum())
+        bar->setValue((std::max)(0, bar->value() - removed));
+}
+
+void Terminal::applyLimits()
+{
+    const quint32 size = (std::max)(1u, m_settings.scrollbackSize)*1024*1024;
+    m_data.setLimit(size);
+    m_lines.setLimits(m_settings.scrollbackLines, size/sizeof(QChar));
 }
 
 void Terminal::keyPressEvent(QKeyEvent *event)
@@ -452,16 +540,16 @@ void Terminal::copyToClipboard()
     int stop;
     for(quint32 i = m_sel_start.y(); i <= (quint32)m_sel_stop.y(); ++i)
     {
-        if(i >= lines().size())
+        if(i >= lineCount())
             break;
 
+        line = lineText(i);
         if(i == (quint32)m_sel_stop.y())
             stop = m_sel_stop.x() - m_sel_start.x();
         else
-            stop = lines()[i].length();
+            stop = line.length();
 
-        text += lines()[i].mid(start, stop);
-        line = lines()[i].mid(start, stop);
+        text += line.mid(start, stop);
 
         if(i != (quint32)m_sel_stop.y())
             text += "\r\n";
@@ -475,9 +563,12 @@ void Terminal::copyToClipboard()
 
 void Terminal::selectAll()
 {
+    if(lineCount() == 0)
+        return;
+
     m_sel_begin = m_sel_start = QPoint(0, 0);
-    m_sel_stop.setY(lines().size()-1);
-    m_sel_stop.setX(lines()[m_sel_stop.y()].length());
+    m_sel_stop.setY(lineCount()-1);
+    m_sel_stop.setX(lineLength(m_sel_stop.y()));
 
     viewport()->update();
 }
@@ -499,14 +590,8 @@ void Terminal::updateScrollBars()
 
     bool scroll = (verticalScrollBar()->value() == verticalScrollBar()->maximum());
 
-    int height = lines().size();
-    int width = 0;
-
-    for(std::size_t i = 0; i < lines().size(); ++i)
-    {
-        if(width < lines()[i].length())
-            width = lines()[i].length();
-    }
+    int height = lineCount();
+    int width = m_fmt == FMT_HEX ? HEX_LINE_LEN : lines().maxLength();
 
     verticalScrollBar()->setRange(0, height - areaSize.height()/m_char_height + 1);
     horizontalScrollBar()->setRange(0, width - areaSize.width()/m_char_width + 1);
@@ -531,7 +616,9 @@ void Terminal::paintEvent(QPaintEvent *)
     int y = 0;
     int x = 0;
 
-    QPoint& cursor = m_paused ? m_cursor_pause_pos : m_cursor_pos;
+    QPoint cursor = m_paused ? m_cursor_pause_pos : m_cursor_pos;
+    if(m_fmt == FMT_HEX)
+        cursor = QPoint(0, hexRows());
 
     // Draw cursor
     if(cursor.x() >= startX && (cursor.x() - startX) < width &&
@@ -570,10 +657,10 @@ void Terminal::paintEvent(QPaintEvent *)
 
         for(quint32 i = 0; i <= max; ++i,++textLine)
         {
-            if(textLine >= lines().size())
+            if(textLine >= lineCount())
                 continue;
 
-            int len = (lines()[textLine].length() - startX)*m_char_width;
+            int len = ((int)lineLength(textLine) - startX)*m_char_width;
             adjustSelectionWidth(w, i, max, len);
 
             QRect rec(x, y, w, m_char_height);
@@ -592,15 +679,24 @@ void Terminal::paintEvent(QPaintEvent *)
 
     painter.setPen(QPen(m_settings.colors[COLOR_TEXT]));
 
-    for(y = 0; (int)i < maxLines && i < lines().size(); ++i, y += m_char_height)
+    const std::size_t count = lineCount();
+    char hexLineBuf[HEX_LINE_LEN];
+    for(y = 0; (int)i < maxLines && i < count; ++i, y += m_char_height)
     {
-        QString& l = lines()[i];
+        if(m_fmt == FMT_HEX)
+        {
+            int len = std::min(hexLine(i, hexLineBuf) - startX, maxLen);
+            if(len > 0)
+                painter.drawText(0, y, viewport()->width(), m_char_height, 0,
+                                 QString::fromLatin1(hexLineBuf+startX, len));
+            continue;
+        }
 
-        int len = std::min(l.length() - startX, maxLen);
+        int len = std::min((int)lines().length(i) - startX, maxLen);
         if(len <= 0)
             continue;
         painter.drawText(0, y, viewport()->width(), m_char_height, 0,
-                         QString::fromRawData(l.data()+startX, len));
+                         QString::fromRawData(lines().data(i)+startX, len));
     }
 }
 
@@ -626,6 +722,7 @@ void Terminal::pause(bool pause)
     {
         m_pause_lines = m_lines;
         m_cursor_pause_pos = m_cursor_pos;
+        m_hex_pause_end = m_data.endOffset();
     }
     else
         m_pause_lines.clear();
@@ -639,12 +736,12 @@ void Terminal::pause(bool pause)
 void Terminal::clear()
 {
     m_data.clear();
-    m_data.reserve(512);
+    m_decoder.reset();
 
     m_lines.clear();
     m_pause_lines.clear();
     m_cursor_pos = m_cursor_pause_pos = QPoint(0, 0);
-    m_hex_pos = 0;
+    m_hex_first_row = 0;
 
     m_changed = true;
     updateScrollBars();
@@ -749,9 +846,21 @@ void Terminal::setFmt(int fmt)
 
 void Terminal::writeToFile(QFile *file)
 {
+    if(m_fmt == FMT_HEX)
+    {
+        char line[HEX_LINE_LEN+1];
+        for(quint32 i = 0; i < hexRows(); ++i)
+        {
+            const int len = hexLine(i, line);
+            line[len] = '\n';
+            file->write(line, len+1);
+        }
+        return;
+    }
+
     for(quint32 i = 0; i < lines().size(); ++i)
     {
-        file->write(lines()[i].toUtf8());
+        file->write(QString::fromRawData(lines().data(i), lines().length(i)).toUtf8());
         file->write("\n");
     }
 }
@@ -779,6 +888,7 @@ QString Terminal::getSettingsData()
 
     res += "|" + QString::number(m_fmt);
     res += "|" + QString::number(m_input);
+    res += QString("|%1;%2").arg(m_settings.scrollbackLines).arg(m_settings.scrollbackSize);
     return res;
 }
 
@@ -815,6 +925,19 @@ void Terminal::loadSettings(const QString& data)
 
     if(lst.size() >= 6)
         setInput(lst[5].toUInt());
+
+    if(lst.size() >= 7)
+    {
+        QStringList limits = lst[6].split(';', QString::SkipEmptyParts);
+        if(limits.size() >= 2)
+        {
+            m_settings.scrollbackLines = limits[0].toUInt();
+            m_settings.scrollbackSize = limits[1].toUInt();
+            applyLimits();
+            trimLines();
+            m_changed = true;
+        }
+    }
 }
 
 void Terminal::setFont(const QFont &f)
@@ -850,6 +973,7 @@ void Terminal::applySettings(const terminal_settings& set)
     p.setColor(QPalette::Text, m_settings.colors[COLOR_TEXT]);
     setPalette(p);
 
+    applyLimits();
     redrawAll();
 
     emit settingsChanged();
@@ -857,8 +981,9 @@ void Terminal::applySettings(const terminal_settings& set)
 
 void Terminal::redrawAll()
 {
+    m_decoder.reset();
     m_lines.clear();
-    m_hex_pos = 0;
+    m_hex_first_row = m_data.firstOffset()/16;
     m_cursor_pos = m_cursor_pause_pos = QPoint(0, 0);
 
     bool paused = m_paused;
@@ -866,9 +991,21 @@ void Terminal::redrawAll()
 
     switch(m_fmt)
     {
-        case FMT_TEXT: addLines(QString::fromUtf8(m_data.data(), m_data.size())); break;
-        case FMT_HEX:  addHex();         break;
+        case FMT_TEXT:
+        {
+            // Decoded in parts, to keep m_decoded small
+            const char *data = NULL;
+            for(quint64 off = m_data.firstOffset(); off < m_data.endOffset();)
+            {
+                const quint32 len = (std::min)(m_data.segment(off, &data), quint32(REDRAW_PART_SIZE));
+                addText(data, len);
+                off += len;
+            }
+            break;
+        }
+        case FMT_HEX:  break;
     }
+    trimLines();
 
     m_changed = true;
     updateScrollBars();
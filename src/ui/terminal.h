@@ -15,6 +15,8 @@
 #include <QTime>
 #include <QTimer>
 
+#include "terminalbuffer.h"
+
 class QMenu;
 class QByteArray;
 class QFile;
@@ -89,6 +91,8 @@ struct terminal_settings
         chars[SET_IGNORE_NULL] = 1;
         chars[SET_ENTER_SEND] = NLS_RN;
         tabReplace = 4;
+        scrollbackLines = 100000;
+        scrollbackSize = 16;
 
         colors[COLOR_BG] = Qt::black;
         colors[COLOR_TEXT] = Qt::white;
@@ -104,11 +108,15 @@ struct terminal_settings
             colors[i] = set.colors[i];
 
         tabReplace = set.tabReplace;
+        scrollbackLines = set.scrollbackLines;
+        scrollbackSize = set.scrollbackSize;
         font = set.font;
     }
 
     quint8 chars[SET_MAX];
     quint8 tabReplace;
+    quint32 scrollbackLines; // 0 means no limit
+    quint32 scrollbackSize;  // in MB, for received data and for their text
     QColor colors[COLOR_MAX];
     QFont font;
 };
@@ -131,7 +139,7 @@ public:
 
     QByteArray getData()
     {
-        return QByteArray(m_data.data(), m_data.size());
+        return m_data.toByteArray();
     }
 
     int getFmt() { return m_fmt; }
@@ -176,10 +184,19 @@ private slots:
 
 private:
     void handleInput(const QString &data, int key = 0);
-    void addLine(quint32 pos, QChar *&line_start, QChar *&line_end);
+    void addLine(quint32 pos, const QChar *&line_start, const QChar *&line_end);
     void newlineChar(quint8 option, quint32& pos);
-    void addLines(const QString& text);
-    void addHex();
+    void addText(const char *data, quint32 len);
+    void addLines(const QChar *begin, const QChar *end);
+    quint32 hexRows();
+    int hexLine(quint32 row, char *line);
+    void trimHexRows();
+    quint32 lineCount();
+    quint32 lineLength(quint32 i);
+    QString lineText(quint32 i);
+    void trimLines();
+    void shiftView(int removed);
+    void applyLimits();
     void redrawAll();
     QPoint mouseToTextPos(const QPoint& pos);
     QString getCurrNewlineStr(Qt::KeyboardModifiers modifiers);
@@ -188,21 +205,24 @@ private:
 
     inline void adjustSelectionWidth(int &w, quint32 i, quint32 max, int len);
 
-    inline std::vector<QString>& lines()
+    inline TerminalLines& lines()
     {
         return m_paused ? m_pause_lines : m_lines;
     }
 
-    std::vector<QString> m_lines;
-    std::vector<QString> m_pause_lines;
-    std::vector<char> m_data;
+    TerminalLines m_lines;
+    TerminalLines m_pause_lines;
+    TerminalData m_data;
+    Utf8Decoder m_decoder;
+    std::vector<QChar> m_decoded;
 
     QString m_command;
 
     bool m_paused;
     quint8 m_fmt;
     quint8 m_input;
-    int m_hex_pos;
+    quint64 m_hex_first_row;
+    quint64 m_hex_pause_end;
 
     int m_char_height;
     int m_char_width;
@@ -0,0 +1,342 @@
+/**********************************************
+**    This file is part of Lorris
+**    http://tasssadar.github.com/Lorris/
+**
+**    See README and COPYING
+***********************************************/
+
+#include <algorithm>
+#include <string.h>
+#include <limits.h>
+
+#include "terminalbuffer.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+ #include <emmintrin.h>
+ #define TERMINAL_SSE2
+#endif
+
+// Smallest allocation of TerminalData, it grows from here up to the limit
+#define DATA_MIN_CAPACITY 4096
+
+TerminalData::TerminalData()
+{
+    m_start = 0;
+    m_size = 0;
+    m_limit = UINT_MAX;
+    m_offset = 0;
+}
+
+void TerminalData::setLimit(quint32 bytes)
+{
+    m_limit = (std::max)(1u, bytes);
+    if(m_buf.size() > m_limit)
+        realloc(m_limit);
+}
+
+void TerminalData::append(const char *data, quint32 len)
+{
+    if(len == 0)
+        return;
+
+    if(len >= m_limit)
+    {
+        m_offset += m_size + (len - m_limit);
+        m_start = m_size = 0;
+        data += len - m_limit;
+        len = m_limit;
+    }
+
+    if(m_size + len > m_buf.size() && m_buf.size() < m_limit)
+    {
+        const quint32 cap = (std::max)(m_size + len, (std::max)(quint32(m_buf.size())*2, quint32(DATA_MIN_CAPACITY)));
+        realloc((std::min)(cap, m_limit));
+    }
+
+    // overwrite the oldest bytes
+    const quint32 cap = m_buf.size();
+    if(m_size + len > cap)
+    {
+        const quint32 drop = m_size + len - cap;
+        m_start = (m_start + drop) % cap;
+        m_size -= drop;
+        m_offset += drop;
+    }
+
+    const quint32 pos = (m_start + m_size) % cap;
+    const quint32 first = (std::min)(len, cap - pos);
+    memcpy(&m_buf[pos], data, first);
+    if(first != len)
+        memcpy(&m_buf[0], data + first, len - first);
+    m_size += len;
+}
+
+void TerminalData::clear()
+{
+    std::vector<char>().swap(m_buf);
+    m_offset = 0;
+    m_start = m_size = 0;
+}
+
+void TerminalData::copy(quint64 offset, quint32 len, char *dst) const
+{
+    Q_ASSERT(offset >= m_offset && offset + len <= endOffset());
+    if(len == 0)
+        return;
+
+    const quint32 cap = m_buf.size();
+    const quint32 pos = (m_start + quint32(offset - m_offset)) % cap;
+    const quint32 first = (std::min)(len, cap - pos);
+    memcpy(dst, &m_buf[pos], first);
+    if(first != len)
+        memcpy(dst + first, &m_buf[0], len - first);
+}
+
+quint32 TerminalData::segment(quint64 offset, const char **data) const
+{
+    Q_ASSERT(offset >= m_offset && offset <= endOffset());
+    if(offset == endOffset())
+        return 0;
+
+    const quint32 cap = m_buf.size();
+    const quint32 pos = (m_start + quint32(offset - m_offset)) % cap;
+    *data = &m_buf[pos];
+    return (std::min)(quint64(cap - pos), endOffset() - offset);
+}
+
+QByteArray TerminalData::toByteArray() const
+{
+    QByteArray res;
+    res.resize(m_size);
+    copy(m_offset, m_size, res.data());
+    return res;
+}
+
+// Moves the newest bytes which fit in capacity to new buffer
+void TerminalData::realloc(quint32 capacity)
+{
+    const quint32 keep = (std::min)(m_size, capacity);
+
+    std::vector<char> buf(capacity);
+    copy(endOffset() - keep, keep, buf.empty() ? NULL : &buf[0]);
+    m_buf.swap(buf);
+
+    m_offset += m_size - keep;
+    m_start = 0;
+    m_size = keep;
+}
+
+TerminalLines::TerminalLines()
+{
+    m_max_lines = 0;
+    m_max_chars = UINT_MAX;
+    m_max_len = 0;
+}
+
+void TerminalLines::setLimits(quint32 maxLines, quint32 maxChars)
+{
+    m_max_lines = maxLines;
+    m_max_chars = (std::max)(1u, maxChars);
+}
+
+void TerminalLines::append(const QChar *data, quint32 len)
+{
+    m_starts.push_back(m_chars.size());
+    m_chars.insert(m_chars.end(), data, data + len);
+    m_max_len = (std::max)(m_max_len, len);
+}
+
+void TerminalLines::write(quint32 line, quint32 col, const QChar *data, quint32 len)
+{
+    if(col + len > length(line))
+        resize(line, col + len);
+    std::copy(data, data + len, m_chars.begin() + m_starts[line] + col);
+}
+
+// Characters of the following lines are moved, which is cheap
+// for the last lines, where the cursor usually is
+void TerminalLines::resize(quint32 line, quint32 len)
+{
+    const quint32 start = m_starts[line];
+    const quint32 old = length(line);
+    if(len == old)
+        return;
+
+    if(len > old)
+    {
+        m_chars.insert(m_chars.begin() + start + old, len - old, QChar(' '));
+        for(quint32 i = line+1; i < m_starts.size(); ++i)
+            m_starts[i] += len - old;
+        m_max_len = (std::max)(m_max_len, len);
+    }
+    else
+    {
+        m_chars.erase(m_chars.begin() + start + len, m_chars.begin() + start + old);
+        for(quint32 i = line+1; i < m_starts.size(); ++i)
+            m_starts[i] -= old - len;
+    }
+}
+
+void TerminalLines::remove(quint32 line)
+{
+    resize(line, 0);
+    m_starts.erase(m_starts.begin() + line);
+    compact();
+}
+
+void TerminalLines::clear()
+{
+    std::vector<QChar>().swap(m_chars);
+    m_starts.clear();
+    m_max_len = 0;
+}
+
+quint32 TerminalLines::trim(quint32& cut)
+{
+    quint32 removed = 0;
+    cut = 0;
+
+    while(m_starts.size() > 1 &&
+          ((m_max_lines != 0 && m_starts.size() > m_max_lines) || m_chars.size() - m_starts.front() > m_max_chars))
+    {
+        m_starts.pop_front();
+        ++removed;
+    }
+
+    if(m_starts.size() == 1 && m_chars.size() - m_starts.front() > m_max_chars)
+    {
+        cut = m_chars.size() - m_starts.front() - m_max_chars;
+        m_starts.front() += cut;
+    }
+
+    compact();
+    return removed;
+}
+
+void TerminalLines::compact()
+{
+    const quint32 unused = m_starts.empty() ? m_chars.size() : m_starts.front();
+    if(unused == 0 || unused < m_chars.size() - unused)
+        return;
+
+    m_chars.erase(m_chars.begin(), m_chars.begin() + unused);
+    for(quint32 i = 0; i < m_starts.size(); ++i)
+        m_starts[i] -= unused;
+}
+
+// Converts ASCII characters until the first non-ASCII one
+static const uchar *decodeAscii(const uchar *itr, const uchar *end, QChar *&dst)
+{
+#ifdef TERMINAL_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    for(; end - itr >= 16; itr += 16, dst += 16)
+    {
+        const __m128i chunk = _mm_loadu_si128((const __m128i*)itr);
+        if(_mm_movemask_epi8(chunk) != 0)
+            break;
+        _mm_storeu_si128((__m128i*)dst, _mm_unpacklo_epi8(chunk, zero));
+        _mm_storeu_si128((__m128i*)(dst+8), _mm_unpackhi_epi8(chunk, zero));
+    }
+#endif
+    for(; itr != end && *itr < 0x80; ++itr, ++dst)
+        *dst = QChar(*itr);
+    return itr;
+}
+
+static inline QChar *putCodePoint(QChar *dst, quint32 cp)
+{
+    if(cp > 0xFFFF)
+    {
+        *dst++ = QChar(QChar::highSurrogate(cp));
+        *dst++ = QChar(QChar::lowSurrogate(cp));
+    }
+    else
+        *dst++ = QChar(cp);
+    return dst;
+}
+
+// Invalid sequences are replaced the way Unicode recommends, one U+FFFD
+// for each maximal part of a valid sequence. Overlong forms, surrogates
+// and code points above U+10FFFF are excluded by the allowed range
+// of the second byte.
+void Utf8Decoder::decode(const char *data, quint32 len, std::vector<QChar>& out)
+{
+    // one byte is at most one QChar, plus replacement
+    // of sequence unfinished in the last call
+    const size_t start = out.size();
+    out.resize(start + len + 1);
+
+    QChar *dst = &out[start];
+    const uchar *itr = (const uchar*)data;
+    const uchar *end = itr + len;
+    while(itr != end)
+    {
+        if(m_need != 0)
+        {
+            if(*itr < m_lower || *itr > m_upper)
+            {
+                *dst++ = QChar(0xFFFD);
+                m_need = 0;
+                continue;
+            }
+
+            m_cp = (m_cp << 6) | (*itr++ & 0x3F);
+            m_lower = 0x80;
+            m_upper = 0xBF;
+            if(--m_need == 0)
+                dst = putCodePoint(dst, m_cp);
+            continue;
+        }
+
+        if(*itr < 0x80)
+        {
+            itr = decodeAscii(itr, end, dst);
+            continue;
+        }
+
+        const uchar c = *itr++;
+        m_lower = 0x80;
+        m_upper = 0xBF;
+        if(c >= 0xC2 && c <= 0xDF)
+        {
+            m_cp = c & 0x1F;
+            m_need = 1;
+        }
+        else if(c >= 0xE0 && c <= 0xEF)
+        {
+            m_cp = c & 0x0F;
+            m_need = 2;
+            if(c == 0xE0)      m_lower = 0xA0;
+            else if(c == 0xED) m_upper = 0x9F;
+        }
+        else if(c >= 0xF0 && c <= 0xF4)
+        {
+            m_cp = c & 0x07;
+            m_need = 3;
+            if(c == 0xF0)      m_lower = 0x90;
+            else if(c == 0xF4) m_upper = 0x8F;
+        }
+        else
+            *dst++ = QChar(0xFFFD);
+    }
+
+    out.resize(dst - &out[0]);
+}
+
+const QChar *findControlChar(const QChar *itr, const QChar *end)
+{
+#ifdef TERMINAL_SSE2
+    // c - 0x1F saturates to zero for control characters
+    const __m128i limit = _mm_set1_epi16(0x1F);
+    const __m128i zero = _mm_setzero_si128();
+    for(; end - itr >= 8; itr += 8)
+    {
+        const __m128i chunk = _mm_loadu_si128((const __m128i*)itr);
+        if(_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_subs_epu16(chunk, limit), zero)) != 0)
+            break;
+    }
+#endif
+    while(itr != end && itr->unicode() >= 0x20)
+        ++itr;
+    return itr;
+}
@@ -0,0 +1,126 @@
+/**********************************************
+**    This file is part of Lorris
+**    http://tasssadar.github.com/Lorris/
+**
+**    See README and COPYING
+***********************************************/
+
+#ifndef TERMINALBUFFER_H
+#define TERMINALBUFFER_H
+
+#include <vector>
+#include <deque>
+#include <QChar>
+#include <QString>
+#include <QByteArray>
+
+// Received bytes of the Terminal. Ring buffer which grows
+// up to the limit, then the oldest bytes are overwritten.
+// Offsets are counted from the first byte ever appended.
+class TerminalData
+{
+public:
+    TerminalData();
+
+    void setLimit(quint32 bytes);
+
+    void append(const char *data, quint32 len);
+    void clear();
+
+    quint32 size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+
+    // Offset of the oldest stored byte and offset past the newest one
+    quint64 firstOffset() const { return m_offset; }
+    quint64 endOffset() const { return m_offset + m_size; }
+
+    // Copies len bytes starting at offset, they must be stored
+    void copy(quint64 offset, quint32 len, char *dst) const;
+    // Contiguous part of the data starting at offset, returns its length
+    quint32 segment(quint64 offset, const char **data) const;
+    QByteArray toByteArray() const;
+
+private:
+    void realloc(quint32 capacity);
+
+    std::vector<char> m_buf;
+    quint32 m_start;
+    quint32 m_size;
+    quint32 m_limit;
+    quint64 m_offset;
+};
+
+// Lines of the Terminal. Characters of all lines are in one array,
+// the index holds only start of each line, line ends where the next
+// one starts. Oldest lines are removed by trim() when the buffer is
+// over the limits, their space is reclaimed once it is larger
+// than the rest of the array.
+class TerminalLines
+{
+public:
+    TerminalLines();
+
+    // maxLines == 0 means lines are not limited, only their size
+    void setLimits(quint32 maxLines, quint32 maxChars);
+
+    quint32 size() const { return m_starts.size(); }
+    bool empty() const { return m_starts.empty(); }
+
+    quint32 length(quint32 line) const { return end(line) - m_starts[line]; }
+    // Valid until the buffer is changed
+    const QChar *data(quint32 line) const { return m_chars.empty() ? NULL : &m_chars[0] + m_starts[line]; }
+    QString line(quint32 line) const { return QString(data(line), length(line)); }
+
+    // Length of the longest line since the last clear()
+    quint32 maxLength() const { return m_max_len; }
+
+    void append(const QChar *data, quint32 len);
+    // Overwrites the line from column col, the line is extended
+    // as needed and padded with spaces when col is past its end
+    void write(quint32 line, quint32 col, const QChar *data, quint32 len);
+    void resize(quint32 line, quint32 len);
+    void remove(quint32 line);
+    void clear();
+
+    // Removes the oldest lines over the limits and returns their count.
+    // The last line is always kept, if it alone is over the limit,
+    // its beginning is cut off and the count of removed characters
+    // is returned in cut.
+    quint32 trim(quint32& cut);
+
+private:
+    quint32 end(quint32 line) const { return line+1 < m_starts.size() ? m_starts[line+1] : m_chars.size(); }
+    void compact();
+
+    std::vector<QChar> m_chars;
+    std::deque<quint32> m_starts;
+    quint32 m_max_lines;
+    quint32 m_max_chars;
+    quint32 m_max_len;
+};
+
+// Streaming UTF-8 decoder, sequence split between two chunks
+// is finished in the next decode() call. Invalid sequences
+// are replaced by U+FFFD like QString::fromUtf8() does.
+class Utf8Decoder
+{
+public:
+    Utf8Decoder() { reset(); }
+
+    void reset() { m_need = 0; }
+
+    // Appends decoded text to out
+    void decode(const char *data, quint32 len, std::vector<QChar>& out);
+
+private:
+    quint32 m_cp;
+    quint8 m_need;
+    // allowed range of the next byte
+    quint8 m_lower;
+    quint8 m_upper;
+};
+
+// First character below 0x20 or end
+const QChar *findControlChar(const QChar *itr, const QChar *end);
+
+#endif // TERMINALBUFFER_H
@@ -28,6 +28,8 @@ TerminalSettings::TerminalSettings(const terminal_settings &set, QWidget *parent
     ui->enterSendBox->setCurrentIndex(set.chars[SET_ENTER_SEND]);
 
     ui->widthBox->setValue(set.tabReplace);
+    ui->linesBox->setValue(set.scrollbackLines);
+    ui->scrollSizeBox->setValue(set.scrollbackSize);
     ui->fontBox->setCurrentFont(set.font);
     ui->sizeBox->setEditText(QString::number(set.font.pointSize()));
 
@@ -54,6 +56,8 @@ terminal_settings TerminalSettings::getSettings()
     set.chars[SET_ENTER_SEND] = ui->enterSendBox->currentIndex();
 
     set.tabReplace = ui->widthBox->value();
+    set.scrollbackLines = ui->linesBox->value();
+    set.scrollbackSize = ui->scrollSizeBox->value();
     set.font = ui->fontBox->currentFont();
 
     int size = ui->sizeBox->currentText().toUInt();